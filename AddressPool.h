@@ -0,0 +1,268 @@
+#ifndef ADDRESSPOOL_H
+#define ADDRESSPOOL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// All addresses a download host resolves to, with per-address throughput bookkeeping.
+// Segments are pinned to an address through CURLOPT_RESOLVE so parallel connections spread
+// over every edge a CDN hands out instead of piling onto the first A record. Addresses that
+// fail or deliver well below the best one are demoted and receive no further segments.
+class AddressPool {
+public:
+    struct Address {
+        std::string ip;
+        int family = AF_INET;
+        int active = 0;                 // segments currently transferring
+        long long bytes = 0;
+        double seconds = 0;
+        int failures = 0;
+        bool demoted = false;
+
+        double Throughput() const { return seconds > 0 ? bytes / seconds : 0; }
+    };
+
+private:
+    std::string host;
+    long port = 0;
+    std::vector<Address> addresses;
+    std::mutex mutex;
+
+    // Demote an address delivering less than this fraction of the best address
+    static constexpr double kDemoteRatio = 0.5;
+    static constexpr int kMaxFailures = 2;
+
+    static long DefaultPort(const std::string& scheme) {
+        if (scheme == "https") return 443;
+        if (scheme == "ftp") return 21;
+        if (scheme == "sftp") return 22;
+        return 80;
+    }
+
+    // Start a non-blocking connect; returns the socket or -1
+    static int StartConnect(const Address& address, long port) {
+        sockaddr_storage storage;
+        memset(&storage, 0, sizeof(storage));
+        socklen_t len;
+        if (address.family == AF_INET6) {
+            sockaddr_in6* sa = reinterpret_cast<sockaddr_in6*>(&storage);
+            sa->sin6_family = AF_INET6;
+            sa->sin6_port = htons((uint16_t)port);
+            inet_pton(AF_INET6, address.ip.c_str(), &sa->sin6_addr);
+            len = sizeof(sockaddr_in6);
+        } else {
+            sockaddr_in* sa = reinterpret_cast<sockaddr_in*>(&storage);
+            sa->sin_family = AF_INET;
+            sa->sin_port = htons((uint16_t)port);
+            inet_pton(AF_INET, address.ip.c_str(), &sa->sin_addr);
+            len = sizeof(sockaddr_in);
+        }
+        int fd = socket(address.family, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&storage), len) != 0 && errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Happy-eyeballs style race between the first IPv4 and first IPv6 address; the winning
+    // family is moved to the front so the first segments use it
+    void RaceFamilies() {
+        auto v4 = std::find_if(addresses.begin(), addresses.end(), [](const Address& a) { return a.family == AF_INET; });
+        auto v6 = std::find_if(addresses.begin(), addresses.end(), [](const Address& a) { return a.family == AF_INET6; });
+        if (v4 == addresses.end() || v6 == addresses.end()) {
+            return;
+        }
+
+        TraceSpan span("connect", "family_race");
+        int fds[2] = {StartConnect(*v4, port), StartConnect(*v6, port)};
+        int winner_family = 0;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!winner_family && std::chrono::steady_clock::now() < deadline) {
+            pollfd pfds[2];
+            int count = 0;
+            int families[2];
+            for (int i = 0; i < 2; ++i) {
+                if (fds[i] >= 0) {
+                    pfds[count].fd = fds[i];
+                    pfds[count].events = POLLOUT;
+                    families[count] = i == 0 ? AF_INET : AF_INET6;
+                    ++count;
+                }
+            }
+            if (count == 0 || poll(pfds, count, 250) < 0) break;
+            for (int i = 0; i < count && !winner_family; ++i) {
+                if (!(pfds[i].revents & (POLLOUT | POLLERR | POLLHUP))) continue;
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                if (error == 0) {
+                    winner_family = families[i];
+                } else {
+                    // This family failed; let the other one keep racing
+                    for (int& fd : fds) {
+                        if (fd == pfds[i].fd) { close(fd); fd = -1; }
+                    }
+                }
+            }
+        }
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+
+        if (winner_family) {
+            std::stable_partition(addresses.begin(), addresses.end(),
+                                  [winner_family](const Address& a) { return a.family == winner_family; });
+            LogInfo() << "Connection race won by " << (winner_family == AF_INET6 ? "IPv6" : "IPv4");
+        }
+    }
+
+    // Caller holds the mutex. The last healthy address is never demoted.
+    void Demote(int index, const char* reason) {
+        int healthy = 0;
+        for (const Address& a : addresses) {
+            if (!a.demoted) ++healthy;
+        }
+        if (healthy <= 1 || addresses[index].demoted) return;
+        addresses[index].demoted = true;
+        TraceRecorder::Instance().Instant("scheduler", "demote_address", "index", index);
+        LogWarning() << "Demoting " << addresses[index].ip << " (" << reason << ")";
+    }
+
+public:
+    // Resolve every address of the URL's host. Returns false if nothing could be resolved,
+    // in which case callers simply let curl resolve on its own.
+    bool Resolve(const std::string& url) {
+        TraceSpan span("probe", "resolve_all");
+        CURLU* parsed = curl_url();
+        char* host_part = nullptr;
+        char* port_part = nullptr;
+        char* scheme_part = nullptr;
+        bool ok = parsed && curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+                  curl_url_get(parsed, CURLUPART_HOST, &host_part, 0) == CURLUE_OK &&
+                  curl_url_get(parsed, CURLUPART_SCHEME, &scheme_part, 0) == CURLUE_OK;
+        if (ok) {
+            host = host_part;
+            port = curl_url_get(parsed, CURLUPART_PORT, &port_part, 0) == CURLUE_OK ? atol(port_part)
+                                                                                      : DefaultPort(scheme_part);
+        }
+        curl_free(host_part);
+        curl_free(port_part);
+        curl_free(scheme_part);
+        if (parsed) curl_url_cleanup(parsed);
+        if (!ok) {
+            return false;
+        }
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* result = nullptr;
+        std::string lookup = host;
+        if (lookup.size() > 2 && lookup.front() == '[') {
+            lookup = lookup.substr(1, lookup.size() - 2);
+        }
+        if (getaddrinfo(lookup.c_str(), nullptr, &hints, &result) != 0) {
+            return false;
+        }
+        for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+            char text[INET6_ADDRSTRLEN] = {0};
+            if (ai->ai_family == AF_INET) {
+                inet_ntop(AF_INET, &reinterpret_cast<sockaddr_in*>(ai->ai_addr)->sin_addr, text, sizeof(text));
+            } else if (ai->ai_family == AF_INET6) {
+                inet_ntop(AF_INET6, &reinterpret_cast<sockaddr_in6*>(ai->ai_addr)->sin6_addr, text, sizeof(text));
+            } else {
+                continue;
+            }
+            bool seen = std::any_of(addresses.begin(), addresses.end(), [&](const Address& a) { return a.ip == text; });
+            if (!seen) {
+                Address address;
+                address.ip = text;
+                address.family = ai->ai_family;
+                addresses.push_back(address);
+            }
+        }
+        freeaddrinfo(result);
+
+        RaceFamilies();
+        for (const Address& address : addresses) {
+            LogInfo() << "Resolved " << host << " -> " << address.ip;
+        }
+        return !addresses.empty();
+    }
+
+    size_t Size() const { return addresses.size(); }
+
+    // Choose an address for the next segment: least busy healthy address, ties broken by the
+    // best measured throughput. Returns -1 if there are none.
+    int Acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        int best = -1;
+        for (size_t i = 0; i < addresses.size(); ++i) {
+            const Address& a = addresses[i];
+            if (a.demoted) continue;
+            if (best < 0 || a.active < addresses[best].active ||
+                (a.active == addresses[best].active && a.Throughput() > addresses[best].Throughput())) {
+                best = (int)i;
+            }
+        }
+        if (best >= 0) {
+            addresses[best].active++;
+        }
+        return best;
+    }
+
+    // Record the outcome of a segment fetched through an address
+    void Release(int index, long long bytes, double seconds, bool success) {
+        if (index < 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Address& address = addresses[index];
+        address.active--;
+        address.bytes += bytes;
+        address.seconds += seconds;
+        if (!success && ++address.failures >= kMaxFailures) {
+            Demote(index, "repeated failures");
+        }
+
+        double best = 0;
+        for (const Address& a : addresses) {
+            if (!a.demoted) best = std::max(best, a.Throughput());
+        }
+        if (success && best > 0 && address.seconds > 1.0 && address.Throughput() < best * kDemoteRatio) {
+            Demote(index, "low throughput");
+        }
+    }
+
+    // CURLOPT_RESOLVE entry pinning the host to one address
+    std::string ResolveEntry(int index) const {
+        const Address& address = addresses[index];
+        std::string ip = address.family == AF_INET6 ? "[" + address.ip + "]" : address.ip;
+        std::string name = host;
+        if (name.size() > 2 && name.front() == '[') return "";   // literal IPv6 URL, nothing to pin
+        return name + ":" + std::to_string(port) + ":" + ip;
+    }
+
+    std::vector<Address> Snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return addresses;
+    }
+};
+
+#endif // ADDRESSPOOL_H
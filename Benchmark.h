@@ -0,0 +1,299 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Logger.h"
+
+// A/B comparison of download strategies against one URL. Every variant (single-threaded, then
+// multithreaded at each thread count of the sweep) runs N times. The variants take turns within
+// a round, and each round starts one variant later, so a drift in network conditions spreads
+// over all of them instead of favouring whichever ran first. Each request gets a unique query
+// parameter, so caches on the way return nothing that an earlier run fetched.
+//
+// Per variant the report gives the median and p95 time, the median throughput, and a 95%
+// bootstrap confidence interval for the median. The speedup is the baseline median over the
+// variant median, with a bootstrap interval of that ratio. Medians and bootstrap intervals
+// assume nothing about the distribution of download times, which is usually skewed by the
+// occasional slow run. The raw samples can be written as CSV, and samples plus summary as JSON.
+class DownloadComparison {
+public:
+    // Downloads url into filename and returns whether it succeeded
+    using RunFn = std::function<bool(const std::string& url, const std::string& filename)>;
+
+    struct Sample {
+        std::string variant;
+        int threads;
+        int run;
+        double ms;
+        long long bytes;
+        bool ok;
+    };
+
+    struct Summary {
+        std::string variant;
+        int threads = 0;
+        int runs = 0;                    // successful runs; failed ones are excluded
+        int failures = 0;
+        double median_ms = 0;
+        double p95_ms = 0;
+        double median_low_ms = 0;        // 95% confidence interval of the median
+        double median_high_ms = 0;
+        double mbit_s = 0;               // at the median time
+        double speedup = 0;              // baseline median / median
+        double speedup_low = 0;
+        double speedup_high = 0;
+    };
+
+private:
+    struct Variant {
+        std::string name;
+        int threads;
+        RunFn run;
+    };
+
+    static constexpr int kBootstrapResamples = 2000;
+    static constexpr double kConfidence = 0.95;
+
+    std::string url;
+    std::string scratch_file;
+    int runs;
+    bool cache_bust = true;
+    std::vector<Variant> variants;
+    std::vector<Sample> samples;
+    std::vector<Summary> summaries;
+
+    std::string BustedUrl(int request) const {
+        if (!cache_bust) return url;
+        size_t fragment = url.find('#');
+        std::string base = url.substr(0, fragment);
+        base += base.find('?') == std::string::npos ? '?' : '&';
+        base += "mtcompare=" + std::to_string((long long)getpid()) + "-" + std::to_string(request);
+        return fragment == std::string::npos ? base : base + url.substr(fragment);
+    }
+
+    // Linear interpolation between the closest ranks
+    static double Percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0;
+        std::sort(values.begin(), values.end());
+        double rank = p * (double)(values.size() - 1);
+        size_t low = (size_t)std::floor(rank);
+        size_t high = std::min(low + 1, values.size() - 1);
+        return values[low] + (values[high] - values[low]) * (rank - (double)low);
+    }
+
+    static std::vector<double> Resample(const std::vector<double>& values, std::mt19937& rng) {
+        std::uniform_int_distribution<size_t> pick(0, values.size() - 1);
+        std::vector<double> resampled(values.size());
+        for (double& value : resampled) {
+            value = values[pick(rng)];
+        }
+        return resampled;
+    }
+
+    static long long FileSize(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? (long long)info.st_size : 0;
+    }
+
+    static std::string JsonString(const std::string& text) {
+        std::string out = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) >= 0x20) {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    void Summarize() {
+        summaries.clear();
+        // Fixed seed: the same samples always give the same intervals
+        std::mt19937 rng(12345);
+        std::vector<double> baseline;
+        double alpha = (1 - kConfidence) / 2;
+
+        for (size_t v = 0; v < variants.size(); ++v) {
+            Summary summary;
+            summary.variant = variants[v].name;
+            summary.threads = variants[v].threads;
+            std::vector<double> times;
+            long long bytes = 0;
+            for (const Sample& sample : samples) {
+                if (sample.variant != summary.variant) continue;
+                if (!sample.ok) {
+                    ++summary.failures;
+                    continue;
+                }
+                times.push_back(sample.ms);
+                bytes = sample.bytes;
+            }
+            summary.runs = (int)times.size();
+            if (times.empty()) {
+                summaries.push_back(summary);
+                continue;
+            }
+            summary.median_ms = Percentile(times, 0.5);
+            summary.p95_ms = Percentile(times, 0.95);
+            summary.mbit_s = summary.median_ms > 0 ? bytes * 8 / 1e3 / summary.median_ms : 0;
+
+            std::vector<double> medians;
+            std::vector<double> ratios;
+            for (int i = 0; i < kBootstrapResamples; ++i) {
+                double median = Percentile(Resample(times, rng), 0.5);
+                medians.push_back(median);
+                if (!baseline.empty() && median > 0) {
+                    ratios.push_back(Percentile(Resample(baseline, rng), 0.5) / median);
+                }
+            }
+            summary.median_low_ms = Percentile(medians, alpha);
+            summary.median_high_ms = Percentile(medians, 1 - alpha);
+
+            // The first variant is the baseline the others are compared with
+            if (v == 0) {
+                baseline = times;
+                summary.speedup = summary.speedup_low = summary.speedup_high = 1;
+            } else if (!baseline.empty()) {
+                summary.speedup = Percentile(baseline, 0.5) / summary.median_ms;
+                summary.speedup_low = Percentile(ratios, alpha);
+                summary.speedup_high = Percentile(ratios, 1 - alpha);
+            }
+            summaries.push_back(summary);
+        }
+    }
+
+public:
+    // Runs download into scratch_file, which is deleted after every run
+    DownloadComparison(const std::string& url, int runs, const std::string& scratch_file)
+        : url(url), scratch_file(scratch_file), runs(std::max(runs, 1)) {}
+
+    // The first variant added is the baseline of the speedups
+    void AddVariant(const std::string& name, int threads, RunFn run) {
+        variants.push_back({name, threads, std::move(run)});
+    }
+
+    // Append a unique query parameter to every request (on by default); turn off for URLs
+    // whose signature covers the query string
+    void SetCacheBusting(bool enabled) {
+        cache_bust = enabled;
+    }
+
+    // Returns false if no run succeeded
+    bool Run() {
+        samples.clear();
+        int request = 0;
+        int total = runs * (int)variants.size();
+        for (int round = 0; round < runs; ++round) {
+            for (size_t i = 0; i < variants.size(); ++i) {
+                const Variant& variant = variants[(i + round) % variants.size()];
+                std::string run_url = BustedUrl(request++);
+
+                auto start = std::chrono::steady_clock::now();
+                bool ok = variant.run(run_url, scratch_file);
+                double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                long long bytes = ok ? FileSize(scratch_file) : 0;
+                std::remove(scratch_file.c_str());
+
+                samples.push_back({variant.name, variant.threads, round + 1, ms, bytes, ok});
+                std::cout << "[" << request << "/" << total << "] " << variant.name << ": "
+                          << (ok ? std::to_string((long long)ms) + " ms" : std::string("failed")) << std::endl;
+            }
+        }
+        Summarize();
+        return std::any_of(samples.begin(), samples.end(), [](const Sample& sample) { return sample.ok; });
+    }
+
+    void Report() const {
+        std::cout << "\n=== Comparison: " << runs << " runs per variant, " << url << " ===" << std::endl;
+        std::cout << std::left << std::setw(14) << "variant" << std::right
+                  << std::setw(8) << "runs" << std::setw(11) << "median ms" << std::setw(22) << "95% CI"
+                  << std::setw(10) << "p95 ms" << std::setw(10) << "Mbit/s" << std::setw(9) << "speedup"
+                  << std::setw(18) << "95% CI" << std::endl;
+        for (const Summary& summary : summaries) {
+            std::cout << std::left << std::setw(14) << summary.variant << std::right
+                      << std::setw(8) << summary.runs;
+            if (summary.runs == 0) {
+                std::cout << "  all runs failed" << std::endl;
+                continue;
+            }
+            char interval[64];
+            snprintf(interval, sizeof(interval), "[%.0f, %.0f]", summary.median_low_ms, summary.median_high_ms);
+            char speedup_interval[64];
+            snprintf(speedup_interval, sizeof(speedup_interval), "[%.2f, %.2f]", summary.speedup_low, summary.speedup_high);
+            std::cout << std::fixed << std::setprecision(0) << std::setw(11) << summary.median_ms << std::setw(22) << interval
+                      << std::setw(10) << summary.p95_ms << std::setprecision(1) << std::setw(10) << summary.mbit_s
+                      << std::setprecision(2) << std::setw(9) << summary.speedup << std::setw(18) << speedup_interval;
+            if (summary.failures > 0) {
+                std::cout << "  (" << summary.failures << " failed)";
+            }
+            std::cout << std::endl;
+        }
+        std::cout << "Speedups are relative to " << (summaries.empty() ? "" : summaries[0].variant)
+                  << "; an interval that includes 1.00 is no measurable difference." << std::endl;
+    }
+
+    // One row per run
+    bool WriteCsv(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            LogError() << "Failed to write " << path;
+            return false;
+        }
+        out << "variant,threads,run,ms,bytes,ok\n";
+        for (const Sample& sample : samples) {
+            out << sample.variant << "," << sample.threads << "," << sample.run << ","
+                << std::fixed << std::setprecision(3) << sample.ms << "," << sample.bytes << ","
+                << (sample.ok ? 1 : 0) << "\n";
+        }
+        return (bool)out;
+    }
+
+    // Summary per variant plus every sample
+    bool WriteJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) {
+            LogError() << "Failed to write " << path;
+            return false;
+        }
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"url\": " << JsonString(url) << ",\n  \"runs\": " << runs
+            << ",\n  \"confidence\": " << kConfidence << ",\n  \"variants\": [\n";
+        for (size_t i = 0; i < summaries.size(); ++i) {
+            const Summary& s = summaries[i];
+            out << "    {\"variant\": " << JsonString(s.variant) << ", \"threads\": " << s.threads
+                << ", \"runs\": " << s.runs << ", \"failures\": " << s.failures
+                << ", \"median_ms\": " << s.median_ms << ", \"median_ci_ms\": [" << s.median_low_ms << ", " << s.median_high_ms
+                << "], \"p95_ms\": " << s.p95_ms << ", \"mbit_s\": " << s.mbit_s
+                << ", \"speedup\": " << s.speedup << ", \"speedup_ci\": [" << s.speedup_low << ", " << s.speedup_high << "]}"
+                << (i + 1 < summaries.size() ? "," : "") << "\n";
+        }
+        out << "  ],\n  \"samples\": [\n";
+        for (size_t i = 0; i < samples.size(); ++i) {
+            const Sample& s = samples[i];
+            out << "    {\"variant\": " << JsonString(s.variant) << ", \"threads\": " << s.threads
+                << ", \"run\": " << s.run << ", \"ms\": " << s.ms << ", \"bytes\": " << s.bytes
+                << ", \"ok\": " << (s.ok ? "true" : "false") << "}" << (i + 1 < samples.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return (bool)out;
+    }
+
+    const std::vector<Summary>& Summaries() const { return summaries; }
+    const std::vector<Sample>& Samples() const { return samples; }
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,506 @@
+#ifndef CACHINGPROXY_H
+#define CACHINGPROXY_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "DownloadCache.h"
+#include "MiniHttpServer.h"
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// Local HTTP forward proxy that gives single-connection clients (package managers, build tools)
+// multi-connection speed. A large, cacheable GET is probed with HEAD and, if the origin accepts
+// ranges, fetched over several connections in segments taken in file order; the client is sent
+// the contiguous prefix as soon as it exists, so the first bytes arrive as fast as with a direct
+// download. The result goes through DownloadCache, so later clients (in this proxy or any other
+// process sharing the cache) get it from disk after revalidation. Everything else is relayed
+// unchanged; CONNECT is tunnelled, so HTTPS works but is not accelerated.
+class CachingProxy {
+private:
+    DownloadCache* cache;
+    int num_threads;
+    std::string spool_directory;
+    MiniHttpServer server;
+    std::atomic<unsigned long long> spool_counter{0};
+
+    static constexpr curl_off_t kMinAccelerateBytes = 4LL * 1024 * 1024;
+    static constexpr curl_off_t kSegmentSize = 4LL * 1024 * 1024;
+    static constexpr int kMaxSegmentAttempts = 3;
+
+    // What a HEAD of the target told us
+    struct Probe {
+        long status = 0;
+        curl_off_t length = -1;
+        bool accepts_ranges = false;
+        bool cacheable = true;
+        std::vector<std::pair<std::string, std::string>> headers;   // forwarded to the client
+    };
+
+    // Response headers that describe the connection rather than the resource
+    static bool HopByHop(const std::string& name) {
+        static const char* names[] = {"connection", "keep-alive", "proxy-connection", "proxy-authenticate",
+                                      "proxy-authorization", "te", "trailer", "transfer-encoding", "upgrade",
+                                      "content-length"};
+        for (const char* hop : names) {
+            if (strcasecmp(name.c_str(), hop) == 0) return true;
+        }
+        return false;
+    }
+
+    // Collects status and headers of the last response (a 100 Continue or redirect restarts it)
+    struct HeaderState {
+        long status = 0;
+        std::string reason;
+        std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+        size_t total = size * nitems;
+        HeaderState* state = static_cast<HeaderState*>(userdata);
+        std::string line(buffer, total);
+        line.erase(line.find_last_not_of("\r\n") + 1);
+        if (line.compare(0, 5, "HTTP/") == 0) {
+            state->headers.clear();
+            size_t space = line.find(' ');
+            state->status = space == std::string::npos ? 0 : atol(line.c_str() + space + 1);
+            size_t reason = space == std::string::npos ? std::string::npos : line.find(' ', space + 1);
+            state->reason = reason == std::string::npos ? "" : line.substr(reason + 1);
+            return total;
+        }
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            state->headers.emplace_back(line.substr(0, colon), value);
+        }
+        return total;
+    }
+
+    static void CommonOptions(CURL* curl, const std::string& url) {
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+    }
+
+    bool ProbeTarget(const std::string& url, Probe& probe) {
+        TraceSpan span("probe", "proxy_head");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return false;
+        }
+        HeaderState state;
+        CommonOptions(curl, url);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &state);
+        CURLcode res = curl_easy_perform(curl);
+        curl_easy_cleanup(curl);
+        if (res != CURLE_OK) {
+            return false;
+        }
+        probe.status = state.status;
+        for (const auto& header : state.headers) {
+            const std::string& name = header.first;
+            const std::string& value = header.second;
+            if (strcasecmp(name.c_str(), "content-length") == 0) {
+                probe.length = atoll(value.c_str());
+            } else if (strcasecmp(name.c_str(), "accept-ranges") == 0) {
+                probe.accepts_ranges = strcasecmp(value.c_str(), "bytes") == 0;
+            } else if (strcasecmp(name.c_str(), "cache-control") == 0) {
+                if (strcasestr(value.c_str(), "no-store") || strcasestr(value.c_str(), "private")) {
+                    probe.cacheable = false;
+                }
+            } else if (strcasecmp(name.c_str(), "content-encoding") == 0) {
+                probe.accepts_ranges = false;    // ranges of an encoded body are not worth the risk
+            }
+            if (!HopByHop(name) && strcasecmp(name.c_str(), "accept-ranges") != 0) {
+                probe.headers.push_back(header);
+            }
+        }
+        return true;
+    }
+
+    // Parallel range download into a spool file that the client is served from while it fills
+    class Accelerated {
+    public:
+        std::string url;
+        int fd;
+        curl_off_t length;
+        size_t segment_count;
+        std::vector<curl_off_t> done;          // bytes landed per segment, front to back
+        std::atomic<size_t> next_segment{0};
+        std::mutex mutex;
+        std::condition_variable progress;
+        bool failed = false;
+
+        Accelerated(const std::string& url, int fd, curl_off_t length)
+            : url(url), fd(fd), length(length),
+              segment_count((size_t)((length + kSegmentSize - 1) / kSegmentSize)), done(segment_count, 0) {}
+
+        ByteRange Segment(size_t index) const {
+            return ByteRange{(curl_off_t)index * kSegmentSize,
+                             std::min(length, (curl_off_t)(index + 1) * kSegmentSize) - 1};
+        }
+
+        // Bytes available from the start of the file without gaps; caller holds mutex
+        curl_off_t Prefix() const {
+            curl_off_t prefix = 0;
+            for (size_t i = 0; i < segment_count; ++i) {
+                prefix += done[i];
+                if (done[i] < Segment(i).Length()) break;
+            }
+            return prefix;
+        }
+
+        void Worker() {
+            while (true) {
+                size_t index = next_segment++;
+                if (index >= segment_count) return;
+                bool ok = false;
+                for (int attempt = 0; attempt < kMaxSegmentAttempts && !ok; ++attempt) {
+                    ByteRange range = Segment(index);
+                    {
+                        // A retry resumes after the bytes that already landed
+                        std::lock_guard<std::mutex> lock(mutex);
+                        range.start += done[index];
+                    }
+                    if (range.start > range.end) {
+                        ok = true;
+                        break;
+                    }
+                    TraceSpan span("transfer", "proxy_segment", "segment", (long long)index);
+                    std::vector<ByteRange> ranges{range};
+                    std::string error;
+                    ok = RangeFetcher::Fetch(url, ranges, [&](curl_off_t offset, const char* data, size_t len) {
+                        while (len > 0) {
+                            ssize_t n = pwrite(fd, data, len, offset);
+                            if (n < 0) {
+                                if (errno == EINTR) continue;
+                                return false;
+                            }
+                            data += n;
+                            len -= (size_t)n;
+                            offset += n;
+                            std::lock_guard<std::mutex> lock(mutex);
+                            done[index] += n;
+                        }
+                        progress.notify_all();
+                        return true;
+                    }, &error);
+                    if (!ok) {
+                        LogWarning() << "Proxy segment " << index << " of " << url << " failed: " << error;
+                    }
+                }
+                if (!ok) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    failed = true;
+                    progress.notify_all();
+                    return;
+                }
+            }
+        }
+    };
+
+    // Download url into spool_path while streaming it to the client; the body is sent only if
+    // the client is still connected, but the download always completes for the cache
+    bool AccelerateToClient(const std::string& url, const std::string& spool_path, const Probe& probe,
+                            HttpConnection& connection) {
+        int fd = open(spool_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ftruncate(fd, probe.length) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        Accelerated job(url, fd, probe.length);
+        int workers_wanted = (int)std::min<size_t>((size_t)num_threads, job.segment_count);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < workers_wanted; ++i) {
+            workers.emplace_back(&Accelerated::Worker, &job);
+        }
+
+        bool client_ok = connection.SendHead(200, "OK", probe.length, probe.headers);
+        curl_off_t sent = 0;
+        while (sent < probe.length) {
+            curl_off_t available;
+            {
+                std::unique_lock<std::mutex> lock(job.mutex);
+                job.progress.wait(lock, [&] { return job.failed || job.Prefix() > sent; });
+                if (job.failed) break;
+                available = job.Prefix();
+            }
+            if (client_ok) {
+                client_ok = connection.SendFileRange(fd, ByteRange{sent, available - 1});
+            }
+            sent = available;
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        close(fd);
+        if (job.failed || !client_ok) {
+            connection.Close();
+        }
+        return !job.failed;
+    }
+
+    // Serve a complete local file (cache hit)
+    static bool SendFile(const std::string& path, const Probe& probe, HttpConnection& connection) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        curl_off_t length = lseek(fd, 0, SEEK_END);
+        bool ok = connection.SendHead(200, "OK", length, probe.headers);
+        if (ok && length > 0) {
+            ok = connection.SendFileRange(fd, ByteRange{0, length - 1});
+        }
+        close(fd);
+        return ok;
+    }
+
+    // Relay one request to the origin and its response back, streaming
+    struct Relay {
+        HttpConnection* connection;
+        HeaderState headers;
+        bool head_sent = false;
+        bool head_only = false;
+
+        void SendHead() {
+            head_sent = true;
+            curl_off_t length = -1;
+            std::vector<std::pair<std::string, std::string>> forwarded;
+            for (const auto& header : headers.headers) {
+                if (strcasecmp(header.first.c_str(), "content-length") == 0) {
+                    length = atoll(header.second.c_str());
+                } else if (!HopByHop(header.first)) {
+                    forwarded.push_back(header);
+                }
+            }
+            if (strcasecmp(HeaderValue("transfer-encoding").c_str(), "chunked") == 0) {
+                length = -1;                     // curl de-chunks; the length is unknown
+            }
+            if (head_only && length < 0) length = 0;
+            if (headers.status == 204 || headers.status == 304) length = 0;
+            connection->SendHead((int)headers.status, headers.reason.empty() ? "OK" : headers.reason, length, forwarded);
+        }
+
+        std::string HeaderValue(const char* name) const {
+            for (const auto& header : headers.headers) {
+                if (strcasecmp(header.first.c_str(), name) == 0) return header.second;
+            }
+            return "";
+        }
+
+        static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+            Relay* relay = static_cast<Relay*>(userp);
+            if (!relay->head_sent) relay->SendHead();
+            return relay->connection->SendAll(static_cast<char*>(contents), size * nmemb) ? size * nmemb : 0;
+        }
+    };
+
+    void Passthrough(const std::string& url, const HttpRequest& request, HttpConnection& connection) {
+        TraceSpan span("transfer", "proxy_relay");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            connection.SendResponse(502, "Bad Gateway", "proxy error\n");
+            return;
+        }
+        Relay relay;
+        relay.connection = &connection;
+        relay.head_only = request.method == "HEAD";
+
+        struct curl_slist* headers = nullptr;
+        for (const auto& header : request.headers) {
+            if (HopByHop(header.first) || header.first == "host" || header.first == "expect") continue;
+            headers = curl_slist_append(headers, (header.first + ": " + header.second).c_str());
+        }
+        headers = curl_slist_append(headers, "Expect:");
+        if (request.headers.find("accept") == request.headers.end()) {
+            headers = curl_slist_append(headers, "Accept:");
+        }
+
+        CommonOptions(curl, url);
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, request.method.c_str());
+        if (relay.head_only) {
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        }
+        if (!request.body.empty()) {
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request.body.data());
+            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)request.body.size());
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &relay.headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, Relay::WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &relay);
+
+        CURLcode res = curl_easy_perform(curl);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+
+        if (res != CURLE_OK && !relay.head_sent) {
+            connection.SendResponse(502, "Bad Gateway", std::string(curl_easy_strerror(res)) + "\n");
+            return;
+        }
+        if (!relay.head_sent) {
+            relay.SendHead();
+        }
+        if (res != CURLE_OK) {
+            connection.Close();                  // body cut short; the client must not reuse the connection
+        }
+    }
+
+    // CONNECT host:port: splice bytes both ways until either side closes
+    void Tunnel(const HttpRequest& request, HttpConnection& connection) {
+        connection.Close();
+        std::string authority = request.target;
+        size_t colon = authority.rfind(':');
+        if (colon == std::string::npos) {
+            connection.SendResponse(400, "Bad Request", "CONNECT needs host:port\n");
+            return;
+        }
+        std::string host = authority.substr(0, colon);
+        std::string port = authority.substr(colon + 1);
+        if (host.size() > 2 && host.front() == '[') host = host.substr(1, host.size() - 2);
+
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* results = nullptr;
+        int upstream = -1;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &results) == 0) {
+            for (addrinfo* ai = results; ai && upstream < 0; ai = ai->ai_next) {
+                upstream = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+                if (upstream >= 0 && connect(upstream, ai->ai_addr, ai->ai_addrlen) != 0) {
+                    close(upstream);
+                    upstream = -1;
+                }
+            }
+            freeaddrinfo(results);
+        }
+        if (upstream < 0) {
+            connection.SendResponse(502, "Bad Gateway", "cannot reach " + authority + "\n");
+            return;
+        }
+        const char established[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        if (!connection.SendAll(established, sizeof(established) - 1)) {
+            close(upstream);
+            return;
+        }
+
+        TraceSpan span("transfer", "proxy_tunnel");
+        pollfd fds[2] = {{connection.Socket(), POLLIN, 0}, {upstream, POLLIN, 0}};
+        std::vector<char> buffer(64 * 1024);
+        bool open = true;
+        while (open && poll(fds, 2, -1) > 0) {
+            for (int i = 0; i < 2 && open; ++i) {
+                if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+                ssize_t n = recv(fds[i].fd, buffer.data(), buffer.size(), 0);
+                if (n <= 0) {
+                    open = false;
+                    break;
+                }
+                int target = fds[1 - i].fd;
+                for (ssize_t sent = 0; sent < n;) {
+                    ssize_t w = send(target, buffer.data() + sent, (size_t)(n - sent), MSG_NOSIGNAL);
+                    if (w <= 0) {
+                        open = false;
+                        break;
+                    }
+                    sent += w;
+                }
+            }
+        }
+        close(upstream);
+    }
+
+    void Handle(const HttpRequest& request, HttpConnection& connection) {
+        if (request.method == "CONNECT") {
+            Tunnel(request, connection);
+            return;
+        }
+        const std::string& url = request.target;
+        if (url.compare(0, 7, "http://") != 0) {
+            connection.SendResponse(400, "Bad Request", "this is a forward proxy; send absolute http:// URLs\n");
+            return;
+        }
+
+        // Only plain, anonymous, whole-file requests are shared through the cache
+        bool shareable = request.method == "GET" && request.body.empty() &&
+                         request.Header("authorization").empty() && request.Header("cookie").empty() &&
+                         request.Header("range").empty();
+        Probe probe;
+        if (!shareable || !ProbeTarget(url, probe) || probe.status != 200 || !probe.cacheable ||
+            !probe.accepts_ranges || probe.length < kMinAccelerateBytes) {
+            LogDebug() << request.method << " " << url << " -> relayed";
+            Passthrough(url, request, connection);
+            return;
+        }
+
+        TraceSpan span("session", "proxy_request");
+        std::string spool_path = spool_directory + "/" + std::to_string(getpid()) + "-" +
+                                 std::to_string(spool_counter++) + ".part";
+        bool fetched = false;
+        bool ok = cache->Fetch(url, spool_path, [&] {
+            fetched = true;
+            LogInfo() << "GET " << url << " -> accelerated (" << probe.length << " bytes)";
+            return AccelerateToClient(url, spool_path, probe, connection);
+        });
+        if (!fetched) {
+            if (ok) {
+                ok = SendFile(spool_path, probe, connection);
+            } else {
+                Passthrough(url, request, connection);
+            }
+        }
+        unlink(spool_path.c_str());
+    }
+
+public:
+    // cache is not owned; threads is the number of connections per accelerated download
+    CachingProxy(DownloadCache* cache, int threads = 4) : cache(cache), num_threads(threads > 0 ? threads : 1) {
+        spool_directory = cache->Directory() + "/spool";
+        mkdir(spool_directory.c_str(), 0755);
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~CachingProxy() {
+        server.Stop();
+        curl_global_cleanup();
+    }
+
+    // Listen on the loopback interface only: an open proxy must not be reachable from outside
+    bool Start(int port) {
+        if (!server.Start("127.0.0.1", port, [this](const HttpRequest& request, HttpConnection& connection) {
+                Handle(request, connection);
+            })) {
+            return false;
+        }
+        LogInfo() << "Proxy listening on 127.0.0.1:" << server.Port() << " with " << num_threads
+                  << " connections per accelerated download";
+        return true;
+    }
+
+    int Port() const { return server.Port(); }
+
+    void Stop() { server.Stop(); }
+};
+
+#endif // CACHINGPROXY_H
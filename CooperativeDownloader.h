@@ -0,0 +1,414 @@
+#ifndef COOPERATIVEDOWNLOADER_H
+#define COOPERATIVEDOWNLOADER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "Logger.h"
+#include "Sha256.h"
+#include "TraceRecorder.h"
+
+// Several downloader processes, on one host or many hosts sharing a volume (NFS, Lustre),
+// filling one output file together. Coordination happens through a segment map stored next to
+// the file (<file>.mtmap) and guarded with fcntl() locks, which network filesystems honour:
+//
+//   header   128 bytes  "MTMAP 1 size=<bytes> segment=<bytes> url=<hash>", space padded
+//   record    64 bytes  per segment: "<state> <owner, 40 chars> <lease expiry, unix time>\n"
+//                       state '.' free, 'C' claimed, 'D' done
+//
+// A process claims a free segment (or one whose lease expired because its owner died), fetches
+// it with a range request, writes it in place with pwrite(), syncs it and marks it done. Leases
+// are renewed while data keeps arriving; claims of crashed processes on the same host are taken
+// over at once. Every process returns once all segments are done, so each additional process
+// simply adds bandwidth. The map is kept after completion so that late joiners see the file is
+// already complete.
+class CooperativeDownloader {
+private:
+    std::string url;
+    std::string filename;
+    std::string map_filename;
+    int num_threads;
+    curl_off_t segment_size;
+
+    static constexpr size_t kHeaderSize = 128;
+    static constexpr size_t kRecordSize = 64;
+    static constexpr size_t kOwnerWidth = 40;
+    static constexpr long kLeaseSeconds = 60;           // a claim not renewed for this long is up for grabs
+    static constexpr long kRenewSeconds = 10;
+    static constexpr int kPollMilliseconds = 1000;      // wait between checks for others' segments
+
+    struct Record {
+        char state = '.';
+        std::string owner;
+        long long lease_expiry = 0;
+    };
+
+    int map_fd = -1;
+    int out_fd = -1;
+    std::string owner_id;                               // <host>/<host hash>:<pid>, see OwnerId()
+    curl_off_t file_size = -1;
+    size_t segment_count = 0;
+    std::string range_url;
+
+    // fcntl locks belong to the process, so they do not exclude our own threads
+    std::mutex map_mutex;
+    std::atomic<bool> failed{false};
+    std::atomic<long long> bytes_fetched{0};
+    std::atomic<int> segments_fetched{0};
+    std::shared_ptr<ProgressBoard> progress_board;
+
+    // Exclusive lock on the whole map, blocking; released on destruction
+    class MapLock {
+    private:
+        int fd;
+    public:
+        explicit MapLock(int fd) : fd(fd) {
+            struct flock fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type = F_WRLCK;
+            fl.l_whence = SEEK_SET;
+            while (fcntl(fd, F_SETLKW, &fl) != 0 && errno == EINTR) {
+            }
+        }
+        ~MapLock() {
+            struct flock fl;
+            memset(&fl, 0, sizeof(fl));
+            fl.l_type = F_UNLCK;
+            fl.l_whence = SEEK_SET;
+            fcntl(fd, F_SETLK, &fl);
+        }
+    };
+
+    std::string HeaderText() const {
+        char header[kHeaderSize + 1];
+        snprintf(header, sizeof(header), "MTMAP 1 size=%lld segment=%lld url=%s",
+                 (long long)file_size, (long long)segment_size, Sha256::Hash(url).substr(0, 32).c_str());
+        std::string text(header);
+        text.resize(kHeaderSize - 1, ' ');
+        return text + "\n";
+    }
+
+    off_t RecordOffset(size_t index) const { return (off_t)(kHeaderSize + index * kRecordSize); }
+
+    // Caller holds the map lock
+    Record ReadRecord(size_t index) const {
+        char buffer[kRecordSize];
+        Record record;
+        if (pread(map_fd, buffer, kRecordSize, RecordOffset(index)) != (ssize_t)kRecordSize) {
+            return record;
+        }
+        record.state = buffer[0];
+        record.owner = std::string(buffer + 2, kOwnerWidth);
+        record.owner.erase(record.owner.find_last_not_of(' ') + 1);
+        record.lease_expiry = atoll(buffer + 3 + kOwnerWidth);
+        return record;
+    }
+
+    // Caller holds the map lock
+    bool WriteRecord(size_t index, const Record& record) {
+        char buffer[kRecordSize + 1];
+        snprintf(buffer, sizeof(buffer), "%c %-40.40s %020lld\n", record.state, record.owner.c_str(),
+                 record.lease_expiry);
+        return pwrite(map_fd, buffer, kRecordSize, RecordOffset(index)) == (ssize_t)kRecordSize;
+    }
+
+    bool ProbeSize() {
+        TraceSpan span("probe", "head_size");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return false;
+        }
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+        CURLcode res = curl_easy_perform(curl);
+        long response_code = 0;
+        char* effective = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &file_size);
+        curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effective);
+        range_url = effective ? effective : url;
+        curl_easy_cleanup(curl);
+        if (res != CURLE_OK || response_code < 200 || response_code >= 300 || file_size <= 0) {
+            LogError() << "Cannot determine the size of " << url << ": "
+                       << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Open or create the map and the output file; the first process to lock an empty map
+    // lays it out, everyone else checks that it describes the same download
+    bool OpenMap() {
+        map_fd = open(map_filename.c_str(), O_RDWR | O_CREAT, 0644);
+        out_fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (map_fd < 0 || out_fd < 0) {
+            LogError() << "Failed to open " << (map_fd < 0 ? map_filename : filename) << ": " << strerror(errno);
+            return false;
+        }
+        segment_count = (size_t)((file_size + segment_size - 1) / segment_size);
+
+        MapLock lock(map_fd);
+        struct stat st;
+        fstat(map_fd, &st);
+        std::string header = HeaderText();
+        if (st.st_size == 0) {
+            if (ftruncate(out_fd, file_size) != 0 ||
+                pwrite(map_fd, header.data(), header.size(), 0) != (ssize_t)header.size()) {
+                LogError() << "Failed to initialize " << map_filename << ": " << strerror(errno);
+                return false;
+            }
+            for (size_t i = 0; i < segment_count; ++i) {
+                if (!WriteRecord(i, Record())) {
+                    LogError() << "Failed to initialize " << map_filename << ": " << strerror(errno);
+                    return false;
+                }
+            }
+            fsync(map_fd);
+            LogInfo() << "Created segment map with " << segment_count << " segments";
+            return true;
+        }
+
+        std::string existing(kHeaderSize, '\0');
+        if (pread(map_fd, &existing[0], kHeaderSize, 0) != (ssize_t)kHeaderSize || existing != header ||
+            st.st_size != (off_t)(kHeaderSize + segment_count * kRecordSize)) {
+            LogError() << map_filename << " belongs to a different download (URL, size or segment size differ)";
+            return false;
+        }
+        LogInfo() << "Joining download through existing segment map";
+        return true;
+    }
+
+    // Owner ids must fit the record's owner field whole, or our own claims stop matching. Long
+    // hostnames are cut to kOwnerHostChars for readability; the hash of the full name keeps hosts
+    // that share a prefix apart. pid_t fits in 10 digits.
+    static constexpr size_t kOwnerHostChars = 16;
+
+    static std::string OwnerId(const std::string& host, pid_t pid) {
+        std::string id = host.substr(0, kOwnerHostChars) + "/" + Sha256::Hash(host).substr(0, 12) + ":" +
+                         std::to_string(pid);
+        static_assert(kOwnerHostChars + 1 + 12 + 1 + 10 <= kOwnerWidth, "owner id must fit its field");
+        return id;
+    }
+
+    // A claim by a process on this host that no longer exists need not wait for its lease
+    bool OwnerDead(const std::string& owner) const {
+        size_t colon = owner.rfind(':');
+        if (colon == std::string::npos || owner.compare(0, colon, owner_id, 0, owner_id.rfind(':')) != 0) {
+            return false;
+        }
+        pid_t pid = (pid_t)atol(owner.c_str() + colon + 1);
+        return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+    }
+
+    // Claim a free or abandoned segment. Returns its index, kAllDone when every segment is
+    // done, or kNoneFree when the remaining ones are being fetched by others.
+    static constexpr long kAllDone = -1;
+    static constexpr long kNoneFree = -2;
+
+    long Claim() {
+        std::lock_guard<std::mutex> guard(map_mutex);
+        MapLock lock(map_fd);
+        long long now = time(nullptr);
+        bool all_done = true;
+        for (size_t i = 0; i < segment_count; ++i) {
+            Record record = ReadRecord(i);
+            if (record.state == 'D') continue;
+            all_done = false;
+            if (record.state == 'C' && record.lease_expiry > now && !OwnerDead(record.owner)) continue;
+            if (record.state == 'C') {
+                LogWarning() << "Taking over segment " << i << " from " << record.owner << " (owner gone)";
+            }
+            Record claim;
+            claim.state = 'C';
+            claim.owner = owner_id;
+            claim.lease_expiry = now + kLeaseSeconds;
+            if (!WriteRecord(i, claim)) {
+                LogError() << "Failed to update " << map_filename << ": " << strerror(errno);
+                failed = true;
+                return kAllDone;
+            }
+            return (long)i;
+        }
+        return all_done ? kAllDone : kNoneFree;
+    }
+
+    // Extend our lease; false if the segment was taken over in the meantime
+    bool Renew(size_t index) {
+        std::lock_guard<std::mutex> guard(map_mutex);
+        MapLock lock(map_fd);
+        Record record = ReadRecord(index);
+        if (record.state != 'C' || record.owner != owner_id) {
+            return false;
+        }
+        record.lease_expiry = time(nullptr) + kLeaseSeconds;
+        return WriteRecord(index, record);
+    }
+
+    void Finish(size_t index, bool done) {
+        std::lock_guard<std::mutex> guard(map_mutex);
+        MapLock lock(map_fd);
+        Record record = ReadRecord(index);
+        if (record.owner != owner_id) {
+            return;     // someone else took it over; their outcome counts
+        }
+        record.state = done ? 'D' : '.';
+        record.lease_expiry = 0;
+        if (!done) record.owner.clear();
+        WriteRecord(index, record);
+    }
+
+    bool FetchSegment(size_t index) {
+        TraceSpan span("transfer", "segment", "segment", (long long)index);
+        ByteRange range{(curl_off_t)index * segment_size,
+                        std::min(file_size, (curl_off_t)(index + 1) * segment_size) - 1};
+        if (progress_board) {
+            progress_board->SetTotal((int)index, range.Length());
+        }
+        auto last_renewal = std::chrono::steady_clock::now();
+        curl_off_t done = 0;
+        bool lease_lost = false;
+        std::string error;
+        std::vector<ByteRange> ranges{range};
+        bool ok = RangeFetcher::Fetch(range_url, ranges, [&](curl_off_t offset, const char* data, size_t len) {
+            while (len > 0) {
+                ssize_t n = pwrite(out_fd, data, len, offset);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    LogError() << "Disk write failed: " << strerror(errno);
+                    return false;
+                }
+                data += n;
+                len -= (size_t)n;
+                offset += n;
+                done += n;
+            }
+            if (progress_board) progress_board->SetDone((int)index, done);
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_renewal > std::chrono::seconds(kRenewSeconds)) {
+                last_renewal = now;
+                if (!Renew(index)) {
+                    lease_lost = true;
+                    return false;
+                }
+            }
+            return true;
+        }, &error);
+
+        if (lease_lost) {
+            LogWarning() << "Segment " << index << " was taken over by another process";
+            return false;
+        }
+        if (!ok) {
+            LogError() << "Segment " << index << " failed: " << error;
+            return false;
+        }
+        // Make the bytes visible to other nodes before the map says they are there
+        if (fdatasync(out_fd) != 0) {
+            LogError() << "Failed to sync " << filename << ": " << strerror(errno);
+            return false;
+        }
+        bytes_fetched += range.Length();
+        segments_fetched++;
+        return true;
+    }
+
+    void Worker(int worker_id) {
+        TraceRecorder::Instance().SetThreadName("worker " + std::to_string(worker_id));
+        int consecutive_failures = 0;
+        while (!failed) {
+            long index = Claim();
+            if (index == kAllDone) {
+                return;
+            }
+            if (index == kNoneFree) {
+                // Remaining segments belong to live processes; wait in case one of them dies
+                std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+                continue;
+            }
+            bool ok = FetchSegment((size_t)index);
+            Finish((size_t)index, ok);
+            consecutive_failures = ok ? 0 : consecutive_failures + 1;
+            if (consecutive_failures >= 3) {
+                LogError() << "Giving up after repeated segment failures";
+                failed = true;
+            }
+        }
+    }
+
+public:
+    CooperativeDownloader(const std::string& url, const std::string& filename, int threads = 4,
+                          curl_off_t segment_size = 16LL * 1024 * 1024)
+        : url(url), filename(filename), map_filename(filename + ".mtmap"), num_threads(threads > 0 ? threads : 1),
+          segment_size(segment_size > 0 ? segment_size : 16LL * 1024 * 1024) {
+        char host[256] = {0};
+        gethostname(host, sizeof(host) - 1);
+        owner_id = OwnerId(host, getpid());
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~CooperativeDownloader() {
+        if (map_fd >= 0) close(map_fd);
+        if (out_fd >= 0) close(out_fd);
+        curl_global_cleanup();
+    }
+
+    bool Download() {
+        TraceSpan session_span("session", "cooperative_download");
+        LogInfo() << "Starting cooperative download as " << owner_id << "...";
+        LogInfo() << "URL: " << url;
+        LogInfo() << "Filename: " << filename;
+
+        if (!ProbeSize() || !OpenMap()) {
+            return false;
+        }
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_board = Logger::Instance().BeginProgress("download", (int)segment_count);
+        }
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < num_threads; ++i) {
+            workers.emplace_back(&CooperativeDownloader::Worker, this, i);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        if (progress_board) {
+            Logger::Instance().EndProgress(progress_board);
+            progress_board.reset();
+        }
+
+        if (failed) {
+            LogError() << "Cooperative download failed; other processes (or a rerun) can finish it";
+            return false;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        LogInfo() << "Download completed successfully!";
+        LogInfo() << "This process fetched " << segments_fetched << " of " << segment_count << " segments ("
+                  << bytes_fetched << " bytes)";
+        LogInfo() << "Total time: " << duration.count() << " ms";
+        return true;
+    }
+};
+
+#endif // COOPERATIVEDOWNLOADER_H
@@ -0,0 +1,406 @@
+#ifndef DELTADOWNLOADER_H
+#define DELTADOWNLOADER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "Logger.h"
+#include "Sha256.h"
+#include "TraceRecorder.h"
+
+// Block checksum manifest published next to a file (zsync-style). Text format:
+//
+//   MTDELTA 1
+//   length: <file size>
+//   blocksize: <bytes>
+//   sha256: <whole-file digest>
+//   <weak checksum hex> <strong checksum hex>     one line per block
+//
+// The weak checksum is the rsync rolling checksum, the strong one is a truncated SHA-256.
+struct DeltaManifest {
+    curl_off_t length = 0;
+    size_t block_size = 0;
+    std::string file_hash;
+    std::vector<uint32_t> weak;
+    std::vector<std::string> strong;
+
+    static constexpr size_t kStrongHexLength = 32;
+
+    size_t BlockCount() const { return weak.size(); }
+
+    size_t BlockLength(size_t index) const {
+        curl_off_t start = (curl_off_t)index * block_size;
+        return (size_t)std::min<curl_off_t>(block_size, length - start);
+    }
+
+    // rsync weak checksum of a whole window
+    static uint32_t WeakChecksum(const unsigned char* data, size_t len) {
+        uint32_t a = 0, b = 0;
+        for (size_t i = 0; i < len; ++i) {
+            a += data[i];
+            b += (uint32_t)(len - i) * data[i];
+        }
+        return (a & 0xffff) | (b << 16);
+    }
+
+    static std::string StrongChecksum(const unsigned char* data, size_t len) {
+        return Sha256::Hash(data, len).substr(0, kStrongHexLength);
+    }
+
+    bool Parse(const std::string& text) {
+        std::istringstream in(text);
+        std::string line;
+        if (!std::getline(in, line) || line.compare(0, 9, "MTDELTA 1") != 0) {
+            return false;
+        }
+        while (std::getline(in, line)) {
+            if (line.compare(0, 8, "length: ") == 0) length = atoll(line.c_str() + 8);
+            else if (line.compare(0, 11, "blocksize: ") == 0) block_size = (size_t)atoll(line.c_str() + 11);
+            else if (line.compare(0, 8, "sha256: ") == 0) file_hash = line.substr(8);
+            else if (line.size() > kStrongHexLength) {
+                std::istringstream fields(line);
+                std::string weak_hex, strong_hex;
+                fields >> weak_hex >> strong_hex;
+                weak.push_back((uint32_t)strtoul(weak_hex.c_str(), nullptr, 16));
+                strong.push_back(strong_hex);
+            }
+        }
+        size_t expected = block_size ? (size_t)((length + block_size - 1) / block_size) : 0;
+        return block_size > 0 && length > 0 && weak.size() == expected;
+    }
+
+    // Download and parse a published manifest
+    bool Fetch(const std::string& manifest_url) {
+        TraceSpan span("probe", "delta_manifest");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return false;
+        }
+        std::string body;
+        curl_easy_setopt(curl, CURLOPT_URL, manifest_url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](void* contents, size_t size, size_t nmemb, void* userp) {
+            static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+            return size * nmemb;
+        });
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+        CURLcode res = curl_easy_perform(curl);
+        long response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_easy_cleanup(curl);
+
+        if (res != CURLE_OK || response_code >= 400) {
+            LogError() << "Failed to fetch delta manifest " << manifest_url << ": "
+                       << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            return false;
+        }
+        if (!Parse(body)) {
+            LogError() << "Invalid delta manifest: " << manifest_url;
+            return false;
+        }
+        return true;
+    }
+
+    // Build the manifest for a local file (run by whoever publishes the file)
+    static bool Generate(const std::string& path, size_t block_size, const std::string& manifest_path) {
+        std::ifstream file(path, std::ios::binary);
+        std::ofstream out(manifest_path);
+        if (!file.is_open() || !out.is_open() || block_size == 0) {
+            return false;
+        }
+        std::ostringstream blocks;
+        std::vector<unsigned char> buffer(block_size);
+        Sha256 whole;
+        curl_off_t length = 0;
+        while (file) {
+            file.read(reinterpret_cast<char*>(buffer.data()), block_size);
+            size_t got = (size_t)file.gcount();
+            if (got == 0) break;
+            whole.Update(buffer.data(), got);
+            length += got;
+            char weak_hex[9];
+            snprintf(weak_hex, sizeof(weak_hex), "%08x", WeakChecksum(buffer.data(), got));
+            blocks << weak_hex << " " << StrongChecksum(buffer.data(), got) << "\n";
+        }
+        out << "MTDELTA 1\n"
+            << "length: " << length << "\n"
+            << "blocksize: " << block_size << "\n"
+            << "sha256: " << whole.HexDigest() << "\n"
+            << blocks.str();
+        return out.good();
+    }
+};
+
+// Rebuilds a new version of a remote file from an older local copy: blocks whose checksums
+// match somewhere in the old file are copied locally, and only the remaining gaps are fetched,
+// several gaps per request (multi-range), across parallel connections.
+class DeltaDownloader {
+private:
+    std::string url;
+    std::string manifest_url;
+    std::string old_filename;
+    std::string filename;
+    int num_threads;
+
+    // Gaps batched into one multi-range request
+    static constexpr size_t kRangesPerRequest = 32;
+    static constexpr curl_off_t kBytesPerRequest = 16LL * 1024 * 1024;
+
+
+    // Roll the weak checksum over the old file; for every block of the new file that also
+    // occurs in the old one, record where (offset in the old file, or -1 if missing)
+    std::vector<curl_off_t> MatchBlocks(const DeltaManifest& manifest, const unsigned char* old_data, size_t old_size) {
+        TraceSpan span("delta", "match_blocks");
+        std::vector<curl_off_t> source(manifest.BlockCount(), -1);
+        const size_t block = manifest.block_size;
+        if (old_size < block) {
+            return source;
+        }
+
+        std::unordered_map<uint32_t, std::vector<size_t>> by_weak;
+        for (size_t i = 0; i < manifest.BlockCount(); ++i) {
+            // A short final block is only matched if it sits at the very end of the old file
+            if (manifest.BlockLength(i) == block) {
+                by_weak[manifest.weak[i]].push_back(i);
+            }
+        }
+
+        size_t last = manifest.BlockCount() - 1;
+        size_t tail = manifest.BlockLength(last);
+        if (tail != block && old_size >= tail) {
+            const unsigned char* candidate = old_data + old_size - tail;
+            if (DeltaManifest::WeakChecksum(candidate, tail) == manifest.weak[last] &&
+                DeltaManifest::StrongChecksum(candidate, tail) == manifest.strong[last]) {
+                source[last] = (curl_off_t)(old_size - tail);
+            }
+        }
+
+        uint32_t a = 0, b = 0;
+        for (size_t i = 0; i < block; ++i) {
+            a += old_data[i];
+            b += (uint32_t)(block - i) * old_data[i];
+        }
+
+        size_t pos = 0;
+        while (true) {
+            uint32_t weak = (a & 0xffff) | (b << 16);
+            bool matched = false;
+            auto it = by_weak.find(weak);
+            if (it != by_weak.end()) {
+                std::string strong;
+                for (size_t index : it->second) {
+                    if (source[index] >= 0) continue;
+                    if (strong.empty()) strong = DeltaManifest::StrongChecksum(old_data + pos, block);
+                    if (strong == manifest.strong[index]) {
+                        source[index] = (curl_off_t)pos;
+                        matched = true;
+                    }
+                }
+            }
+
+            // After a match skip a whole block (blocks rarely overlap), otherwise slide one byte
+            size_t step = matched ? block : 1;
+            if (pos + step + block > old_size) break;
+            if (matched) {
+                pos += block;
+                a = b = 0;
+                for (size_t i = 0; i < block; ++i) {
+                    a += old_data[pos + i];
+                    b += (uint32_t)(block - i) * old_data[pos + i];
+                }
+            } else {
+                unsigned char out = old_data[pos];
+                unsigned char in = old_data[pos + block];
+                a = a - out + in;
+                b = b - (uint32_t)block * out + a;
+                ++pos;
+            }
+        }
+        return source;
+    }
+
+    // Turn missing blocks into coalesced gaps, then group gaps into multi-range requests
+    std::vector<std::vector<ByteRange>> PlanRequests(const DeltaManifest& manifest, const std::vector<curl_off_t>& source) {
+        std::vector<ByteRange> gaps;
+        for (size_t i = 0; i < source.size(); ++i) {
+            if (source[i] >= 0) continue;
+            curl_off_t start = (curl_off_t)i * manifest.block_size;
+            gaps.push_back({start, start + (curl_off_t)manifest.BlockLength(i) - 1});
+        }
+        gaps = RangeFetcher::Coalesce(gaps);
+
+        std::vector<std::vector<ByteRange>> requests;
+        curl_off_t batch_bytes = 0;
+        for (const ByteRange& gap : gaps) {
+            // Split very large gaps so they can be spread over several connections
+            for (curl_off_t start = gap.start; start <= gap.end; start += kBytesPerRequest) {
+                ByteRange piece{start, std::min(gap.end, start + kBytesPerRequest - 1)};
+                if (requests.empty() || requests.back().size() >= kRangesPerRequest ||
+                    batch_bytes + piece.Length() > kBytesPerRequest) {
+                    requests.emplace_back();
+                    batch_bytes = 0;
+                }
+                requests.back().push_back(piece);
+                batch_bytes += piece.Length();
+            }
+        }
+        return requests;
+    }
+
+public:
+    // manifest_url defaults to url + ".mtdelta"
+    DeltaDownloader(const std::string& url, const std::string& old_filename, const std::string& filename,
+                    int threads = 4, const std::string& manifest_url = "")
+        : url(url), manifest_url(manifest_url.empty() ? url + ".mtdelta" : manifest_url),
+          old_filename(old_filename), filename(filename), num_threads(threads > 0 ? threads : 1) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~DeltaDownloader() {
+        curl_global_cleanup();
+    }
+
+    bool Download() {
+        TraceSpan session_span("session", "delta_download");
+        LogInfo() << "Starting delta download...";
+        LogInfo() << "URL: " << url;
+        LogInfo() << "Old copy: " << old_filename;
+        LogInfo() << "Filename: " << filename;
+
+        DeltaManifest manifest;
+        if (!manifest.Fetch(manifest_url)) {
+            return false;
+        }
+        LogInfo() << "Manifest: " << manifest.length << " bytes in " << manifest.BlockCount()
+                  << " blocks of " << manifest.block_size << " bytes";
+
+        int old_fd = open(old_filename.c_str(), O_RDONLY);
+        if (old_fd < 0) {
+            LogError() << "Failed to open old file: " << old_filename;
+            return false;
+        }
+        struct stat st;
+        fstat(old_fd, &st);
+        size_t old_size = (size_t)st.st_size;
+        const unsigned char* old_data = nullptr;
+        if (old_size > 0) {
+            void* mapped = mmap(nullptr, old_size, PROT_READ, MAP_PRIVATE, old_fd, 0);
+            if (mapped == MAP_FAILED) {
+                LogError() << "Failed to map old file: " << old_filename;
+                close(old_fd);
+                return false;
+            }
+            madvise(mapped, old_size, MADV_SEQUENTIAL);
+            old_data = static_cast<const unsigned char*>(mapped);
+        }
+
+        std::vector<curl_off_t> source = MatchBlocks(manifest, old_data, old_size);
+        size_t reused = 0;
+        for (curl_off_t offset : source) {
+            if (offset >= 0) ++reused;
+        }
+        LogInfo() << "Reusing " << reused << " of " << source.size() << " blocks from the old copy";
+
+        // The result is assembled beside the target and renamed over it at the end, so the old
+        // copy may be the target itself (an update in place) and survives a failed download
+        std::string part_filename = filename + ".part";
+        int out_fd = open(part_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0 || ftruncate(out_fd, manifest.length) != 0) {
+            LogError() << "Failed to create file: " << part_filename;
+            if (out_fd >= 0) {
+                close(out_fd);
+                unlink(part_filename.c_str());
+            }
+            if (old_data) munmap(const_cast<unsigned char*>(old_data), old_size);
+            close(old_fd);
+            return false;
+        }
+
+        bool ok = true;
+        {
+            TraceSpan span("disk", "delta_copy_local");
+            for (size_t i = 0; i < source.size() && ok; ++i) {
+                if (source[i] < 0) continue;
+                size_t len = manifest.BlockLength(i);
+                ok = pwrite(out_fd, old_data + source[i], len, (off_t)i * manifest.block_size) == (ssize_t)len;
+            }
+        }
+        if (old_data) munmap(const_cast<unsigned char*>(old_data), old_size);
+        close(old_fd);
+
+        std::vector<std::vector<ByteRange>> requests = PlanRequests(manifest, source);
+        curl_off_t missing = 0;
+        for (const auto& request : requests) {
+            for (const ByteRange& range : request) missing += range.Length();
+        }
+        LogInfo() << "Fetching " << missing << " bytes in " << requests.size() << " range requests";
+
+        std::atomic<size_t> next_request{0};
+        std::atomic<bool> failed{!ok};
+        std::vector<std::thread> workers;
+        for (int t = 0; t < num_threads && t < (int)requests.size(); ++t) {
+            workers.emplace_back([&, t] {
+                TraceRecorder::Instance().SetThreadName("delta " + std::to_string(t));
+                for (size_t i = next_request++; i < requests.size() && !failed; i = next_request++) {
+                    TraceSpan span("transfer", "delta_ranges", "ranges", (long long)requests[i].size());
+                    std::string error;
+                    bool fetched = RangeFetcher::Fetch(url, requests[i], [&](curl_off_t offset, const char* data, size_t len) {
+                        return pwrite(out_fd, data, len, (off_t)offset) == (ssize_t)len;
+                    }, &error);
+                    if (!fetched) {
+                        LogError() << "Range request failed: " << error;
+                        failed = true;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        if (close(out_fd) != 0) {
+            failed = true;
+        }
+
+        if (failed) {
+            unlink(part_filename.c_str());
+            return false;
+        }
+
+        if (!manifest.file_hash.empty()) {
+            TraceSpan span("commit", "delta_verify");
+            if (Sha256::HashFile(part_filename) != manifest.file_hash) {
+                LogError() << "Delta result does not match the manifest checksum";
+                unlink(part_filename.c_str());
+                return false;
+            }
+        }
+        if (rename(part_filename.c_str(), filename.c_str()) != 0) {
+            LogError() << "Failed to rename " << part_filename << " to " << filename << ": " << strerror(errno);
+            unlink(part_filename.c_str());
+            return false;
+        }
+
+        LogInfo() << "Delta download completed: " << missing << " of " << manifest.length << " bytes transferred";
+        return true;
+    }
+};
+
+#endif // DELTADOWNLOADER_H
@@ -0,0 +1,441 @@
+#ifndef DOWNLOADCACHE_H
+#define DOWNLOADCACHE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <ctime>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+#include <curl/curl.h>
+#include "Logger.h"
+#include "Sha256.h"
+#include "TraceRecorder.h"
+
+// On-disk download cache. Index entries are keyed by a hash of the URL and remember the
+// validators (ETag / Last-Modified) seen when the content was fetched; the bytes themselves
+// live in a content-addressed blob store keyed by SHA-256, so identical files reached through
+// different URLs are stored once.
+//
+// Layout under the cache directory:
+//   index/<url-key>.entry   key=value metadata
+//   blobs/<sha256>          file contents
+//   locks/<url-key>.lock    flock()ed while a URL is being fetched (single-flight across processes)
+class DownloadCache {
+private:
+    struct Entry {
+        std::string url;
+        std::string etag;
+        std::string last_modified;
+        std::string content_hash;
+        long long size = 0;
+        long long validated_at = 0;
+        long long last_access = 0;
+    };
+
+    // Result of a conditional probe against the origin. Unreachable (transport error, 408, 429,
+    // 5xx) lets a cached copy be served stale; Rejected (any other answer) means the origin no
+    // longer serves the URL as cached.
+    enum class Validation { NotModified, Modified, Unreachable, Rejected };
+
+    struct Validators {
+        std::string etag;
+        std::string last_modified;
+    };
+
+    std::string directory;
+    unsigned long long max_bytes;
+    long fresh_seconds;
+
+    // In-process single-flight: one mutex per URL key
+    std::mutex flights_mutex;
+    std::map<std::string, std::shared_ptr<std::mutex>> flights;
+
+    std::string IndexPath(const std::string& key) const { return directory + "/index/" + key + ".entry"; }
+    std::string BlobPath(const std::string& hash) const { return directory + "/blobs/" + hash; }
+    std::string LockPath(const std::string& key) const { return directory + "/locks/" + key + ".lock"; }
+
+    static std::string KeyFor(const std::string& url) { return Sha256::Hash(url).substr(0, 32); }
+
+    static void MakeDirectory(const std::string& path) {
+        std::string partial;
+        std::stringstream parts(path);
+        std::string part;
+        if (!path.empty() && path[0] == '/') partial = "/";
+        while (std::getline(parts, part, '/')) {
+            if (part.empty()) continue;
+            partial += part + "/";
+            mkdir(partial.c_str(), 0755);
+        }
+    }
+
+    bool LoadEntry(const std::string& key, Entry& entry) const {
+        std::ifstream in(IndexPath(key));
+        if (!in.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            std::string name = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            if (name == "url") entry.url = value;
+            else if (name == "etag") entry.etag = value;
+            else if (name == "last_modified") entry.last_modified = value;
+            else if (name == "content_hash") entry.content_hash = value;
+            else if (name == "size") entry.size = atoll(value.c_str());
+            else if (name == "validated_at") entry.validated_at = atoll(value.c_str());
+            else if (name == "last_access") entry.last_access = atoll(value.c_str());
+        }
+        return !entry.content_hash.empty();
+    }
+
+    // Write to a temporary file and rename so readers never see a partial entry
+    bool SaveEntry(const std::string& key, const Entry& entry) const {
+        std::string path = IndexPath(key);
+        std::string temp = path + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temp);
+            if (!out.is_open()) {
+                return false;
+            }
+            out << "url=" << entry.url << "\n"
+                << "etag=" << entry.etag << "\n"
+                << "last_modified=" << entry.last_modified << "\n"
+                << "content_hash=" << entry.content_hash << "\n"
+                << "size=" << entry.size << "\n"
+                << "validated_at=" << entry.validated_at << "\n"
+                << "last_access=" << entry.last_access << "\n";
+        }
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    static size_t DiscardCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+        return size * nmemb;
+    }
+
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+        size_t total = size * nitems;
+        Validators* validators = static_cast<Validators*>(userdata);
+        std::string line(buffer, total);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r\n") + 1);
+            if (name == "etag") validators->etag = value;
+            else if (name == "last-modified") validators->last_modified = value;
+        }
+        return total;
+    }
+
+    // HEAD the URL, conditional on the cached validators when there are any
+    Validation Validate(const std::string& url, const Entry* cached, Validators& fresh) {
+        TraceSpan span("probe", "cache_revalidate");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return Validation::Unreachable;
+        }
+
+        struct curl_slist* headers = nullptr;
+        if (cached && !cached->etag.empty()) {
+            headers = curl_slist_append(headers, ("If-None-Match: " + cached->etag).c_str());
+        } else if (cached && !cached->last_modified.empty()) {
+            headers = curl_slist_append(headers, ("If-Modified-Since: " + cached->last_modified).c_str());
+        }
+
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DiscardCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &fresh);
+
+        CURLcode res = curl_easy_perform(curl);
+        long response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+
+        if (res != CURLE_OK) {
+            LogWarning() << "Cache revalidation failed: " << curl_easy_strerror(res);
+            return Validation::Unreachable;
+        }
+        if (response_code == 304) {
+            return Validation::NotModified;
+        }
+        if (response_code >= 200 && response_code < 300) {
+            // Same validators as the cached copy also means unchanged (server ignored the condition)
+            if (cached && !cached->etag.empty() && cached->etag == fresh.etag) {
+                return Validation::NotModified;
+            }
+            return Validation::Modified;
+        }
+        LogWarning() << "Cache revalidation - Response code: " << response_code;
+        if (response_code == 408 || response_code == 429 || response_code >= 500) {
+            return Validation::Unreachable;
+        }
+        return Validation::Rejected;
+    }
+
+    // Place a copy of src at dst: reflink (copy-on-write clone), else a plain copy. Never a
+    // hardlink, which would let an edit of the downloaded file corrupt the cached blob.
+    static bool CloneFile(const std::string& src, const std::string& dst) {
+        unlink(dst.c_str());
+
+#ifdef FICLONE
+        int in = open(src.c_str(), O_RDONLY);
+        if (in >= 0) {
+            int out = open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (out >= 0) {
+                bool cloned = ioctl(out, FICLONE, in) == 0;
+                close(out);
+                close(in);
+                if (cloned) {
+                    return true;
+                }
+                unlink(dst.c_str());
+            } else {
+                close(in);
+            }
+        }
+#endif
+
+        std::ifstream from(src, std::ios::binary);
+        std::ofstream to(dst, std::ios::binary);
+        if (!from.is_open() || !to.is_open()) {
+            return false;
+        }
+        to << from.rdbuf();
+        return to.good();
+    }
+
+    // Move a freshly downloaded file into the blob store and record it in the index
+    bool Store(const std::string& key, const std::string& url, const std::string& filename,
+               const Validators& validators) {
+        TraceSpan span("commit", "cache_store");
+        std::string hash = Sha256::HashFile(filename);
+        if (hash.empty()) {
+            return false;
+        }
+
+        struct stat st;
+        if (stat(filename.c_str(), &st) != 0) {
+            return false;
+        }
+
+        std::string blob = BlobPath(hash);
+        if (access(blob.c_str(), F_OK) != 0) {
+            std::string temp = blob + ".tmp" + std::to_string(getpid());
+            if (!CloneFile(filename, temp) || rename(temp.c_str(), blob.c_str()) != 0) {
+                unlink(temp.c_str());
+                LogWarning() << "Failed to add " << filename << " to the download cache";
+                return false;
+            }
+        }
+
+        Entry entry;
+        entry.url = url;
+        entry.etag = validators.etag;
+        entry.last_modified = validators.last_modified;
+        entry.content_hash = hash;
+        entry.size = st.st_size;
+        entry.validated_at = time(nullptr);
+        entry.last_access = entry.validated_at;
+        return SaveEntry(key, entry);
+    }
+
+    // Evict least recently used entries until the blob store fits in max_bytes
+    void Evict() {
+        std::vector<std::pair<std::string, Entry>> entries;
+        DIR* dir = opendir((directory + "/index").c_str());
+        if (!dir) {
+            return;
+        }
+        while (struct dirent* item = readdir(dir)) {
+            std::string name = item->d_name;
+            const std::string suffix = ".entry";
+            if (name.size() <= suffix.size() || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+                continue;
+            }
+            std::string key = name.substr(0, name.size() - suffix.size());
+            Entry entry;
+            if (LoadEntry(key, entry)) {
+                entries.emplace_back(key, entry);
+            }
+        }
+        closedir(dir);
+
+        // Blobs shared by several entries are only counted (and removed) once
+        std::map<std::string, int> blob_refs;
+        std::map<std::string, long long> blob_sizes;
+        unsigned long long total = 0;
+        for (const auto& item : entries) {
+            if (blob_refs[item.second.content_hash]++ == 0) {
+                blob_sizes[item.second.content_hash] = item.second.size;
+                total += item.second.size;
+            }
+        }
+        // Drop blobs no entry points at any more (replaced content), once they are an hour old
+        if ((dir = opendir((directory + "/blobs").c_str()))) {
+            while (struct dirent* item = readdir(dir)) {
+                std::string name = item->d_name;
+                if (name.size() != 64 || blob_refs.count(name)) continue;
+                struct stat st;
+                if (stat(BlobPath(name).c_str(), &st) == 0 && time(nullptr) - st.st_mtime > 3600) {
+                    unlink(BlobPath(name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+
+        if (total <= max_bytes) {
+            return;
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+            return a.second.last_access < b.second.last_access;
+        });
+        for (const auto& item : entries) {
+            if (total <= max_bytes) break;
+            unlink(IndexPath(item.first).c_str());
+            if (--blob_refs[item.second.content_hash] == 0) {
+                unlink(BlobPath(item.second.content_hash).c_str());
+                total -= blob_sizes[item.second.content_hash];
+                LogInfo() << "Cache evicted " << item.second.url;
+            }
+        }
+    }
+
+    std::shared_ptr<std::mutex> FlightFor(const std::string& key) {
+        std::lock_guard<std::mutex> lock(flights_mutex);
+        auto& flight = flights[key];
+        if (!flight) {
+            flight = std::make_shared<std::mutex>();
+        }
+        return flight;
+    }
+
+    // Copy the blob beside filename and rename it over whatever is there, so a failed copy
+    // leaves the existing file alone
+    bool ServeHit(const std::string& key, Entry& entry, const std::string& filename) {
+        std::string temp = filename + ".tmp" + std::to_string(getpid());
+        if (!CloneFile(BlobPath(entry.content_hash), temp) || rename(temp.c_str(), filename.c_str()) != 0) {
+            unlink(temp.c_str());
+            return false;
+        }
+        entry.last_access = time(nullptr);
+        SaveEntry(key, entry);
+        LogInfo() << "Served from cache: " << entry.url << " (" << entry.size << " bytes)";
+        return true;
+    }
+
+public:
+    // max_bytes caps the blob store; entries validated less than fresh_seconds ago are served
+    // without contacting the origin
+    DownloadCache(const std::string& directory, unsigned long long max_bytes, long fresh_seconds = 0)
+        : directory(directory), max_bytes(max_bytes), fresh_seconds(fresh_seconds) {
+        MakeDirectory(directory + "/index");
+        MakeDirectory(directory + "/blobs");
+        MakeDirectory(directory + "/locks");
+    }
+
+    const std::string& Directory() const { return directory; }
+
+    // $XDG_CACHE_HOME/multidownloader or ~/.cache/multidownloader
+    static std::string DefaultDirectory() {
+        const char* xdg = std::getenv("XDG_CACHE_HOME");
+        if (xdg && *xdg) {
+            return std::string(xdg) + "/multidownloader";
+        }
+        const char* home = std::getenv("HOME");
+        return std::string(home ? home : ".") + "/.cache/multidownloader";
+    }
+
+    // Produce url's content at filename, either from the cache or by running fetch(), which must
+    // download into filename. Concurrent calls for the same URL (threads or processes) are
+    // collapsed: the first one fetches, the others wait and are then served from the cache.
+    bool Fetch(const std::string& url, const std::string& filename, const std::function<bool()>& fetch) {
+        const std::string key = KeyFor(url);
+
+        std::shared_ptr<std::mutex> flight = FlightFor(key);
+        std::lock_guard<std::mutex> flight_lock(*flight);
+
+        int lock_fd = open(LockPath(key).c_str(), O_RDWR | O_CREAT, 0644);
+        if (lock_fd >= 0 && flock(lock_fd, LOCK_EX) != 0) {
+            close(lock_fd);
+            lock_fd = -1;
+        }
+
+        Entry entry;
+        bool cached = LoadEntry(key, entry) && access(BlobPath(entry.content_hash).c_str(), R_OK) == 0;
+        bool result = false;
+        bool done = false;
+        Validators validators;
+
+        if (cached && time(nullptr) - entry.validated_at < fresh_seconds) {
+            result = done = ServeHit(key, entry, filename);
+        }
+
+        if (!done) {
+            Validation validation = Validate(url, cached ? &entry : nullptr, validators);
+            if (cached && validation == Validation::Rejected) {
+                // Gone or forbidden at the origin: forget the copy and let fetch() report the error
+                LogWarning() << "Origin rejected the cached URL, dropping cache entry";
+                unlink(IndexPath(key).c_str());
+            } else if (cached && validation != Validation::Modified) {
+                if (validation == Validation::Unreachable) {
+                    LogWarning() << "Origin unreachable, serving stale cache entry";
+                } else {
+                    entry.validated_at = time(nullptr);
+                }
+                result = done = ServeHit(key, entry, filename);
+            }
+        }
+
+        if (!done) {
+            // fetch() writes in place; a file left there by an older version of the cache may be
+            // a hardlink to a blob, which must be replaced rather than overwritten
+            struct stat st;
+            if (stat(filename.c_str(), &st) == 0 && st.st_nlink > 1) {
+                unlink(filename.c_str());
+            }
+            result = fetch();
+            if (result && Store(key, url, filename, validators)) {
+                Evict();
+            }
+        }
+
+        if (lock_fd >= 0) {
+            flock(lock_fd, LOCK_UN);
+            close(lock_fd);
+        }
+        return result;
+    }
+};
+
+#endif // DOWNLOADCACHE_H
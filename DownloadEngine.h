@@ -0,0 +1,474 @@
+#ifndef DOWNLOADENGINE_H
+#define DOWNLOADENGINE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <type_traits>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "Sha256.h"
+#include "SocketTuning.h"
+#include "StreamWriter.h"
+#include "Transport.h"
+#include "SegmentQueue.h"
+
+// A segmented download assembled at compile time from four policies:
+//
+//   Transport  fetches byte ranges: CurlTransport, or any Transport such as SimulatedTransport
+//   Sink       where segment bytes go: PwriteSink, MemorySink, HashingSink<Inner>, NullSink
+//   Scheduler  cuts the file up and hands out segments: StaticScheduler, BalancedScheduler
+//   Progress   reports per-segment progress: BoardProgress, NoProgress
+//
+// The sinks are final SegmentSinks. CurlTransport::FetchInto instantiates its write callback
+// for the concrete sink, so the per-packet path is a direct, inlinable call with no virtual
+// dispatch. NoProgress has kEnabled = false, which removes the progress callback from the
+// transfer altogether. Segment layout and retries are the SegmentQueue that
+// MultithreadedDownloader uses too; that class remains the fully featured engine (cache,
+// address spreading, source links, scavenger, profiles), and the instantiations at the bottom
+// of this file cover the plain cases with less machinery.
+
+// ---------------------------------------------------------------------------------------------
+// Sinks. Each has a Target shared by the whole download, opened once the size is known, and is
+// constructed per segment attempt on the target with the segment's offset and length.
+
+// Writes each segment in place into one preallocated file with pwrite(2): no part files and
+// no merge afterwards. A retried segment simply overwrites its own range.
+class PwriteSink final : public SegmentSink {
+public:
+    class Target {
+    private:
+        int fd = -1;
+        std::string path;
+
+    public:
+        bool Open(const std::string& filename, curl_off_t size) {
+            path = filename;
+            fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                LogError() << "Failed to create file: " << filename << ": " << strerror(errno);
+                return false;
+            }
+            // Reserve the blocks up front so segments never extend the file concurrently
+            int err = posix_fallocate(fd, 0, (off_t)size);
+            if (err != 0 && ::ftruncate(fd, (off_t)size) != 0) {
+                LogError() << "Failed to size " << filename << ": " << strerror(err);
+                return false;
+            }
+            return true;
+        }
+
+        // A failed download leaves no truncated file behind
+        bool Close(bool ok) {
+            if (fd < 0) return false;
+            bool closed = ::close(fd) == 0;
+            fd = -1;
+            if (!ok || !closed) {
+                std::remove(path.c_str());
+            }
+            return ok && closed;
+        }
+
+        int Fd() const { return fd; }
+    };
+
+private:
+    int fd;
+    curl_off_t offset;
+    curl_off_t length;
+    curl_off_t written = 0;
+    bool failed = false;
+
+public:
+    PwriteSink(Target& target, curl_off_t offset, curl_off_t length)
+        : fd(target.Fd()), offset(offset), length(length) {}
+
+    bool TryWrite(const char* data, size_t len) override {
+        if (written + (curl_off_t)len > length) {
+            failed = true;
+            return false;
+        }
+        while (len > 0) {
+            ssize_t n = ::pwrite(fd, data, len, (off_t)(offset + written));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                LogError() << "Disk write failed: " << strerror(errno);
+                failed = true;
+                return false;
+            }
+            data += n;
+            len -= (size_t)n;
+            written += n;
+        }
+        return true;
+    }
+
+    // The segment arrived in full
+    bool Finish() { return !failed; }
+
+    bool Failed() const override { return failed; }
+};
+
+// Copies each segment into its slice of one buffer: the engine's own, or one the caller
+// provides with SetBuffer() before the download
+class MemorySink final : public SegmentSink {
+public:
+    class Target {
+    private:
+        std::vector<char> owned;
+        char* data = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+
+    public:
+        void SetBuffer(char* buffer, size_t buffer_capacity) {
+            data = buffer;
+            capacity = buffer_capacity;
+        }
+
+        bool Open(const std::string& filename, curl_off_t resource_size) {
+            size = (size_t)resource_size;
+            if (!data) {
+                owned.resize(size);
+                data = owned.data();
+                capacity = size;
+            }
+            if (size > capacity) {
+                LogError() << "Resource needs " << size << " bytes, buffer holds " << capacity;
+                return false;
+            }
+            return true;
+        }
+
+        bool Close(bool ok) { return ok; }
+
+        char* Data() const { return data; }
+        std::string_view View() const { return std::string_view(data, size); }
+    };
+
+private:
+    char* data;
+    curl_off_t length;
+    curl_off_t used = 0;
+    bool failed = false;
+
+public:
+    MemorySink(Target& target, curl_off_t offset, curl_off_t length)
+        : data(target.Data() + offset), length(length) {}
+
+    bool TryWrite(const char* contents, size_t len) override {
+        if (used + (curl_off_t)len > length) {
+            failed = true;
+            return false;
+        }
+        memcpy(data + used, contents, len);
+        used += (curl_off_t)len;
+        return true;
+    }
+
+    bool Finish() { return !failed; }
+
+    bool Failed() const override { return failed; }
+};
+
+// Hashes each segment with SHA-256 while passing it on to the inner sink, so integrity is
+// checked in the same pass as the write rather than by reading the file back. Digests are kept
+// per segment (by start offset); with a single segment that is the digest of the whole file.
+template <class Inner>
+class HashingSink final : public SegmentSink {
+public:
+    class Target : public Inner::Target {
+    private:
+        std::mutex mutex;
+        std::map<curl_off_t, std::string> digests;
+
+    public:
+        void Record(curl_off_t offset, std::string digest) {
+            std::lock_guard<std::mutex> lock(mutex);
+            digests[offset] = std::move(digest);
+        }
+
+        std::map<curl_off_t, std::string> Digests() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return digests;
+        }
+    };
+
+private:
+    Target& target;
+    Inner inner;
+    Sha256 sha;
+    curl_off_t offset;
+
+public:
+    HashingSink(Target& target, curl_off_t offset, curl_off_t length)
+        : target(target), inner(target, offset, length), offset(offset) {}
+
+    bool TryWrite(const char* data, size_t len) override {
+        sha.Update(data, len);
+        return inner.TryWrite(data, len);
+    }
+
+    bool Finish() {
+        if (!inner.Finish()) return false;
+        target.Record(offset, sha.HexDigest());
+        return true;
+    }
+
+    bool Failed() const override { return inner.Failed(); }
+};
+
+// Throws the data away: measures what the network and the engine can do without a disk
+class NullSink final : public SegmentSink {
+public:
+    class Target {
+    public:
+        bool Open(const std::string& filename, curl_off_t size) { return true; }
+        bool Close(bool ok) { return ok; }
+    };
+
+    NullSink(Target& target, curl_off_t offset, curl_off_t length) {}
+
+    bool TryWrite(const char* data, size_t len) override { return true; }
+    bool Finish() { return true; }
+};
+
+// ---------------------------------------------------------------------------------------------
+// Schedulers
+
+// The shared SegmentQueue, cutting the file into up to kSegmentsPerThread segments per
+// connection
+template <int kSegmentsPerThread>
+class QueueScheduler : public SegmentQueue {
+public:
+    int Plan(curl_off_t size, int threads, curl_off_t min_segment_size) {
+        return SegmentQueue::Plan(size, threads, min_segment_size, kSegmentsPerThread);
+    }
+};
+
+// One contiguous segment per connection
+using StaticScheduler = QueueScheduler<1>;
+
+// More segments than connections, so fast connections pick up the work of slow ones
+using BalancedScheduler = QueueScheduler<4>;
+
+// ---------------------------------------------------------------------------------------------
+// Progress
+
+struct NoProgress {
+    static constexpr bool kEnabled = false;
+
+    void Begin(int segments) {}
+    void SetTotal(int segment, curl_off_t bytes) {}
+    void Update(int segment, curl_off_t bytes) {}
+    void End() {}
+};
+
+// Publishes to a ProgressBoard rendered by the logger thread (nothing in quiet mode)
+class BoardProgress {
+private:
+    std::shared_ptr<ProgressBoard> board;
+
+public:
+    static constexpr bool kEnabled = true;
+
+    void Begin(int segments) {
+        if (Logger::Instance().ProgressEnabled()) {
+            board = Logger::Instance().BeginProgress("download", segments);
+        }
+    }
+
+    void SetTotal(int segment, curl_off_t bytes) {
+        if (board) board->SetTotal(segment, bytes);
+    }
+
+    void Update(int segment, curl_off_t bytes) {
+        if (board) board->SetDone(segment, bytes);
+    }
+
+    void End() {
+        if (board) {
+            Logger::Instance().EndProgress(board);
+            board.reset();
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------------------------
+
+template <class TransportPolicy, class Sink, class Scheduler, class ProgressPolicy>
+class DownloadEngine {
+public:
+    using SinkTarget = typename Sink::Target;
+
+private:
+    static constexpr curl_off_t kMinSegmentSize = 1024 * 1024;
+    static constexpr long kReceiveBufferSize = 512 * 1024;
+
+    std::string url;
+    std::string filename;
+    int num_threads;
+    curl_off_t file_size = 0;
+    curl_off_t min_segment_size = kMinSegmentSize;
+    int num_segments = 0;
+    long long duration_ms = 0;
+
+    TransportPolicy transport;
+    SinkTarget target;
+    Scheduler scheduler;
+    ProgressPolicy progress;
+
+    // Take segments off the scheduler until it runs dry or the download has failed
+    void Worker(int worker_id, bool ranged) {
+        TraceRecorder::Instance().SetThreadName("worker " + std::to_string(worker_id));
+        PlannedSegment segment;
+        while (scheduler.Next(segment)) {
+            Sink sink(target, segment.start_byte, segment.Length());
+            progress.Update(segment.id, 0);
+
+            RangeRequest request;
+            request.url = url;
+            request.start_byte = segment.start_byte;
+            request.end_byte = segment.end_byte;
+            request.ranged = ranged;
+            request.segment_id = segment.id;
+            Transport::ProgressFn report;
+            if constexpr (ProgressPolicy::kEnabled) {
+                report = [this, &segment](curl_off_t received) { progress.Update(segment.id, received); };
+            }
+            RangeResult result = transport.FetchInto(request, sink, report);
+
+            long expected_code = ranged ? 206 : 200;
+            bool ok = result.ok && (result.status == 0 || result.status == expected_code) &&
+                      result.received == segment.Length() && sink.Finish();
+            if (!ok) {
+                LogError() << "Chunk " << segment.id << " download failed: "
+                           << (result.ok ? "HTTP " + std::to_string(result.status) + ", " +
+                                           std::to_string(result.received) + " of " +
+                                           std::to_string(segment.Length()) + " bytes"
+                                         : result.error);
+            } else {
+                LogDebug() << "Chunk " << segment.id << " downloaded successfully";
+            }
+            if (!ok && !scheduler.Retry(segment.id)) {
+                transport.Cancel();
+            }
+        }
+        transport.WorkerDone();
+    }
+
+public:
+    // Any further arguments construct the transport, e.g. the SimulatedNetwork of a
+    // SimulatedTransport
+    template <class... TransportArgs>
+    DownloadEngine(const std::string& url, const std::string& filename, int threads = 4,
+                   TransportArgs&&... transport_args)
+        : url(url), filename(filename), num_threads(std::max(threads, 1)),
+          transport(std::forward<TransportArgs>(transport_args)...) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        if constexpr (std::is_base_of_v<CurlTransport, TransportPolicy>) {
+            transport.SetHandleSetup([](CURL* curl, const RangeRequest& request) {
+                // Large reads from the socket mean fewer write callbacks per MB
+                curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, kReceiveBufferSize);
+                SocketTuning::Instance().Apply(curl);
+            });
+        }
+    }
+
+    ~DownloadEngine() {
+        curl_global_cleanup();
+    }
+
+    // Smallest segment worth a request of its own (default 1 MB)
+    void SetSegmentSize(curl_off_t bytes) {
+        min_segment_size = std::max<curl_off_t>(bytes, 1);
+    }
+
+    // The sink's shared state: the output buffer, digests, ...
+    SinkTarget& Target() { return target; }
+
+    bool Download() {
+        TraceSpan session_span("session", "engine_download");
+        LogInfo() << "Starting engine download...";
+        LogInfo() << "URL: " << url;
+
+        file_size = transport.Size(url, num_threads);
+        if (file_size <= 0) {
+            LogError() << "Size of " << url << " is unknown";
+            return false;
+        }
+        // Without ranges the whole resource is one plain request
+        bool ranged = transport.SupportsRanges(url, file_size);
+        if (!ranged) {
+            LogWarning() << "Server doesn't support range requests. Using a single connection...";
+        }
+        if (!target.Open(filename, file_size)) {
+            return false;
+        }
+
+        long long start_time = transport.NowMicros();
+        num_segments = scheduler.Plan(file_size, ranged ? num_threads : 1, ranged ? min_segment_size : file_size);
+        progress.Begin(num_segments);
+        for (const PlannedSegment& segment : scheduler.Segments()) {
+            progress.SetTotal(segment.id, segment.Length());
+        }
+
+        int workers = std::min(num_threads, num_segments);
+        std::vector<std::thread> threads;
+        transport.BeginWorkers(workers);
+        for (int i = 0; i < workers; ++i) {
+            threads.emplace_back(&DownloadEngine::Worker, this, i, ranged);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        progress.End();
+        duration_ms = (transport.NowMicros() - start_time) / 1000;
+
+        bool ok = !scheduler.Failed();
+        {
+            TraceSpan span("disk", "flush");
+            ok = target.Close(ok);
+        }
+        if (!ok) {
+            LogError() << "Download failed: not all chunks could be downloaded";
+            return false;
+        }
+        LogInfo() << "Download completed successfully!";
+        LogInfo() << "Total time: " << duration_ms << " ms";
+        return true;
+    }
+
+    void DisplayStats() {
+        LogInfo() << "\n=== Download Statistics ===";
+        LogInfo() << "File: " << filename;
+        LogInfo() << "Size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)";
+        LogInfo() << "Threads used: " << num_threads;
+        LogInfo() << "Chunks: " << num_segments;
+        if (duration_ms > 0) {
+            LogInfo() << "Throughput: " << file_size / 1024 * 1000 / duration_ms / 1024 << " MB/s";
+        }
+    }
+
+    curl_off_t FileSize() const { return file_size; }
+    long long DurationMs() const { return duration_ms; }
+};
+
+// Ready-made engines
+using PwriteDownloader = DownloadEngine<CurlTransport, PwriteSink, BalancedScheduler, BoardProgress>;
+using QuietPwriteDownloader = DownloadEngine<CurlTransport, PwriteSink, BalancedScheduler, NoProgress>;
+using VerifyingDownloader = DownloadEngine<CurlTransport, HashingSink<PwriteSink>, BalancedScheduler, BoardProgress>;
+using MemoryDownloader = DownloadEngine<CurlTransport, MemorySink, BalancedScheduler, NoProgress>;
+using ThroughputProbe = DownloadEngine<CurlTransport, NullSink, BalancedScheduler, NoProgress>;
+
+#endif // DOWNLOADENGINE_H
@@ -1,15 +1,17 @@
 #include "DownloaderGUI.h"
 #include "MultiDownloader.cpp" // Include the implementation
+#include "LogModel.h"
 #include <QtWidgets/QApplication>
 #include <QtCore/QDateTime>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QDir>
 #include <QtGui/QFont>
 #include <QtGui/QIcon>
+#include <QtWidgets/QScrollBar>
 
 // DownloadWorker Implementation
-DownloadWorker::DownloadWorker(const QString& url, const QString& filename, bool useMultithread, int threads)
-    : m_url(url), m_filename(filename), m_useMultithread(useMultithread), m_threads(threads) {
+DownloadWorker::DownloadWorker(const QString& url, const QString& filename, bool useMultithread, int threads, LogModel* log)
+    : m_url(url), m_filename(filename), m_useMultithread(useMultithread), m_threads(threads), m_log(log) {
 }
 
 DownloadWorker::~DownloadWorker() {
@@ -23,11 +25,20 @@ void DownloadWorker::startDownload() {
     bool success = false;
     QString message;
     
+    // Route downloader log output into the GUI log instead of stdout. Lines go straight into the
+    // model's queue rather than through a queued signal each, and keep their level for filtering.
+    Logger::Instance().SetSink([log = m_log](LogLevel level, const std::string& text) {
+        log->append(level, QString::fromStdString(text));
+    });
+    
     try {
         if (m_useMultithread) {
-            emit logMessage(QString("Using %1 threads").arg(m_threads));
+            emit logMessage(m_threads > 0 ? QString("Using %1 threads").arg(m_threads)
+                                          : QString("Using the thread count learned for this host"));
             m_multiDownloader = std::make_unique<MultithreadedDownloader>(
                 m_url.toStdString(), m_filename.toStdString(), m_threads);
+            HostProfileStore profiles(HostProfileStore::DefaultDirectory());
+            m_multiDownloader->SetProfileStore(&profiles);
             success = m_multiDownloader->Download();
             message = success ? "Multithreaded download completed successfully!" : "Multithreaded download failed!";
         } else {
@@ -42,6 +53,7 @@ void DownloadWorker::startDownload() {
         emit logMessage(message);
     }
     
+    Logger::Instance().SetSink(nullptr);
     emit downloadFinished(success, message);
 }
 
@@ -67,6 +79,11 @@ DownloaderGUI::DownloaderGUI(QWidget *parent)
     // Setup update timer
     m_updateTimer = new QTimer(this);
     connect(m_updateTimer, &QTimer::timeout, this, &DownloaderGUI::updateTimer);
+    
+    // Queued log lines enter the view at most once per frame
+    m_logFlushTimer = new QTimer(this);
+    connect(m_logFlushTimer, &QTimer::timeout, this, &DownloaderGUI::flushLog);
+    m_logFlushTimer->start(33);
 }
 
 DownloaderGUI::~DownloaderGUI() {
@@ -113,7 +130,8 @@ void DownloaderGUI::setupUI() {
     
     m_threadsLabel = new QLabel("Number of threads:", this);
     m_threadsSpinBox = new QSpinBox(this);
-    m_threadsSpinBox->setRange(1, 16);
+    m_threadsSpinBox->setRange(0, 16);
+    m_threadsSpinBox->setSpecialValueText("Auto");
     m_threadsSpinBox->setValue(4);
     
     methodLayout->addWidget(m_singleThreadRadio, 0, 0, 1, 2);
@@ -164,11 +182,29 @@ void DownloaderGUI::setupUI() {
     // Log Section
     m_logGroup = new QGroupBox("Download Log", this);
     QVBoxLayout *logLayout = new QVBoxLayout(m_logGroup);
-    m_logTextEdit = new QTextEdit(this);
-    m_logTextEdit->setMaximumHeight(200);
-    m_logTextEdit->setFont(QFont("Consolas", 9));
-    m_logTextEdit->setReadOnly(true);
-    logLayout->addWidget(m_logTextEdit);
+    QHBoxLayout *logFilterLayout = new QHBoxLayout();
+    m_logLevelCombo = new QComboBox(this);
+    m_logLevelCombo->addItem("All", static_cast<int>(LogLevel::Debug));
+    m_logLevelCombo->addItem("Info", static_cast<int>(LogLevel::Info));
+    m_logLevelCombo->addItem("Warnings", static_cast<int>(LogLevel::Warning));
+    m_logLevelCombo->addItem("Errors", static_cast<int>(LogLevel::Error));
+    m_logFilterEdit = new QLineEdit(this);
+    m_logFilterEdit->setPlaceholderText("Search log...");
+    m_logFilterEdit->setClearButtonEnabled(true);
+    logFilterLayout->addWidget(m_logLevelCombo);
+    logFilterLayout->addWidget(m_logFilterEdit);
+    logLayout->addLayout(logFilterLayout);
+    
+    // A bounded ring buffer model; uniform item sizes let the view lay out only visible rows
+    m_logModel = new LogModel(LogModel::kDefaultCapacity, this);
+    m_logView = new QListView(this);
+    m_logView->setModel(m_logModel);
+    m_logView->setUniformItemSizes(true);
+    m_logView->setMaximumHeight(200);
+    m_logView->setFont(QFont("Consolas", 9));
+    m_logView->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    m_logView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    logLayout->addWidget(m_logView);
     m_mainLayout->addWidget(m_logGroup);
     
     // Status Bar
@@ -182,6 +218,8 @@ void DownloaderGUI::setupConnections() {
     connect(m_downloadButton, &QPushButton::clicked, this, &DownloaderGUI::onDownloadClicked);
     connect(m_cancelButton, &QPushButton::clicked, this, &DownloaderGUI::onCancelClicked);
     connect(m_clearLogButton, &QPushButton::clicked, this, &DownloaderGUI::onClearLogClicked);
+    connect(m_logLevelCombo, QOverload<int>::of(&QComboBox::currentIndexChanged), this, &DownloaderGUI::onLogFilterChanged);
+    connect(m_logFilterEdit, &QLineEdit::textChanged, this, &DownloaderGUI::onLogFilterChanged);
     
     // Enable/disable thread spinbox based on method selection
     connect(m_singleThreadRadio, &QRadioButton::toggled, [this](bool checked) {
@@ -233,7 +271,7 @@ void DownloaderGUI::onDownloadClicked() {
     
     // Create worker thread
     m_workerThread = new QThread(this);
-    m_worker = new DownloadWorker(url, filename, m_multiThreadRadio->isChecked(), m_threadsSpinBox->value());
+    m_worker = new DownloadWorker(url, filename, m_multiThreadRadio->isChecked(), m_threadsSpinBox->value(), m_logModel);
     m_worker->moveToThread(m_workerThread);
     
     // Connect worker signals
@@ -261,7 +299,7 @@ void DownloaderGUI::onCancelClicked() {
 }
 
 void DownloaderGUI::onClearLogClicked() {
-    m_logTextEdit->clear();
+    m_logModel->clear();
 }
 
 void DownloaderGUI::onDownloadProgress(int percentage, qint64 downloaded, qint64 total, double speed) {
@@ -303,9 +341,21 @@ void DownloaderGUI::onDownloadFinished(bool success, const QString& message) {
 }
 
 void DownloaderGUI::onLogMessage(const QString& message) {
-    QMutexLocker locker(&m_logMutex);
-    QString timestamp = QDateTime::currentDateTime().toString("hh:mm:ss");
-    m_logTextEdit->append(QString("[%1] %2").arg(timestamp).arg(message));
+    m_logModel->append(LogLevel::Info, message);
+}
+
+void DownloaderGUI::onLogFilterChanged() {
+    m_logModel->setMinimumLevel(static_cast<LogLevel>(m_logLevelCombo->currentData().toInt()));
+    m_logModel->setFilterText(m_logFilterEdit->text());
+}
+
+void DownloaderGUI::flushLog() {
+    // Follow new lines only while the user is looking at the end of the log
+    QScrollBar *scrollBar = m_logView->verticalScrollBar();
+    bool atBottom = scrollBar->value() == scrollBar->maximum();
+    if (m_logModel->flush() && atBottom) {
+        m_logView->scrollToBottom();
+    }
 }
 
 void DownloaderGUI::updateTimer() {
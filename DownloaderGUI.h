@@ -9,7 +9,8 @@
 #include <QtWidgets/QLineEdit>
 #include <QtWidgets/QPushButton>
 #include <QtWidgets/QProgressBar>
-#include <QtWidgets/QTextEdit>
+#include <QtWidgets/QListView>
+#include <QtWidgets/QComboBox>
 #include <QtWidgets/QSpinBox>
 #include <QtWidgets/QRadioButton>
 #include <QtWidgets/QButtonGroup>
@@ -19,18 +20,18 @@
 #include <QtWidgets/QStatusBar>
 #include <QtCore/QTimer>
 #include <QtCore/QThread>
-#include <QtCore/QMutex>
 #include <memory>
 
 // Forward declarations
 class SingleThreadedDownloader;
 class MultithreadedDownloader;
+class LogModel;
 
 class DownloadWorker : public QObject {
     Q_OBJECT
 
 public:
-    DownloadWorker(const QString& url, const QString& filename, bool useMultithread, int threads);
+    DownloadWorker(const QString& url, const QString& filename, bool useMultithread, int threads, LogModel* log);
     ~DownloadWorker();
 
 public slots:
@@ -46,6 +47,7 @@ private:
     QString m_filename;
     bool m_useMultithread;
     int m_threads;
+    LogModel* m_log;
     std::unique_ptr<SingleThreadedDownloader> m_singleDownloader;
     std::unique_ptr<MultithreadedDownloader> m_multiDownloader;
 };
@@ -65,6 +67,8 @@ private slots:
     void onDownloadProgress(int percentage, qint64 downloaded, qint64 total, double speed);
     void onDownloadFinished(bool success, const QString& message);
     void onLogMessage(const QString& message);
+    void onLogFilterChanged();
+    void flushLog();
     void updateTimer();
 
 private:
@@ -112,7 +116,11 @@ private:
     
     // Log Section
     QGroupBox *m_logGroup;
-    QTextEdit *m_logTextEdit;
+    QComboBox *m_logLevelCombo;
+    QLineEdit *m_logFilterEdit;
+    QListView *m_logView;
+    LogModel *m_logModel;
+    QTimer *m_logFlushTimer;
     
     // Status Bar
     QStatusBar *m_statusBar;
@@ -121,7 +129,6 @@ private:
     QThread *m_workerThread;
     DownloadWorker *m_worker;
     QTimer *m_updateTimer;
-    QMutex m_logMutex;
     
     // Download State
     bool m_isDownloading;
@@ -0,0 +1,231 @@
+#ifndef HOSTPROFILES_H
+#define HOSTPROFILES_H
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+#include <ctime>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "Logger.h"
+
+// What past transfers taught us about one origin (host:port)
+struct HostProfile {
+    std::string host;
+    int supports_range = -1;                 // -1 unknown, 1 yes; refusals are not kept
+    long http_version = 0;                   // CURL_HTTP_VERSION_* last negotiated, 0 unknown
+    long long updated = 0;
+    std::map<int, double> rate;              // connections -> smoothed aggregate bytes/s
+    std::map<int, int> samples;              // connections -> number of transfers measured
+};
+
+// Starting point for the next transfer from a host
+struct HostPlan {
+    bool known = false;
+    int threads = 0;                         // 0: no recommendation
+    curl_off_t segment_size = 0;             // 0: no recommendation
+    int supports_range = -1;
+    long http_version = 0;
+};
+
+// Small on-disk store of per-host tuning profiles, one key=value file per host:
+//
+//   host=example.com:443
+//   supports_range=1
+//   http_version=2
+//   updated=<unix time>
+//   rate.4=<bytes/s>        smoothed throughput measured with 4 connections
+//   samples.4=<count>
+//
+// Connection counts are tuned by hill climbing: the store recommends the best count measured
+// so far, and keeps doubling it while more connections still paid off, which quickly finds the
+// point where an origin that throttles per connection stops scaling.
+class HostProfileStore {
+private:
+    std::string directory;
+    std::mutex mutex;
+
+    static constexpr int kMaxThreads = 32;
+    static constexpr double kScalingGain = 1.15;          // doubling must gain 15% to keep climbing
+    static constexpr double kSmoothing = 0.5;             // weight of the newest measurement
+    static constexpr long long kMinLearnBytes = 4LL * 1024 * 1024;
+    static constexpr long long kMaxAgeSeconds = 30LL * 24 * 3600;
+    static constexpr double kSegmentSeconds = 2.0;        // aim for segments lasting this long
+    static constexpr curl_off_t kMinSegment = 1024 * 1024;
+    static constexpr curl_off_t kMaxSegment = 64LL * 1024 * 1024;
+
+    std::string PathFor(const std::string& host) const {
+        std::string name;
+        for (char c : host) {
+            name += (isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '-') ? c : '_';
+        }
+        return directory + "/" + name + ".profile";
+    }
+
+    bool Load(const std::string& host, HostProfile& profile) const {
+        std::ifstream in(PathFor(host));
+        if (!in.is_open()) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t eq = line.find('=');
+            if (eq == std::string::npos) continue;
+            std::string name = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            if (name == "host") profile.host = value;
+            else if (name == "supports_range") profile.supports_range = atoi(value.c_str());
+            else if (name == "http_version") profile.http_version = atol(value.c_str());
+            else if (name == "updated") profile.updated = atoll(value.c_str());
+            else if (name.compare(0, 5, "rate.") == 0) profile.rate[atoi(name.c_str() + 5)] = atof(value.c_str());
+            else if (name.compare(0, 8, "samples.") == 0) profile.samples[atoi(name.c_str() + 8)] = atoi(value.c_str());
+        }
+        return profile.host == host;
+    }
+
+    // Write to a temporary file and rename so readers never see a partial profile
+    bool Save(const HostProfile& profile) const {
+        std::string path = PathFor(profile.host);
+        std::string temp = path + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temp);
+            if (!out.is_open()) {
+                return false;
+            }
+            out << "host=" << profile.host << "\n"
+                << "supports_range=" << profile.supports_range << "\n"
+                << "http_version=" << profile.http_version << "\n"
+                << "updated=" << profile.updated << "\n";
+            for (const auto& entry : profile.rate) {
+                out << "rate." << entry.first << "=" << (long long)entry.second << "\n";
+            }
+            for (const auto& entry : profile.samples) {
+                out << "samples." << entry.first << "=" << entry.second << "\n";
+            }
+        }
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+public:
+    explicit HostProfileStore(const std::string& directory) : directory(directory) {
+        std::string partial;
+        std::stringstream parts(directory);
+        std::string part;
+        if (!directory.empty() && directory[0] == '/') partial = "/";
+        while (std::getline(parts, part, '/')) {
+            if (part.empty()) continue;
+            partial += part + "/";
+            mkdir(partial.c_str(), 0755);
+        }
+    }
+
+    static std::string DefaultDirectory() {
+        const char* xdg = std::getenv("XDG_CACHE_HOME");
+        if (xdg && *xdg) {
+            return std::string(xdg) + "/multidownloader/profiles";
+        }
+        const char* home = std::getenv("HOME");
+        return std::string(home ? home : ".") + "/.cache/multidownloader/profiles";
+    }
+
+    // "host:port" of a URL, or "" if it cannot be parsed
+    static std::string HostKey(const std::string& url) {
+        CURLU* parsed = curl_url();
+        char* host = nullptr;
+        char* port = nullptr;
+        std::string key;
+        if (parsed && curl_url_set(parsed, CURLUPART_URL, url.c_str(), 0) == CURLUE_OK &&
+            curl_url_get(parsed, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+            curl_url_get(parsed, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK) {
+            key = std::string(host) + ":" + port;
+        }
+        curl_free(host);
+        curl_free(port);
+        if (parsed) curl_url_cleanup(parsed);
+        return key;
+    }
+
+    // Recommended starting parameters for a URL's host
+    HostPlan PlanFor(const std::string& url) {
+        HostPlan plan;
+        std::string host = HostKey(url);
+        HostProfile profile;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (host.empty() || !Load(host, profile)) {
+                return plan;
+            }
+        }
+        if (time(nullptr) - profile.updated > kMaxAgeSeconds) {
+            return plan;
+        }
+        plan.known = true;
+        // Only a positive answer skips the probe; a refusal may have been a transient or
+        // per-URL one, so it is always asked again
+        plan.supports_range = profile.supports_range == 1 ? 1 : -1;
+        plan.http_version = profile.http_version;
+        if (profile.rate.empty()) {
+            return plan;
+        }
+
+        auto best = std::max_element(profile.rate.begin(), profile.rate.end(),
+                                     [](const std::pair<const int, double>& a, const std::pair<const int, double>& b) {
+                                         return a.second < b.second;
+                                     });
+        plan.threads = best->first;
+
+        // Still scaling at the largest count tried: try twice as many next time
+        bool largest = best->first == profile.rate.rbegin()->first;
+        if (largest && best->first < kMaxThreads) {
+            auto lower = profile.rate.find(best->first);
+            bool scaled = lower == profile.rate.begin() || best->second >= std::prev(lower)->second * kScalingGain;
+            if (scaled) {
+                plan.threads = std::min(kMaxThreads, best->first * 2);
+            }
+        }
+
+        double per_connection = best->second / best->first;
+        plan.segment_size = std::max(kMinSegment, std::min(kMaxSegment, (curl_off_t)(per_connection * kSegmentSeconds)));
+        return plan;
+    }
+
+    // Remember the outcome of a transfer. Throughput is only learned from transfers large
+    // enough that connection setup does not dominate. supports_range 1 records that ranges
+    // work, 0 forgets it and -1 leaves it as it was.
+    void Record(const std::string& url, int threads, int supports_range, long http_version,
+                long long bytes, double seconds) {
+        std::string host = HostKey(url);
+        if (host.empty()) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        HostProfile profile;
+        if (!Load(host, profile)) {
+            profile = HostProfile();
+            profile.host = host;
+        }
+        if (supports_range == 1) profile.supports_range = 1;
+        else if (supports_range == 0) profile.supports_range = -1;
+        if (http_version > 0) profile.http_version = http_version;
+        profile.updated = time(nullptr);
+
+        if (threads > 0 && bytes >= kMinLearnBytes && seconds > 0) {
+            double measured = bytes / seconds;
+            auto it = profile.rate.find(threads);
+            profile.rate[threads] = it == profile.rate.end() ? measured
+                                                              : it->second + kSmoothing * (measured - it->second);
+            profile.samples[threads]++;
+        }
+        if (!Save(profile)) {
+            LogWarning() << "Failed to save host profile for " << host;
+        }
+    }
+};
+
+#endif // HOSTPROFILES_H
@@ -0,0 +1,600 @@
+#ifndef HTTPMIRROR_H
+#define HTTPMIRROR_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <chrono>
+#include <iomanip>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// Mirror a directory tree published as HTTP index pages (Apache/nginx autoindex and the like)
+// into a local directory. Index pages are crawled and every file is checked with a conditional
+// HEAD, both on a bounded pool of worker threads. Files whose size and ETag or Last-Modified
+// still match the previous sync are skipped; new and changed files are handed to a fetcher
+// (normally the multi-connection downloader) and renamed into place once complete. The
+// validators of the last sync are kept in <directory>/.mtmirror, and fetched files get the
+// server's Last-Modified as their mtime so unchanged files are recognised even without it.
+class DirectoryMirror {
+public:
+    // Download url to path; size is the length reported by HEAD, or -1 if unknown
+    using Fetcher = std::function<bool(const std::string& url, const std::string& path, curl_off_t size)>;
+
+private:
+    struct Validators {
+        std::string etag;
+        std::string last_modified;
+        curl_off_t size = -1;
+    };
+
+    struct RemoteFile {
+        std::string url;
+        std::string path;           // relative to the mirror root, decoded
+        Validators validators;
+        bool present = false;       // an up-to-date copy exists locally
+    };
+
+    enum class TaskKind { Index, Head, Fetch };
+
+    struct Task {
+        TaskKind kind;
+        std::string url;
+        int depth = 0;
+        size_t file = 0;            // index into files for Head and Fetch
+    };
+
+    std::string root_url;
+    std::string root_path;          // decoded URL path of root_url
+    std::string directory;
+    int jobs;
+    bool delete_stale = false;
+    Fetcher fetcher;
+
+    std::map<std::string, Validators> previous;   // last sync, by relative path
+    std::vector<RemoteFile> files;
+    std::set<std::string> seen_urls;
+    std::set<std::string> remote_directories;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Task> tasks;
+    int busy = 0;
+
+    // Outcome counters, guarded by mutex
+    int directories = 0;
+    int index_errors = 0;
+    int unchanged = 0;
+    int added = 0;
+    int updated = 0;
+    int failed = 0;
+    int removed = 0;
+    long long fetched_bytes = 0;
+
+    static constexpr int kMaxDepth = 32;
+    static constexpr size_t kMaxIndexBytes = 16 * 1024 * 1024;
+    static constexpr const char* kStateFile = ".mtmirror";
+    static constexpr const char* kPartSuffix = ".mtmirror-part";
+
+    std::string LocalPath(const std::string& relative) const { return directory + "/" + relative; }
+
+    static void MakeDirectory(const std::string& path) {
+        std::string partial;
+        std::stringstream parts(path);
+        std::string part;
+        if (!path.empty() && path[0] == '/') partial = "/";
+        while (std::getline(parts, part, '/')) {
+            if (part.empty()) continue;
+            partial += part + "/";
+            mkdir(partial.c_str(), 0755);
+        }
+    }
+
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+        size_t total = size * nitems;
+        Validators* validators = static_cast<Validators*>(userdata);
+        std::string line(buffer, total);
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r\n") + 1);
+            if (name == "etag") validators->etag = value;
+            else if (name == "last-modified") validators->last_modified = value;
+        }
+        return total;
+    }
+
+    // Every href target on a page, with &amp; decoded and spaces encoded
+    static std::vector<std::string> ExtractLinks(const std::string& html) {
+        std::vector<std::string> links;
+        std::string lower = html;
+        std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return (char)tolower(c); });
+        size_t pos = 0;
+        while ((pos = lower.find("href", pos)) != std::string::npos) {
+            pos += 4;
+            while (pos < html.size() && isspace((unsigned char)html[pos])) ++pos;
+            if (pos >= html.size() || html[pos] != '=') continue;
+            ++pos;
+            while (pos < html.size() && isspace((unsigned char)html[pos])) ++pos;
+            if (pos >= html.size()) break;
+            size_t end;
+            if (html[pos] == '"' || html[pos] == '\'') {
+                end = html.find(html[pos], pos + 1);
+                ++pos;
+            } else {
+                end = html.find_first_of(" \t\r\n>", pos);
+            }
+            if (end == std::string::npos) break;
+            std::string link = html.substr(pos, end - pos);
+            size_t amp;
+            while ((amp = link.find("&amp;")) != std::string::npos) {
+                link.replace(amp, 5, "&");
+            }
+            // Some generators leave spaces unencoded, which the URL parser rejects
+            size_t space;
+            while ((space = link.find(' ')) != std::string::npos) {
+                link.replace(space, 1, "%20");
+            }
+            links.push_back(link);
+            pos = end;
+        }
+        return links;
+    }
+
+    // Resolve a link against the page it appeared on; the fragment is dropped.
+    // Also returns the decoded URL path.
+    static bool Resolve(const std::string& base, const std::string& link, std::string& url, std::string& path) {
+        CURLU* parsed = curl_url();
+        char* full = nullptr;
+        char* decoded = nullptr;
+        bool ok = parsed && curl_url_set(parsed, CURLUPART_URL, base.c_str(), 0) == CURLUE_OK &&
+                  curl_url_set(parsed, CURLUPART_URL, link.c_str(), 0) == CURLUE_OK &&
+                  curl_url_set(parsed, CURLUPART_FRAGMENT, nullptr, 0) == CURLUE_OK &&
+                  curl_url_get(parsed, CURLUPART_URL, &full, 0) == CURLUE_OK &&
+                  curl_url_get(parsed, CURLUPART_PATH, &decoded, CURLU_URLDECODE) == CURLUE_OK;
+        if (ok) {
+            url = full;
+            path = decoded;
+        }
+        curl_free(full);
+        curl_free(decoded);
+        if (parsed) curl_url_cleanup(parsed);
+        return ok;
+    }
+
+    // A relative path is only written locally if it cannot escape the mirror directory
+    static bool SafeRelativePath(const std::string& path) {
+        if (path.empty() || path[0] == '/' || path.find_first_of("\t\r\n", 0) != std::string::npos ||
+            path.find('\0') != std::string::npos) {
+            return false;
+        }
+        std::stringstream parts(path);
+        std::string part;
+        while (std::getline(parts, part, '/')) {
+            if (part == ".." || part == ".") return false;
+        }
+        return true;
+    }
+
+    void LoadState() {
+        std::ifstream in(LocalPath(kStateFile));
+        std::string line;
+        while (std::getline(in, line)) {
+            // size \t etag \t last-modified \t path
+            size_t t1 = line.find('\t');
+            size_t t2 = t1 == std::string::npos ? t1 : line.find('\t', t1 + 1);
+            size_t t3 = t2 == std::string::npos ? t2 : line.find('\t', t2 + 1);
+            if (t3 == std::string::npos) continue;
+            Validators validators;
+            validators.size = atoll(line.substr(0, t1).c_str());
+            validators.etag = line.substr(t1 + 1, t2 - t1 - 1);
+            validators.last_modified = line.substr(t2 + 1, t3 - t2 - 1);
+            previous[line.substr(t3 + 1)] = validators;
+        }
+    }
+
+    // Write to a temporary file and rename so an interrupted sync keeps the previous state
+    bool SaveState() {
+        std::string path = LocalPath(kStateFile);
+        std::string temp = path + ".tmp" + std::to_string(getpid());
+        {
+            std::ofstream out(temp);
+            if (!out.is_open()) {
+                return false;
+            }
+            for (const RemoteFile& file : files) {
+                if (!file.present) continue;
+                out << file.validators.size << "\t" << file.validators.etag << "\t"
+                    << file.validators.last_modified << "\t" << file.path << "\n";
+            }
+        }
+        return rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    // Fetch one index page and queue its subdirectories and files
+    void CrawlIndex(const Task& task) {
+        TraceSpan span("mirror", "index");
+        std::string body;
+        std::string content_type;
+        long response_code = 0;
+        CURLcode res = CURLE_FAILED_INIT;
+        CURL* curl = curl_easy_init();
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_URL, task.url.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](void* contents, size_t size, size_t nmemb, void* userp) {
+                std::string* page = static_cast<std::string*>(userp);
+                if (page->size() + size * nmemb > kMaxIndexBytes) return (size_t)0;
+                page->append(static_cast<char*>(contents), size * nmemb);
+                return size * nmemb;
+            });
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+            res = curl_easy_perform(curl);
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            char* type = nullptr;
+            if (curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &type) == CURLE_OK && type) {
+                content_type = type;
+            }
+            curl_easy_cleanup(curl);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        ++directories;
+        if (res != CURLE_OK || response_code >= 400) {
+            LogError() << "Cannot read index " << task.url << ": "
+                       << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            ++index_errors;
+            return;
+        }
+        if (content_type.find("html") == std::string::npos) {
+            LogWarning() << "Not an index page: " << task.url << " (" << content_type << ")";
+            ++index_errors;
+            return;
+        }
+
+        int queued_files = 0;
+        for (const std::string& link : ExtractLinks(body)) {
+            // Sort-order links and the like carry a query; absolute links elsewhere are not ours
+            if (link.empty() || link.find('?') != std::string::npos || link[0] == '#') continue;
+            std::string url;
+            std::string path;
+            if (!Resolve(task.url, link, url, path)) continue;
+            if (url.compare(0, root_url.size(), root_url) != 0 || url.size() == root_url.size() ||
+                path.compare(0, root_path.size(), root_path) != 0) {
+                continue;
+            }
+            if (!seen_urls.insert(url).second) continue;
+            std::string relative = path.substr(root_path.size());
+            bool is_directory = !relative.empty() && relative.back() == '/';
+            if (is_directory) relative.pop_back();
+            if (!SafeRelativePath(relative) || relative == kStateFile) {
+                LogWarning() << "Skipping unsafe path " << url;
+                continue;
+            }
+            if (is_directory) {
+                remote_directories.insert(relative);
+                if (task.depth + 1 > kMaxDepth) {
+                    LogWarning() << "Not descending into " << url << ": too deep";
+                    continue;
+                }
+                tasks.push_back(Task{TaskKind::Index, url, task.depth + 1, 0});
+            } else {
+                RemoteFile file;
+                file.url = url;
+                file.path = relative;
+                files.push_back(file);
+                tasks.push_back(Task{TaskKind::Head, url, task.depth, files.size() - 1});
+                ++queued_files;
+            }
+        }
+        LogDebug() << "Index " << task.url << ": " << queued_files << " files";
+        changed.notify_all();
+    }
+
+    // Conditional HEAD: decide whether the local copy of a file is still current
+    void CheckFile(const Task& task) {
+        TraceSpan span("mirror", "head");
+        std::string relative;
+        Validators known;
+        bool have_previous = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            relative = files[task.file].path;
+            auto it = previous.find(relative);
+            if (it != previous.end()) {
+                known = it->second;
+                have_previous = true;
+            }
+        }
+        struct stat local;
+        bool exists = stat(LocalPath(relative).c_str(), &local) == 0 && S_ISREG(local.st_mode);
+        bool intact = exists && have_previous && local.st_size == known.size;
+
+        Validators fresh;
+        long response_code = 0;
+        CURLcode res = CURLE_FAILED_INIT;
+        CURL* curl = curl_easy_init();
+        if (curl) {
+            struct curl_slist* headers = nullptr;
+            if (intact && !known.etag.empty()) {
+                headers = curl_slist_append(headers, ("If-None-Match: " + known.etag).c_str());
+            } else if (intact && !known.last_modified.empty()) {
+                headers = curl_slist_append(headers, ("If-Modified-Since: " + known.last_modified).c_str());
+            }
+            curl_easy_setopt(curl, CURLOPT_URL, task.url.c_str());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, &fresh);
+            res = curl_easy_perform(curl);
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            curl_off_t length = -1;
+            if (curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK) {
+                fresh.size = length;
+            }
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(headers);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        RemoteFile& file = files[task.file];
+        if (res != CURLE_OK || response_code >= 400) {
+            LogError() << "HEAD " << task.url << " failed: "
+                       << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            ++failed;
+            // Keep whatever copy exists; it is neither refreshed nor deleted
+            file.validators = known;
+            file.present = intact;
+            return;
+        }
+        if (response_code == 304) {
+            file.validators = known;
+            file.present = true;
+            ++unchanged;
+            return;
+        }
+
+        file.validators = fresh;
+        bool same_size = exists && fresh.size >= 0 && local.st_size == fresh.size;
+        bool same_etag = have_previous && !fresh.etag.empty() && fresh.etag == known.etag;
+        time_t modified = fresh.last_modified.empty() ? -1 : curl_getdate(fresh.last_modified.c_str(), nullptr);
+        bool same_time = modified > 0 && local.st_mtime == modified;
+        if (same_size && (same_etag || same_time)) {
+            file.present = true;
+            ++unchanged;
+            return;
+        }
+        tasks.push_back(Task{TaskKind::Fetch, task.url, task.depth, task.file});
+        changed.notify_all();
+    }
+
+    // Download a new or changed file next to its final name, then move it into place
+    void FetchFile(const Task& task) {
+        TraceSpan span("mirror", "fetch");
+        std::string relative;
+        Validators validators;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            relative = files[task.file].path;
+            validators = files[task.file].validators;
+        }
+        std::string path = LocalPath(relative);
+        size_t slash = path.rfind('/');
+        MakeDirectory(path.substr(0, slash));
+        bool existed = access(path.c_str(), F_OK) == 0;
+
+        std::string temp = path + kPartSuffix;
+        LogInfo() << (existed ? "Updating " : "Fetching ") << relative
+                  << (validators.size >= 0 ? " (" + std::to_string(validators.size) + " bytes)" : std::string());
+        bool ok = fetcher(task.url, temp, validators.size);
+        struct stat written;
+        if (ok && validators.size >= 0 && (stat(temp.c_str(), &written) != 0 || written.st_size != validators.size)) {
+            LogError() << "Size mismatch for " << relative;
+            ok = false;
+        }
+        if (ok && rename(temp.c_str(), path.c_str()) != 0) {
+            LogError() << "Cannot move " << temp << " into place: " << strerror(errno);
+            ok = false;
+        }
+        if (!ok) {
+            std::remove(temp.c_str());
+        } else if (!validators.last_modified.empty()) {
+            time_t modified = curl_getdate(validators.last_modified.c_str(), nullptr);
+            if (modified > 0) {
+                struct utimbuf times;
+                times.actime = time(nullptr);
+                times.modtime = modified;
+                utime(path.c_str(), &times);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        RemoteFile& file = files[task.file];
+        if (!ok) {
+            LogError() << "Failed to fetch " << relative;
+            ++failed;
+            return;
+        }
+        file.present = true;
+        if (validators.size < 0 && stat(path.c_str(), &written) == 0) {
+            file.validators.size = written.st_size;
+        }
+        fetched_bytes += file.validators.size > 0 ? file.validators.size : 0;
+        ++(existed ? updated : added);
+    }
+
+    // Run queued tasks on the worker pool until the queue is empty and no task is running.
+    // Tasks of the kinds not accepted are left queued.
+    void Drain(std::set<TaskKind> accepted) {
+        auto worker = [&](int id) {
+            TraceRecorder::Instance().SetThreadName("mirror " + std::to_string(id));
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                auto next = std::find_if(tasks.begin(), tasks.end(),
+                                         [&](const Task& task) { return accepted.count(task.kind) > 0; });
+                if (next == tasks.end()) {
+                    if (busy == 0) {
+                        changed.notify_all();
+                        return;
+                    }
+                    changed.wait(lock);
+                    continue;
+                }
+                Task task = *next;
+                tasks.erase(next);
+                ++busy;
+                lock.unlock();
+                if (task.kind == TaskKind::Index) CrawlIndex(task);
+                else if (task.kind == TaskKind::Head) CheckFile(task);
+                else FetchFile(task);
+                lock.lock();
+                --busy;
+                changed.notify_all();
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int i = 0; i < jobs; ++i) {
+            workers.emplace_back(worker, i);
+        }
+        for (auto& thread : workers) {
+            thread.join();
+        }
+    }
+
+    // Delete local files and directories that are no longer published
+    void RemoveStale(const std::string& relative_directory) {
+        std::string path = relative_directory.empty() ? directory : LocalPath(relative_directory);
+        DIR* dir = opendir(path.c_str());
+        if (!dir) return;
+        std::vector<std::pair<std::string, bool>> entries;
+        while (dirent* entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name == "." || name == "..") continue;
+            std::string relative = relative_directory.empty() ? name : relative_directory + "/" + name;
+            struct stat info;
+            if (lstat(LocalPath(relative).c_str(), &info) != 0) continue;
+            entries.emplace_back(relative, S_ISDIR(info.st_mode));
+        }
+        closedir(dir);
+
+        std::set<std::string> published;
+        for (const RemoteFile& file : files) {
+            published.insert(file.path);
+        }
+        for (const auto& entry : entries) {
+            const std::string& relative = entry.first;
+            if (entry.second) {
+                RemoveStale(relative);
+                if (!remote_directories.count(relative) && rmdir(LocalPath(relative).c_str()) == 0) {
+                    LogInfo() << "Removed directory " << relative;
+                }
+            } else if (relative_directory.empty() && relative.compare(0, strlen(kStateFile), kStateFile) == 0) {
+                continue;
+            } else if (!published.count(relative)) {
+                if (std::remove(LocalPath(relative).c_str()) == 0) {
+                    LogInfo() << "Removed " << relative;
+                    ++removed;
+                }
+            }
+        }
+    }
+
+public:
+    DirectoryMirror(const std::string& url, const std::string& local_directory, int parallel, Fetcher fetch)
+        : root_url(url), directory(local_directory), jobs(std::max(parallel, 1)), fetcher(std::move(fetch)) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        if (root_url.empty() || root_url.back() != '/') {
+            root_url += '/';
+        }
+        while (directory.size() > 1 && directory.back() == '/') {
+            directory.pop_back();
+        }
+    }
+
+    ~DirectoryMirror() {
+        curl_global_cleanup();
+    }
+
+    // Delete local files that have disappeared from the server (only after a complete crawl)
+    void SetDeleteStale(bool enabled) {
+        delete_stale = enabled;
+    }
+
+    bool Run() {
+        TraceSpan session_span("session", "mirror");
+        auto start_time = std::chrono::steady_clock::now();
+        std::string canonical;
+        if (!Resolve(root_url, root_url, canonical, root_path)) {
+            LogError() << "Invalid mirror URL: " << root_url;
+            return false;
+        }
+        root_url = canonical;
+        MakeDirectory(directory);
+        LoadState();
+        LogInfo() << "Mirroring " << root_url << " into " << directory << " (" << jobs << " parallel requests, "
+                  << previous.size() << " files known from the last sync)";
+
+        // Crawl and check every file first, so the fetch phase knows the whole plan
+        seen_urls.insert(root_url);
+        tasks.push_back(Task{TaskKind::Index, root_url, 0, 0});
+        Drain({TaskKind::Index, TaskKind::Head});
+
+        long long planned = 0;
+        for (const Task& task : tasks) {
+            planned += std::max<curl_off_t>(files[task.file].validators.size, 0);
+        }
+        LogInfo() << directories << " directories, " << files.size() << " files: " << unchanged << " unchanged, "
+                  << tasks.size() << " to fetch (" << planned / 1024 / 1024 << " MB)";
+        Drain({TaskKind::Fetch});
+
+        if (!SaveState()) {
+            LogWarning() << "Cannot write " << LocalPath(kStateFile);
+        }
+        if (delete_stale) {
+            if (index_errors > 0) {
+                LogWarning() << "Not removing stale files: " << index_errors << " index pages could not be read";
+            } else {
+                RemoveStale("");
+            }
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        LogInfo() << "\n=== Mirror Summary ===";
+        LogInfo() << "Directories: " << directories << (index_errors ? " (" + std::to_string(index_errors) + " unreadable)" : "");
+        LogInfo() << "Files: " << added << " new, " << updated << " updated, " << unchanged << " unchanged, "
+                  << failed << " failed" << (delete_stale ? ", " + std::to_string(removed) + " removed" : "");
+        LogInfo() << "Fetched: " << fetched_bytes << " bytes in " << std::fixed << std::setprecision(1) << seconds << " s";
+        return failed == 0 && index_errors == 0;
+    }
+};
+
+#endif // HTTPMIRROR_H
@@ -0,0 +1,320 @@
+#ifndef HTTPRANGE_H
+#define HTTPRANGE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <curl/curl.h>
+
+// Inclusive byte range, as in an HTTP Range header
+struct ByteRange {
+    curl_off_t start;
+    curl_off_t end;
+
+    curl_off_t Length() const { return end - start + 1; }
+};
+
+// Fetches one or more byte ranges of a URL in a single request and hands every received byte
+// to a sink together with its absolute file offset. Handles the three shapes a server may
+// answer with: a single 206 part (Content-Range header), a multipart/byteranges 206 body, or a
+// plain 200 with the whole file (only the requested ranges are passed on).
+class RangeFetcher {
+public:
+    // Receives data at an absolute offset; return false to abort the transfer
+    using Sink = std::function<bool(curl_off_t offset, const char* data, size_t len)>;
+
+private:
+    enum class Mode { Unknown, Single, Multipart, Whole };
+
+    struct State {
+        const std::vector<ByteRange>* ranges;
+        const Sink* sink;
+        CURL* curl;
+        Mode mode = Mode::Unknown;
+        std::string content_type;
+        std::string content_range;
+        std::string boundary;
+        curl_off_t offset = 0;        // next absolute offset of body bytes
+        curl_off_t remaining = 0;     // bytes left in the current part (multipart)
+        bool in_part = false;
+        bool finished = false;
+        std::string pending;          // multipart header bytes awaiting a full header block
+        curl_off_t delivered = 0;
+        curl_off_t last_wanted = 0;
+        bool failed = false;
+    };
+
+    static std::string HeaderValue(const std::string& line, const char* name) {
+        size_t name_len = strlen(name);
+        if (line.size() <= name_len || strncasecmp(line.c_str(), name, name_len) != 0 || line[name_len] != ':') {
+            return "";
+        }
+        std::string value = line.substr(name_len + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r\n") + 1);
+        return value;
+    }
+
+    // "bytes 100-199/1000" -> start 100
+    static bool ParseContentRange(const std::string& value, curl_off_t& start, curl_off_t& end) {
+        const char* p = value.c_str();
+        if (strncasecmp(p, "bytes", 5) == 0) p += 5;
+        while (*p == ' ') ++p;
+        char* next = nullptr;
+        start = strtoll(p, &next, 10);
+        if (!next || *next != '-') return false;
+        end = strtoll(next + 1, nullptr, 10);
+        return end >= start;
+    }
+
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+        size_t total = size * nitems;
+        State* state = static_cast<State*>(userdata);
+        std::string line(buffer, total);
+        if (line.compare(0, 5, "HTTP/") == 0) {
+            // New response (e.g. after a redirect): forget headers of the previous one
+            state->content_type.clear();
+            state->content_range.clear();
+        }
+        std::string value = HeaderValue(line, "Content-Type");
+        if (!value.empty()) state->content_type = value;
+        value = HeaderValue(line, "Content-Range");
+        if (!value.empty()) state->content_range = value;
+        return total;
+    }
+
+    // Forward the slice of [offset, offset+len) that falls inside the requested ranges
+    static bool DeliverFiltered(State* state, curl_off_t offset, const char* data, size_t len) {
+        curl_off_t last = offset + (curl_off_t)len - 1;
+        for (const ByteRange& range : *state->ranges) {
+            curl_off_t from = std::max(range.start, offset);
+            curl_off_t to = std::min(range.end, last);
+            if (from <= to) {
+                if (!(*state->sink)(from, data + (from - offset), (size_t)(to - from + 1))) {
+                    return false;
+                }
+                state->delivered += to - from + 1;
+            }
+        }
+        return true;
+    }
+
+    static void DetectMode(State* state) {
+        long response_code = 0;
+        curl_easy_getinfo(state->curl, CURLINFO_RESPONSE_CODE, &response_code);
+        if (response_code == 200) {
+            state->mode = Mode::Whole;
+            state->offset = 0;
+            return;
+        }
+        size_t pos = state->content_type.find("boundary=");
+        if (response_code == 206 && strncasecmp(state->content_type.c_str(), "multipart/byteranges", 20) == 0 &&
+            pos != std::string::npos) {
+            state->boundary = state->content_type.substr(pos + 9);
+            size_t semicolon = state->boundary.find(';');
+            if (semicolon != std::string::npos) state->boundary.erase(semicolon);
+            if (!state->boundary.empty() && state->boundary.front() == '"') {
+                state->boundary = state->boundary.substr(1, state->boundary.size() - 2);
+            }
+            state->mode = Mode::Multipart;
+            return;
+        }
+        curl_off_t start = 0, end = 0;
+        if (response_code == 206 && ParseContentRange(state->content_range, start, end)) {
+            state->mode = Mode::Single;
+            state->offset = start;
+            return;
+        }
+        state->failed = true;
+    }
+
+    // Consume multipart/byteranges body bytes
+    static bool ConsumeMultipart(State* state, const char* data, size_t len) {
+        while (len > 0 && !state->finished) {
+            if (state->in_part) {
+                size_t take = (size_t)std::min<curl_off_t>(state->remaining, (curl_off_t)len);
+                if (!DeliverFiltered(state, state->offset, data, take)) return false;
+                state->offset += take;
+                state->remaining -= take;
+                data += take;
+                len -= take;
+                if (state->remaining == 0) state->in_part = false;
+                continue;
+            }
+
+            // Between parts: collect "\r\n--boundary\r\nheaders\r\n\r\n"
+            state->pending.append(data, len);
+            len = 0;
+            std::string marker = "--" + state->boundary;
+            size_t at = state->pending.find(marker);
+            if (at == std::string::npos) {
+                continue;
+            }
+            size_t after = at + marker.size();
+            if (state->pending.size() >= after + 2 && state->pending.compare(after, 2, "--") == 0) {
+                state->finished = true;
+                break;
+            }
+            size_t headers_end = state->pending.find("\r\n\r\n", after);
+            if (headers_end == std::string::npos) {
+                continue;
+            }
+
+            curl_off_t start = 0, end = 0;
+            bool have_range = false;
+            size_t line_start = after;
+            while (line_start < headers_end) {
+                size_t line_end = state->pending.find("\r\n", line_start);
+                std::string value = HeaderValue(state->pending.substr(line_start, line_end - line_start), "Content-Range");
+                if (!value.empty()) have_range = ParseContentRange(value, start, end);
+                line_start = line_end + 2;
+            }
+            if (!have_range) return false;
+
+            std::string rest = state->pending.substr(headers_end + 4);
+            state->pending.clear();
+            state->in_part = true;
+            state->offset = start;
+            state->remaining = end - start + 1;
+            // Re-feed whatever body bytes arrived together with the part headers
+            if (!rest.empty() && !ConsumeMultipart(state, rest.data(), rest.size())) return false;
+        }
+        return true;
+    }
+
+    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+        size_t total = size * nmemb;
+        State* state = static_cast<State*>(userp);
+        const char* data = static_cast<const char*>(contents);
+
+        if (state->mode == Mode::Unknown) {
+            DetectMode(state);
+        }
+        if (state->failed) return 0;
+
+        bool ok = true;
+        switch (state->mode) {
+        case Mode::Single:
+            ok = DeliverFiltered(state, state->offset, data, total);
+            state->offset += total;
+            break;
+        case Mode::Whole:
+            ok = DeliverFiltered(state, state->offset, data, total);
+            state->offset += total;
+            // Server ignored the Range header: stop once past the last wanted byte
+            if (ok && state->offset > state->last_wanted) {
+                state->finished = true;
+                return 0;
+            }
+            break;
+        case Mode::Multipart:
+            ok = ConsumeMultipart(state, data, total);
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok) state->failed = true;
+        return ok ? total : 0;
+    }
+
+public:
+    // "a-b,c-d,..." for CURLOPT_RANGE
+    static std::string RangeHeader(const std::vector<ByteRange>& ranges) {
+        std::string header;
+        for (const ByteRange& range : ranges) {
+            if (!header.empty()) header += ",";
+            header += std::to_string(range.start) + "-" + std::to_string(range.end);
+        }
+        return header;
+    }
+
+    // Merge ranges that touch or overlap (input need not be sorted)
+    static std::vector<ByteRange> Coalesce(std::vector<ByteRange> ranges) {
+        std::sort(ranges.begin(), ranges.end(), [](const ByteRange& a, const ByteRange& b) { return a.start < b.start; });
+        std::vector<ByteRange> merged;
+        for (const ByteRange& range : ranges) {
+            if (!merged.empty() && range.start <= merged.back().end + 1) {
+                merged.back().end = std::max(merged.back().end, range.end);
+            } else {
+                merged.push_back(range);
+            }
+        }
+        return merged;
+    }
+
+    // Fetch all ranges with one request. Returns true only if every requested byte was delivered.
+    // A caller issuing many requests can pass its own handle, which is reset but kept, so its
+    // connections and DNS cache are reused.
+    static bool Fetch(const std::string& url, const std::vector<ByteRange>& ranges, const Sink& sink,
+                      std::string* error = nullptr, CURL* handle = nullptr) {
+        CURL* curl = handle ? handle : curl_easy_init();
+        if (!curl) {
+            if (error) *error = "Failed to initialize curl";
+            return false;
+        }
+        if (handle) {
+            curl_easy_reset(handle);
+        }
+
+        State state;
+        state.ranges = &ranges;
+        state.sink = &sink;
+        state.curl = curl;
+        for (const ByteRange& r : ranges) state.last_wanted = std::max(state.last_wanted, r.end);
+
+        std::string range = RangeHeader(ranges);
+        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+        curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &state);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &state);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+
+        CURLcode res = curl_easy_perform(curl);
+        long response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        if (!handle) {
+            curl_easy_cleanup(curl);
+        }
+
+        curl_off_t wanted = 0;
+        for (const ByteRange& r : ranges) wanted += r.Length();
+
+        bool stopped_early = res == CURLE_WRITE_ERROR && state.finished && !state.failed;
+        if (res != CURLE_OK && !stopped_early) {
+            if (error) *error = curl_easy_strerror(res);
+            return false;
+        }
+        if (response_code != 200 && response_code != 206) {
+            if (error) *error = "HTTP " + std::to_string(response_code);
+            return false;
+        }
+        if (state.failed || state.delivered != wanted) {
+            if (error) *error = "Incomplete range response (" + std::to_string(state.delivered) + " of " +
+                                std::to_string(wanted) + " bytes)";
+            return false;
+        }
+        return true;
+    }
+
+    // Convenience: fetch a single range into memory
+    static bool FetchToMemory(const std::string& url, const ByteRange& range, std::string& out,
+                              std::string* error = nullptr, CURL* handle = nullptr) {
+        out.assign((size_t)range.Length(), '\0');
+        std::vector<ByteRange> ranges{range};
+        return Fetch(url, ranges, [&](curl_off_t offset, const char* data, size_t len) {
+            memcpy(&out[(size_t)(offset - range.start)], data, len);
+            return true;
+        }, error, handle);
+    }
+};
+
+#endif // HTTPRANGE_H
@@ -0,0 +1,228 @@
+#ifndef LINKPOOL_H
+#define LINKPOOL_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// Local uplinks a download may leave through. Each link is a network interface or a local
+// source address, optionally with a local port range, and a segment is bound to one of them
+// with CURLOPT_INTERFACE / CURLOPT_LOCALPORT. Links are picked by earliest expected
+// completion: a link's measured capacity (bytes over the time it had transfers in flight)
+// divided among the segments already on it, so faster uplinks carry proportionally more
+// connections and one download can exceed the capacity of any single link.
+class LinkPool {
+public:
+    struct Link {
+        std::string name;               // as configured, e.g. "eth1" or "192.168.2.10@40000-40999"
+        std::string interface_option;   // CURLOPT_INTERFACE value ("if!eth1", "host!192.168.2.10")
+        long local_port = 0;            // CURLOPT_LOCALPORT, 0 = any
+        long local_port_range = 0;      // CURLOPT_LOCALPORTRANGE
+        int active = 0;                 // segments currently transferring
+        long long bytes = 0;
+        double busy_seconds = 0;        // wall time with at least one segment in flight
+        std::chrono::steady_clock::time_point busy_since;
+        int failures = 0;
+        bool disabled = false;
+
+        double Throughput() const {
+            double seconds = busy_seconds;
+            if (active > 0) {
+                seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - busy_since).count();
+            }
+            return seconds > 0 ? bytes / seconds : 0;
+        }
+    };
+
+private:
+    std::vector<Link> links;
+    std::mutex mutex;
+
+    static constexpr int kMaxFailures = 2;
+
+    // Check that a source address is configured on this host by binding a throwaway socket to it
+    static bool CanBind(const std::string& ip) {
+        sockaddr_storage storage;
+        memset(&storage, 0, sizeof(storage));
+        socklen_t len;
+        int family;
+        if (ip.find(':') != std::string::npos) {
+            sockaddr_in6* sa = reinterpret_cast<sockaddr_in6*>(&storage);
+            sa->sin6_family = family = AF_INET6;
+            if (inet_pton(AF_INET6, ip.c_str(), &sa->sin6_addr) != 1) return false;
+            len = sizeof(sockaddr_in6);
+        } else {
+            sockaddr_in* sa = reinterpret_cast<sockaddr_in*>(&storage);
+            sa->sin_family = family = AF_INET;
+            if (inet_pton(AF_INET, ip.c_str(), &sa->sin_addr) != 1) return false;
+            len = sizeof(sockaddr_in);
+        }
+        int fd = socket(family, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        bool ok = bind(fd, reinterpret_cast<sockaddr*>(&storage), len) == 0;
+        close(fd);
+        return ok;
+    }
+
+    static bool IsAddress(const std::string& text) {
+        unsigned char buffer[sizeof(in6_addr)];
+        return inet_pton(AF_INET, text.c_str(), buffer) == 1 || inet_pton(AF_INET6, text.c_str(), buffer) == 1;
+    }
+
+    // Caller holds the mutex. The last usable link is never disabled.
+    void Disable(int index, const char* reason) {
+        int usable = 0;
+        for (const Link& l : links) {
+            if (!l.disabled) ++usable;
+        }
+        if (usable <= 1 || links[index].disabled) return;
+        links[index].disabled = true;
+        TraceRecorder::Instance().Instant("scheduler", "disable_link", "index", index);
+        LogWarning() << "Disabling link " << links[index].name << " (" << reason << ")";
+    }
+
+public:
+    // Add one link: an interface name or a local address, optionally followed by
+    // "@port" or "@low-high" to also pin the local port. Returns false if it is not usable here.
+    bool Add(const std::string& spec) {
+        Link link;
+        link.name = spec;
+        std::string source = spec;
+        size_t at = spec.rfind('@');
+        if (at != std::string::npos) {
+            source = spec.substr(0, at);
+            std::string ports = spec.substr(at + 1);
+            size_t dash = ports.find('-');
+            long low = atol(ports.substr(0, dash).c_str());
+            long high = dash == std::string::npos ? low : atol(ports.substr(dash + 1).c_str());
+            if (low <= 0 || low > 65535 || high < low || high > 65535) {
+                LogWarning() << "Ignoring link " << spec << ": bad local port range";
+                return false;
+            }
+            link.local_port = low;
+            link.local_port_range = high - low + 1;
+        }
+        if (source.size() > 2 && source.front() == '[' && source.back() == ']') {
+            source = source.substr(1, source.size() - 2);
+        }
+
+        if (IsAddress(source)) {
+            if (!CanBind(source)) {
+                LogWarning() << "Ignoring link " << spec << ": address is not configured on this host";
+                return false;
+            }
+            link.interface_option = "host!" + source;
+        } else {
+            if (if_nametoindex(source.c_str()) == 0) {
+                LogWarning() << "Ignoring link " << spec << ": no such interface";
+                return false;
+            }
+            link.interface_option = "if!" + source;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        links.push_back(link);
+        LogInfo() << "Link " << spec << " available";
+        return true;
+    }
+
+    // Add every entry of a comma-separated list; returns the number of usable links
+    size_t Configure(const std::string& list) {
+        size_t pos = 0;
+        while (pos <= list.size()) {
+            size_t comma = list.find(',', pos);
+            std::string item = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            item.erase(0, item.find_first_not_of(" \t"));
+            item.erase(item.find_last_not_of(" \t") + 1);
+            if (!item.empty()) {
+                Add(item);
+            }
+            if (comma == std::string::npos) break;
+            pos = comma + 1;
+        }
+        return Size();
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return links.size();
+    }
+
+    // Choose the link that would finish one more segment soonest. Links not yet measured are
+    // assumed as fast as the best measured one so each gets tried. Returns -1 if there are none.
+    int Acquire() {
+        std::lock_guard<std::mutex> lock(mutex);
+        double best_rate = 0;
+        for (const Link& l : links) {
+            if (!l.disabled) best_rate = std::max(best_rate, l.Throughput());
+        }
+        int best = -1;
+        double best_cost = 0;
+        for (size_t i = 0; i < links.size(); ++i) {
+            const Link& l = links[i];
+            if (l.disabled) continue;
+            double rate = l.Throughput();
+            if (rate <= 0) rate = best_rate > 0 ? best_rate : 1;
+            double cost = (l.active + 1) / rate;
+            if (best < 0 || cost < best_cost) {
+                best = (int)i;
+                best_cost = cost;
+            }
+        }
+        if (best >= 0) {
+            Link& link = links[best];
+            if (link.active++ == 0) {
+                link.busy_since = std::chrono::steady_clock::now();
+            }
+        }
+        return best;
+    }
+
+    // Record the outcome of a segment sent over a link
+    void Release(int index, long long bytes, bool success) {
+        if (index < 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Link& link = links[index];
+        link.bytes += bytes;
+        if (--link.active == 0) {
+            link.busy_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - link.busy_since).count();
+        }
+        if (success) {
+            link.failures = 0;
+        } else if (++link.failures >= kMaxFailures) {
+            Disable(index, "repeated failures");
+        }
+    }
+
+    // Bind a handle to a link
+    void Apply(CURL* curl, int index) {
+        if (index < 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        const Link& link = links[index];
+        curl_easy_setopt(curl, CURLOPT_INTERFACE, link.interface_option.c_str());
+        if (link.local_port > 0) {
+            curl_easy_setopt(curl, CURLOPT_LOCALPORT, link.local_port);
+            curl_easy_setopt(curl, CURLOPT_LOCALPORTRANGE, link.local_port_range);
+        }
+    }
+
+    std::vector<Link> Snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return links;
+    }
+};
+
+#endif // LINKPOOL_H
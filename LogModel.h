@@ -0,0 +1,154 @@
+#ifndef LOGMODEL_H
+#define LOGMODEL_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QDateTime>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtGui/QBrush>
+#include <QtGui/QColor>
+#include <deque>
+#include <vector>
+#include "Logger.h"
+
+// Fixed-capacity log backing a QListView. Any thread may append(); lines are queued and only
+// enter the model when the UI thread calls flush() (once per frame from a timer), so a burst
+// of thousands of messages costs one row insertion and one repaint. When the ring is full the
+// oldest lines are dropped. The model exposes only lines passing the level and text filters,
+// and with uniform item sizes the view only ever lays out the rows on screen.
+class LogModel : public QAbstractListModel {
+public:
+    static constexpr int kDefaultCapacity = 20000;
+
+    explicit LogModel(int capacity = kDefaultCapacity, QObject *parent = nullptr)
+        : QAbstractListModel(parent), m_capacity(qMax(capacity, 1)) {}
+
+    // Thread-safe; the line shows up on the next flush()
+    void append(LogLevel level, const QString &text) {
+        QMutexLocker locker(&m_pendingMutex);
+        m_pending.push_back(Entry{QDateTime::currentMSecsSinceEpoch(), level, text});
+    }
+
+    // UI thread: move queued lines into the ring. Returns true if visible rows changed.
+    bool flush() {
+        QVector<Entry> batch;
+        {
+            QMutexLocker locker(&m_pendingMutex);
+            if (m_pending.isEmpty()) return false;
+            batch.swap(m_pending);
+        }
+        // Lines beyond capacity would be evicted within this batch anyway
+        int batchSize = (int)batch.size();
+        int skip = qMax(0, batchSize - m_capacity);
+        int incoming = batchSize - skip;
+
+        // Evict the oldest lines to make room
+        int evict = qMax(0, (int)m_entries.size() + incoming - m_capacity);
+        if (evict > 0) {
+            unsigned long long firstKept = m_firstSequence + (unsigned long long)evict;
+            int visibleEvicted = 0;
+            while (visibleEvicted < (int)m_visible.size() && m_visible[visibleEvicted] < firstKept) ++visibleEvicted;
+            if (visibleEvicted > 0) {
+                beginRemoveRows(QModelIndex(), 0, visibleEvicted - 1);
+                m_visible.erase(m_visible.begin(), m_visible.begin() + visibleEvicted);
+                endRemoveRows();
+            }
+            m_entries.erase(m_entries.begin(), m_entries.begin() + evict);
+            m_firstSequence = firstKept;
+        }
+
+        m_firstSequence += (unsigned long long)skip;
+        std::vector<unsigned long long> added;
+        for (int i = skip; i < batchSize; ++i) {
+            unsigned long long sequence = m_firstSequence + m_entries.size();
+            m_entries.push_back(batch[i]);
+            if (accepts(m_entries.back())) added.push_back(sequence);
+        }
+        if (added.empty()) return evict > 0;
+
+        int first = (int)m_visible.size();
+        beginInsertRows(QModelIndex(), first, first + (int)added.size() - 1);
+        m_visible.insert(m_visible.end(), added.begin(), added.end());
+        endInsertRows();
+        return true;
+    }
+
+    void clear() {
+        {
+            QMutexLocker locker(&m_pendingMutex);
+            m_pending.clear();
+        }
+        beginResetModel();
+        m_firstSequence += m_entries.size();
+        m_entries.clear();
+        m_visible.clear();
+        endResetModel();
+    }
+
+    // Show only lines at or above level
+    void setMinimumLevel(LogLevel level) {
+        if (level == m_minimumLevel) return;
+        m_minimumLevel = level;
+        rebuildVisible();
+    }
+
+    // Show only lines containing text (case-insensitive); empty shows everything
+    void setFilterText(const QString &text) {
+        if (text == m_filterText) return;
+        m_filterText = text;
+        rebuildVisible();
+    }
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override {
+        return parent.isValid() ? 0 : (int)m_visible.size();
+    }
+
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override {
+        if (!index.isValid() || index.row() >= (int)m_visible.size()) return QVariant();
+        const Entry &entry = m_entries[m_visible[index.row()] - m_firstSequence];
+        if (role == Qt::DisplayRole) {
+            QString timestamp = QDateTime::fromMSecsSinceEpoch(entry.time).toString("hh:mm:ss");
+            return QString("[%1] %2").arg(timestamp, entry.text);
+        }
+        if (role == Qt::ForegroundRole) {
+            if (entry.level == LogLevel::Error) return QBrush(QColor(0xc6, 0x28, 0x28));
+            if (entry.level == LogLevel::Warning) return QBrush(QColor(0xb2, 0x6a, 0x00));
+            if (entry.level == LogLevel::Debug) return QBrush(QColor(0x75, 0x75, 0x75));
+        }
+        return QVariant();
+    }
+
+private:
+    struct Entry {
+        qint64 time;
+        LogLevel level;
+        QString text;
+    };
+
+    bool accepts(const Entry &entry) const {
+        return entry.level >= m_minimumLevel &&
+               (m_filterText.isEmpty() || entry.text.contains(m_filterText, Qt::CaseInsensitive));
+    }
+
+    void rebuildVisible() {
+        beginResetModel();
+        m_visible.clear();
+        for (size_t i = 0; i < m_entries.size(); ++i) {
+            if (accepts(m_entries[i])) m_visible.push_back(m_firstSequence + i);
+        }
+        endResetModel();
+    }
+
+    int m_capacity;
+    std::deque<Entry> m_entries;                 // oldest first
+    unsigned long long m_firstSequence = 0;      // sequence number of m_entries.front()
+    std::deque<unsigned long long> m_visible;    // sequence numbers of rows shown
+    LogLevel m_minimumLevel = LogLevel::Debug;
+    QString m_filterText;
+
+    QMutex m_pendingMutex;
+    QVector<Entry> m_pending;
+};
+
+#endif // LOGMODEL_H
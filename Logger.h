@@ -0,0 +1,351 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+#include <unistd.h>
+
+enum class LogLevel { Debug = 0, Info, Warning, Error, Off };
+
+// Live progress of one download, split into segments. Worker threads only store counters here;
+// formatting and printing happen on the logger thread.
+struct ProgressBoard {
+    std::string label;
+    std::vector<std::atomic<long long>> segment_done;
+    std::vector<std::atomic<long long>> segment_total;
+    std::chrono::steady_clock::time_point start_time;
+
+    ProgressBoard(const std::string& label, size_t segments)
+        : label(label), segment_done(segments), segment_total(segments),
+          start_time(std::chrono::steady_clock::now()) {
+        for (size_t i = 0; i < segments; ++i) {
+            segment_done[i].store(0, std::memory_order_relaxed);
+            segment_total[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void SetDone(size_t segment, long long bytes) {
+        segment_done[segment].store(bytes, std::memory_order_relaxed);
+    }
+
+    void SetTotal(size_t segment, long long bytes) {
+        segment_total[segment].store(bytes, std::memory_order_relaxed);
+    }
+};
+
+// Asynchronous logger. Producers push onto an intrusive lock-free MPSC queue (one atomic
+// exchange per message) and a background thread does all stream I/O, so worker threads never
+// contend on std::cout. The same thread renders registered ProgressBoards at a fixed rate:
+// multi-line per-segment bars on a terminal, a plain line per second otherwise.
+class Logger {
+public:
+    using Sink = std::function<void(LogLevel, const std::string&)>;
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        LogLevel level = LogLevel::Info;
+        std::string text;
+    };
+
+    std::atomic<Node*> head;   // producers append here
+    Node* tail;                // consumer side, only touched by the logger thread
+    std::atomic<unsigned long long> pushed{0};
+    std::atomic<unsigned long long> written{0};
+
+    std::atomic<int> min_level{static_cast<int>(LogLevel::Info)};
+    std::atomic<bool> running{true};
+    std::atomic<bool> sleeping{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake_cv;
+    std::condition_variable drained_cv;
+
+    std::mutex boards_mutex;
+    std::vector<std::shared_ptr<ProgressBoard>> boards;
+    std::mutex sink_mutex;
+    Sink sink;
+
+    static constexpr size_t kMaxSegmentLines = 16;
+
+    bool tty;
+    int drawn_lines = 0;
+    std::chrono::steady_clock::time_point last_render;
+    std::thread worker;
+
+    Logger() : tty(isatty(STDOUT_FILENO) != 0) {
+        Node* stub = new Node();
+        head.store(stub);
+        tail = stub;
+        worker = std::thread(&Logger::Run, this);
+    }
+
+    ~Logger() {
+        running.store(false);
+        wake_cv.notify_one();
+        if (worker.joinable()) {
+            worker.join();
+        }
+        delete tail;
+    }
+
+    // Pop one message; only called from the logger thread
+    bool Pop(LogLevel& level, std::string& text) {
+        Node* next = tail->next.load(std::memory_order_acquire);
+        if (!next) {
+            return false;
+        }
+        level = next->level;
+        text = std::move(next->text);
+        delete tail;
+        tail = next;
+        return true;
+    }
+
+    static std::string FormatBytes(long long bytes) {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1);
+        if (bytes >= 1024LL * 1024 * 1024) out << bytes / (1024.0 * 1024 * 1024) << " GB";
+        else if (bytes >= 1024LL * 1024) out << bytes / (1024.0 * 1024) << " MB";
+        else if (bytes >= 1024) out << bytes / 1024.0 << " KB";
+        else out << bytes << " B";
+        return out.str();
+    }
+
+    static std::string Bar(double fraction, int width) {
+        int filled = static_cast<int>(fraction * width);
+        filled = std::max(0, std::min(width, filled));
+        return std::string(filled, '#') + std::string(width - filled, '-');
+    }
+
+    void ClearDrawnBars() {
+        for (; drawn_lines > 0; --drawn_lines) {
+            std::cout << "\x1b[1A\x1b[2K";
+        }
+    }
+
+    void RenderBoards(bool force) {
+        auto now = std::chrono::steady_clock::now();
+        auto interval = std::chrono::milliseconds(tty ? 100 : 1000);
+        if (!force && now - last_render < interval) {
+            return;
+        }
+        last_render = now;
+
+        std::vector<std::shared_ptr<ProgressBoard>> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(boards_mutex);
+            snapshot = boards;
+        }
+        if (snapshot.empty() || !IsEnabled(LogLevel::Info)) {
+            return;
+        }
+
+        std::ostringstream out;
+        int lines = 0;
+        for (const auto& board : snapshot) {
+            long long done = 0, total = 0;
+            size_t segments = board->segment_done.size();
+            for (size_t i = 0; i < segments; ++i) {
+                done += board->segment_done[i].load(std::memory_order_relaxed);
+                total += board->segment_total[i].load(std::memory_order_relaxed);
+            }
+            double elapsed = std::chrono::duration<double>(now - board->start_time).count();
+            double speed = elapsed > 0 ? done / elapsed : 0;
+            double fraction = total > 0 ? (double)done / total : 0;
+
+            if (tty) {
+                out << board->label << " [" << Bar(fraction, 40) << "] " << std::fixed << std::setprecision(1)
+                    << fraction * 100.0 << "% " << FormatBytes(done) << "/" << FormatBytes(total)
+                    << " " << FormatBytes((long long)speed) << "/s\n";
+                ++lines;
+                if (segments > 1) {
+                    for (size_t i = 0; i < segments; ++i) {
+                        long long seg_done = board->segment_done[i].load(std::memory_order_relaxed);
+                        long long seg_total = board->segment_total[i].load(std::memory_order_relaxed);
+                        double seg_fraction = seg_total > 0 ? (double)seg_done / seg_total : 0;
+                        // With many segments only the ones currently transferring get a bar
+                        if (segments > kMaxSegmentLines && (seg_done == 0 || seg_done >= seg_total)) {
+                            continue;
+                        }
+                        out << "  #" << std::setw(3) << std::left << i << std::right << " [" << Bar(seg_fraction, 30)
+                            << "] " << std::setw(5) << std::setprecision(1) << seg_fraction * 100.0 << "%\n";
+                        ++lines;
+                    }
+                }
+            } else {
+                out << "Progress: " << std::fixed << std::setprecision(1) << fraction * 100.0 << "% ("
+                    << done << "/" << total << " bytes) Speed: " << speed / 1024 << " KB/s\n";
+            }
+        }
+
+        if (tty) {
+            ClearDrawnBars();
+            drawn_lines = lines;
+        }
+        std::cout << out.str() << std::flush;
+    }
+
+    void Run() {
+        last_render = std::chrono::steady_clock::now();
+        while (true) {
+            LogLevel level;
+            std::string text;
+            bool wrote = false;
+            bool cleared = false;
+            Sink local_sink;
+            {
+                std::lock_guard<std::mutex> lock(sink_mutex);
+                local_sink = sink;
+            }
+            while (Pop(level, text)) {
+                if (local_sink) {
+                    local_sink(level, text);
+                } else {
+                    if (tty && !cleared) {
+                        ClearDrawnBars();
+                        cleared = true;
+                    }
+                    std::ostream& stream = level >= LogLevel::Warning ? std::cerr : std::cout;
+                    stream << text << '\n';
+                }
+                written.fetch_add(1, std::memory_order_release);
+                wrote = true;
+            }
+            if (wrote) {
+                std::cout.flush();
+                std::cerr.flush();
+                { std::lock_guard<std::mutex> lock(wake_mutex); }
+                drained_cv.notify_all();
+            }
+
+            if (!local_sink) {
+                RenderBoards(cleared);
+            }
+
+            if (!running.load() && written.load() == pushed.load()) {
+                break;
+            }
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            sleeping.store(true);
+            if (tail->next.load(std::memory_order_acquire) == nullptr && running.load()) {
+                wake_cv.wait_for(lock, std::chrono::milliseconds(50));
+            }
+            sleeping.store(false);
+        }
+        { std::lock_guard<std::mutex> lock(wake_mutex); }
+        drained_cv.notify_all();
+    }
+
+public:
+    static Logger& Instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    void SetLevel(LogLevel level) { min_level.store(static_cast<int>(level), std::memory_order_relaxed); }
+    LogLevel Level() const { return static_cast<LogLevel>(min_level.load(std::memory_order_relaxed)); }
+
+    bool IsEnabled(LogLevel level) const {
+        return static_cast<int>(level) >= min_level.load(std::memory_order_relaxed);
+    }
+
+    // Quiet mode: only errors, and downloaders skip progress callbacks entirely
+    void SetQuiet(bool quiet) { SetLevel(quiet ? LogLevel::Error : LogLevel::Info); }
+    bool ProgressEnabled() const { return IsEnabled(LogLevel::Info); }
+
+    // Route messages to a callback (e.g. a GUI) instead of stdout/stderr. Called on the logger thread.
+    void SetSink(Sink new_sink) {
+        Flush();
+        std::lock_guard<std::mutex> lock(sink_mutex);
+        sink = std::move(new_sink);
+    }
+
+    // Enqueue a message; never blocks on I/O
+    void Write(LogLevel level, std::string text) {
+        if (!IsEnabled(level)) return;
+        Node* node = new Node();
+        node->level = level;
+        node->text = std::move(text);
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        Node* prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+        if (sleeping.load(std::memory_order_relaxed)) {
+            wake_cv.notify_one();
+        }
+    }
+
+    // Block until everything enqueued so far has been written
+    void Flush() {
+        unsigned long long target = pushed.load();
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_cv.notify_one();
+        drained_cv.wait_for(lock, std::chrono::seconds(5), [&] { return written.load() >= target; });
+    }
+
+    std::shared_ptr<ProgressBoard> BeginProgress(const std::string& label, size_t segments) {
+        auto board = std::make_shared<ProgressBoard>(label, segments);
+        std::lock_guard<std::mutex> lock(boards_mutex);
+        boards.push_back(board);
+        return board;
+    }
+
+    // Stop rendering a board; its bars are replaced by whatever is logged next
+    void EndProgress(const std::shared_ptr<ProgressBoard>& board) {
+        {
+            std::lock_guard<std::mutex> lock(boards_mutex);
+            boards.erase(std::remove(boards.begin(), boards.end(), board), boards.end());
+        }
+        Flush();
+    }
+};
+
+// One log line built with operator<< and enqueued on destruction. Formatting is skipped
+// entirely when the level is disabled.
+class LogLine {
+private:
+    LogLevel level;
+    bool enabled;
+    std::ostringstream stream;
+
+public:
+    explicit LogLine(LogLevel level) : level(level), enabled(Logger::Instance().IsEnabled(level)) {}
+
+    ~LogLine() {
+        if (enabled) {
+            Logger::Instance().Write(level, stream.str());
+        }
+    }
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        if (enabled) stream << value;
+        return *this;
+    }
+
+    LogLine& operator<<(std::ios_base& (*manip)(std::ios_base&)) {
+        if (enabled) stream << manip;
+        return *this;
+    }
+
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+};
+
+inline LogLine LogDebug() { return LogLine(LogLevel::Debug); }
+inline LogLine LogInfo() { return LogLine(LogLevel::Info); }
+inline LogLine LogWarning() { return LogLine(LogLevel::Warning); }
+inline LogLine LogError() { return LogLine(LogLevel::Error); }
+
+#endif // LOGGER_H
@@ -0,0 +1,88 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <curl/curl.h>
+
+// Process-wide cap on received-but-not-yet-written bytes. Buffers reserve their memory here
+// before accepting data; a transfer that cannot reserve pauses itself (CURL_WRITEFUNC_PAUSE)
+// and parks its multi handle with Wait(), and every Release() wakes the parked transfers so
+// they can retry. This keeps RSS fixed however many connections outrun the disk.
+class MemoryBudget {
+private:
+    std::atomic<long long> limit{256LL * 1024 * 1024};
+    std::atomic<long long> in_use{0};
+    std::atomic<long long> peak{0};
+
+    // Throttling metrics
+    std::atomic<unsigned long long> pauses{0};
+    std::atomic<long long> throttled_us{0};
+
+    std::mutex waiters_mutex;
+    std::vector<CURLM*> waiters;
+    std::atomic<int> waiter_count{0};
+
+    MemoryBudget() = default;
+
+public:
+    static MemoryBudget& Instance() {
+        static MemoryBudget budget;
+        return budget;
+    }
+
+    void SetLimit(long long bytes) { limit = std::max(bytes, 1LL); }
+    long long Limit() const { return limit; }
+    long long InUse() const { return in_use; }
+    long long Peak() const { return peak; }
+    unsigned long long Pauses() const { return pauses; }
+    long long ThrottledMicros() const { return throttled_us; }
+
+    // Reserve bytes if that stays within the limit. A reservation is always granted while
+    // nothing is reserved, so a limit smaller than one buffer still makes progress.
+    bool TryReserve(long long bytes) {
+        long long current = in_use.load(std::memory_order_relaxed);
+        do {
+            if (current > 0 && current + bytes > limit.load(std::memory_order_relaxed)) {
+                return false;
+            }
+        } while (!in_use.compare_exchange_weak(current, current + bytes, std::memory_order_acq_rel));
+        long long seen = peak.load(std::memory_order_relaxed);
+        while (current + bytes > seen && !peak.compare_exchange_weak(seen, current + bytes)) {
+        }
+        return true;
+    }
+
+    // Return bytes and wake transfers paused for lack of memory
+    void Release(long long bytes) {
+        in_use.fetch_sub(bytes, std::memory_order_acq_rel);
+        if (waiter_count.load(std::memory_order_acquire) > 0) {
+            std::lock_guard<std::mutex> lock(waiters_mutex);
+            for (CURLM* multi : waiters) {
+                curl_multi_wakeup(multi);
+            }
+        }
+    }
+
+    // A paused transfer registers to be woken on Release()
+    void Wait(CURLM* multi) {
+        std::lock_guard<std::mutex> lock(waiters_mutex);
+        waiters.push_back(multi);
+        waiter_count = (int)waiters.size();
+    }
+
+    void StopWaiting(CURLM* multi) {
+        std::lock_guard<std::mutex> lock(waiters_mutex);
+        waiters.erase(std::remove(waiters.begin(), waiters.end(), multi), waiters.end());
+        waiter_count = (int)waiters.size();
+    }
+
+    void RecordPause(long long micros) {
+        pauses++;
+        throttled_us += micros;
+    }
+};
+
+#endif // MEMORYBUDGET_H
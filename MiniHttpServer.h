@@ -0,0 +1,371 @@
+#ifndef MINIHTTPSERVER_H
+#define MINIHTTPSERVER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "Logger.h"
+
+// One parsed request. Header names are stored lower-case.
+struct HttpRequest {
+    std::string method;
+    std::string target;
+    std::string version;
+    std::map<std::string, std::string> headers;
+    std::string body;
+    std::string peer_address;
+
+    std::string Header(const std::string& name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? std::string() : it->second;
+    }
+
+    // Path without the query string, and one query parameter ("" if absent)
+    std::string Path() const { return target.substr(0, target.find('?')); }
+
+    std::string Query(const std::string& name) const {
+        size_t question = target.find('?');
+        if (question == std::string::npos) return "";
+        std::string query = target.substr(question + 1);
+        size_t pos = 0;
+        while (pos <= query.size()) {
+            size_t amp = query.find('&', pos);
+            std::string pair = query.substr(pos, amp == std::string::npos ? std::string::npos : amp - pos);
+            size_t eq = pair.find('=');
+            if (pair.substr(0, eq) == name) {
+                return eq == std::string::npos ? "" : pair.substr(eq + 1);
+            }
+            if (amp == std::string::npos) break;
+            pos = amp + 1;
+        }
+        return "";
+    }
+
+    // Single "bytes=a-b", "bytes=a-" or "bytes=-n" range against a resource of the given size
+    bool Range(curl_off_t size, ByteRange& range) const {
+        std::string value = Header("range");
+        if (value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos || size <= 0) {
+            return false;
+        }
+        std::string spec = value.substr(6);
+        size_t dash = spec.find('-');
+        if (dash == std::string::npos) return false;
+        std::string first = spec.substr(0, dash);
+        std::string last = spec.substr(dash + 1);
+        if (first.empty()) {
+            curl_off_t suffix = atoll(last.c_str());
+            if (suffix <= 0) return false;
+            range.start = std::max<curl_off_t>(0, size - suffix);
+            range.end = size - 1;
+        } else {
+            range.start = atoll(first.c_str());
+            range.end = last.empty() ? size - 1 : std::min<curl_off_t>(atoll(last.c_str()), size - 1);
+        }
+        return range.start <= range.end && range.start < size;
+    }
+};
+
+// Response side of one client connection
+class HttpConnection {
+private:
+    int fd;
+    bool keep_alive = true;
+
+public:
+    explicit HttpConnection(int fd) : fd(fd) {}
+
+    int Socket() const { return fd; }
+    bool KeepAlive() const { return keep_alive; }
+    void Close() { keep_alive = false; }
+
+    bool SendAll(const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::send(fd, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                keep_alive = false;
+                return false;
+            }
+            data += n;
+            len -= (size_t)n;
+        }
+        return true;
+    }
+
+    // Status line and headers. content_length < 0 means the body runs until the connection closes.
+    bool SendHead(int status, const std::string& reason, curl_off_t content_length,
+                  const std::vector<std::pair<std::string, std::string>>& headers = {}) {
+        std::string head = "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n";
+        for (const auto& header : headers) {
+            head += header.first + ": " + header.second + "\r\n";
+        }
+        if (content_length >= 0) {
+            head += "Content-Length: " + std::to_string(content_length) + "\r\n";
+        } else {
+            keep_alive = false;
+        }
+        head += keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        return SendAll(head.data(), head.size());
+    }
+
+    bool SendResponse(int status, const std::string& reason, const std::string& body,
+                      const std::string& content_type = "text/plain") {
+        return SendHead(status, reason, (curl_off_t)body.size(), {{"Content-Type", content_type}}) &&
+               SendAll(body.data(), body.size());
+    }
+
+    // Serve a byte range of an open file with pread
+    bool SendFileRange(int file_fd, const ByteRange& range) {
+        std::vector<char> buffer(256 * 1024);
+        curl_off_t offset = range.start;
+        while (offset <= range.end) {
+            size_t want = (size_t)std::min<curl_off_t>((curl_off_t)buffer.size(), range.end - offset + 1);
+            ssize_t got = pread(file_fd, buffer.data(), want, offset);
+            if (got <= 0) {
+                keep_alive = false;
+                return false;
+            }
+            if (!SendAll(buffer.data(), (size_t)got)) {
+                return false;
+            }
+            offset += got;
+        }
+        return true;
+    }
+};
+
+// Minimal threaded HTTP/1.1 server: one thread per connection, keep-alive, request bodies
+// with Content-Length. Enough for peers and local tools to talk to the downloader; not meant
+// to face the internet.
+class MiniHttpServer {
+public:
+    using Handler = std::function<void(const HttpRequest&, HttpConnection&)>;
+
+private:
+    int listen_fd = -1;
+    int port = 0;
+    Handler handler;
+    std::thread acceptor;
+    std::atomic<bool> running{false};
+
+    // Open connections by id. A connection's fd is unregistered before it is closed, so Stop()
+    // never shuts down a descriptor the kernel has already handed to someone else.
+    struct Connection {
+        int fd;
+        std::thread thread;
+        bool finished = false;
+    };
+    std::mutex connections_mutex;
+    std::map<unsigned long long, Connection> connections;
+    unsigned long long next_connection = 0;
+
+    static constexpr size_t kMaxHeaderBytes = 64 * 1024;
+    static constexpr size_t kMaxBodyBytes = 16 * 1024 * 1024;
+
+    // Read one request; false on EOF or a malformed request
+    static bool ReadRequest(int fd, std::string& pending, HttpRequest& request) {
+        size_t header_end;
+        while ((header_end = pending.find("\r\n\r\n")) == std::string::npos) {
+            if (pending.size() > kMaxHeaderBytes) return false;
+            char buffer[8192];
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            pending.append(buffer, (size_t)n);
+        }
+        std::string head = pending.substr(0, header_end);
+        pending.erase(0, header_end + 4);
+
+        size_t line_end = head.find("\r\n");
+        std::string request_line = head.substr(0, line_end);
+        size_t sp1 = request_line.find(' ');
+        size_t sp2 = request_line.rfind(' ');
+        if (sp1 == std::string::npos || sp2 == sp1) return false;
+        request.method = request_line.substr(0, sp1);
+        request.target = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+        request.version = request_line.substr(sp2 + 1);
+
+        size_t pos = line_end == std::string::npos ? head.size() : line_end + 2;
+        while (pos < head.size()) {
+            size_t end = head.find("\r\n", pos);
+            if (end == std::string::npos) end = head.size();
+            std::string line = head.substr(pos, end - pos);
+            size_t colon = line.find(':');
+            if (colon != std::string::npos) {
+                std::string name = line.substr(0, colon);
+                std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+                size_t value_start = line.find_first_not_of(" \t", colon + 1);
+                request.headers[name] = value_start == std::string::npos ? "" : line.substr(value_start);
+            }
+            pos = end + 2;
+        }
+
+        size_t body_length = (size_t)atoll(request.Header("content-length").c_str());
+        if (body_length > kMaxBodyBytes) return false;
+        while (pending.size() < body_length) {
+            char buffer[8192];
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            pending.append(buffer, (size_t)n);
+        }
+        request.body = pending.substr(0, body_length);
+        pending.erase(0, body_length);
+        return true;
+    }
+
+    void Serve(unsigned long long id, int fd, std::string peer_address) {
+        std::string pending;
+        HttpRequest request;
+        while (running && ReadRequest(fd, pending, request)) {
+            request.peer_address = peer_address;
+            HttpConnection connection(fd);
+            std::string connection_header = request.Header("connection");
+            if (strcasecmp(connection_header.c_str(), "close") == 0 ||
+                (request.version == "HTTP/1.0" && strcasecmp(connection_header.c_str(), "keep-alive") != 0)) {
+                connection.Close();
+            }
+            handler(request, connection);
+            if (!connection.KeepAlive()) break;
+            request = HttpRequest();
+        }
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            connections[id].fd = -1;
+        }
+        close(fd);
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connections[id].finished = true;
+    }
+
+    // Join the threads of connections that have ended
+    void ReapConnections() {
+        std::vector<std::thread> finished;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            for (auto it = connections.begin(); it != connections.end();) {
+                if (it->second.finished) {
+                    finished.push_back(std::move(it->second.thread));
+                    it = connections.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        for (auto& thread : finished) {
+            thread.join();
+        }
+    }
+
+    void AcceptLoop() {
+        while (running) {
+            sockaddr_storage address;
+            socklen_t length = sizeof(address);
+            int fd = accept(listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            char host[NI_MAXHOST] = {0};
+            getnameinfo(reinterpret_cast<sockaddr*>(&address), length, host, sizeof(host), nullptr, 0, NI_NUMERICHOST);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            ReapConnections();
+
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            if (!running) {
+                close(fd);
+                break;
+            }
+            unsigned long long id = next_connection++;
+            Connection& connection = connections[id];
+            connection.fd = fd;
+            connection.thread = std::thread(&MiniHttpServer::Serve, this, id, fd, std::string(host));
+        }
+    }
+
+public:
+    MiniHttpServer() = default;
+
+    ~MiniHttpServer() {
+        Stop();
+    }
+
+    // Listen on bind_address:port (port 0 picks a free one) and serve requests with handler
+    bool Start(const std::string& bind_address, int listen_port, Handler request_handler) {
+        handler = std::move(request_handler);
+        listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)listen_port);
+        if (inet_pton(AF_INET, bind_address.c_str(), &address.sin_addr) != 1 ||
+            bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, 128) != 0) {
+            LogError() << "Cannot listen on " << bind_address << ":" << listen_port << ": " << strerror(errno);
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        socklen_t length = sizeof(address);
+        getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length);
+        port = ntohs(address.sin_port);
+        running = true;
+        acceptor = std::thread(&MiniHttpServer::AcceptLoop, this);
+        return true;
+    }
+
+    int Port() const { return port; }
+
+    // Stop accepting, drop open connections and wait for their threads to finish
+    void Stop() {
+        if (!running.exchange(false)) {
+            return;
+        }
+        shutdown(listen_fd, SHUT_RDWR);
+        if (acceptor.joinable()) {
+            acceptor.join();
+        }
+        close(listen_fd);
+        listen_fd = -1;
+
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(connections_mutex);
+            for (auto& item : connections) {
+                if (item.second.fd >= 0) {
+                    shutdown(item.second.fd, SHUT_RDWR);
+                }
+                threads.push_back(std::move(item.second.thread));
+            }
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        connections.clear();
+    }
+};
+
+#endif // MINIHTTPSERVER_H
@@ -10,6 +10,33 @@
 #include <iomanip>
 #include <atomic>
 #include <cstring>
+#include <functional>
+#include <string_view>
+#include "TraceRecorder.h"
+#include "Logger.h"
+#include "DownloadCache.h"
+#include "DeltaDownloader.h"
+#include "RemoteFile.h"
+#include "ProgressiveDownloader.h"
+#include "AddressPool.h"
+#include "LinkPool.h"
+#include "SocketTuning.h"
+#include "Scavenger.h"
+#include "HostProfiles.h"
+#include "StreamWriter.h"
+#include "Transport.h"
+#include "SegmentQueue.h"
+#include "SimulatedTransport.h"
+#include "CooperativeDownloader.h"
+#include "MiniHttpServer.h"
+#include "PeerSharing.h"
+#include "CachingProxy.h"
+#include "PieceManifest.h"
+#include "HttpMirror.h"
+#include "MultiUploader.h"
+#include "DownloadEngine.h"
+#include "Benchmark.h"
+#include <deque>
 
 // Single-threaded downloader for comparison
 class SingleThreadedDownloader {
@@ -20,37 +47,18 @@ private:
     // Progress tracking
     struct ProgressData {
         SingleThreadedDownloader* downloader;
-        std::chrono::high_resolution_clock::time_point start_time;
+        std::shared_ptr<ProgressBoard> board;
     };
     
-    // Callback function to write downloaded data to file
-    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-        size_t total_size = size * nmemb;
-        std::ofstream* file = static_cast<std::ofstream*>(userp);
-        
-        if (file && file->is_open()) {
-            file->write(static_cast<char*>(contents), total_size);
-            return total_size;
-        }
-        return 0;
-    }
+    // Receive buffer per read from the socket; large reads mean fewer callbacks per MB
+    static constexpr long kReceiveBufferSize = 512 * 1024;
     
-    // Progress callback
+    // Progress callback: only publishes counters, rendering happens on the logger thread
     static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, 
                                curl_off_t ultotal, curl_off_t ulnow) {
-        if (dltotal == 0) return 0;
-        
         ProgressData* data = static_cast<ProgressData*>(clientp);
-        auto now = std::chrono::high_resolution_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - data->start_time);
-        
-        double progress = (double)dlnow / dltotal * 100.0;
-        double speed = dlnow / (elapsed.count() + 1); // +1 to avoid division by zero
-        
-        std::cout << "\rProgress: " << std::fixed << std::setprecision(1) 
-                 << progress << "% (" << dlnow << "/" << dltotal << " bytes) "
-                 << "Speed: " << std::fixed << std::setprecision(1) << speed / 1024 << " KB/s" << std::flush;
-        
+        data->board->SetTotal(0, dltotal);
+        data->board->SetDone(0, dlnow);
         return 0;
     }
     
@@ -65,44 +73,64 @@ public:
     }
     
     bool Download() {
-        std::cout << "Starting single-threaded download..." << std::endl;
-        std::cout << "URL: " << url << std::endl;
-        std::cout << "Filename: " << filename << std::endl;
-        
-        std::ofstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
-            std::cerr << "Failed to create file: " << filename << std::endl;
+        TraceSpan session_span("session", "single_threaded_download");
+        LogInfo() << "Starting single-threaded download...";
+        LogInfo() << "URL: " << url;
+        LogInfo() << "Filename: " << filename;
+        
+        // Disk writes happen on a separate thread so the socket is drained at network speed;
+        // the transfer pauses instead of buffering past the memory budget
+        StreamWriter file;
+        if (!file.Open(filename)) {
+            LogError() << "Failed to create file: " << filename;
             return false;
         }
+        BufferedTransfer transfer(&file);
         
         CURL* curl = curl_easy_init();
         if (!curl) {
-            std::cerr << "Failed to initialize curl" << std::endl;
+            LogError() << "Failed to initialize curl";
             return false;
         }
         
         ProgressData progress_data;
         progress_data.downloader = this;
-        progress_data.start_time = std::chrono::high_resolution_clock::now();
+        TcpStats tcp_stats;
         
         // Set curl options
         curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, BufferedTransfer::WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+        curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, kReceiveBufferSize);
         curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
         curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
         curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
         curl_easy_setopt(curl, CURLOPT_TIMEOUT, 300L);  // 5 minute timeout
         curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);  // 30 second connect timeout
+        SocketTuning::Instance().Apply(curl, &tcp_stats);
         
-        // Progress callback
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress_data);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        // Progress callback (not installed at all in quiet mode)
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_data.board = Logger::Instance().BeginProgress("download", 1);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress_data);
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        }
         
         auto start_time = std::chrono::high_resolution_clock::now();
-        CURLcode res = curl_easy_perform(curl);
+        CURLcode res;
+        {
+            TraceSpan span("transfer", "single_transfer");
+            res = transfer.Perform(curl);
+            curl_off_t transferred = 0;
+            curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &transferred);
+            span.SetArg("bytes", transferred);
+            TraceConnectPhases(curl, span.StartMicros(), 0);
+        }
         auto end_time = std::chrono::high_resolution_clock::now();
+        if (progress_data.board) {
+            Logger::Instance().EndProgress(progress_data.board);
+        }
         
         // Get response info
         long response_code;
@@ -112,38 +140,50 @@ public:
         curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &download_size);
         curl_easy_getinfo(curl, CURLINFO_CONTENT_TYPE, &content_type);
         
-        std::cout << "\nResponse code: " << response_code << std::endl;
-        std::cout << "Content-Type: " << (content_type ? content_type : "unknown") << std::endl;
-        std::cout << "Downloaded: " << download_size << " bytes" << std::endl;
+        LogInfo() << "Response code: " << response_code;
+        LogInfo() << "Content-Type: " << (content_type ? content_type : "unknown");
+        LogInfo() << "Downloaded: " << download_size << " bytes";
         
         if (res != CURLE_OK) {
-            std::cerr << "Download failed: " << curl_easy_strerror(res) << std::endl;
+            LogError() << "Download failed: " << curl_easy_strerror(res);
             curl_easy_cleanup(curl);
-            file.close();
+            file.Close();
             return false;
         }
         
         // Check for HTTP errors
         if (response_code >= 400) {
-            std::cerr << "HTTP Error: " << response_code << std::endl;
+            LogError() << "HTTP Error: " << response_code;
             curl_easy_cleanup(curl);
-            file.close();
+            file.Close();
             return false;
         }
         
         // Check if we got HTML instead of binary data
         if (content_type && (strstr(content_type, "text/html") || strstr(content_type, "text/plain"))) {
-            std::cerr << "Warning: Received HTML/text content instead of binary file!" << std::endl;
-            std::cerr << "This might indicate a server error or redirect issue." << std::endl;
+            LogWarning() << "Received HTML/text content instead of binary file!";
+            LogWarning() << "This might indicate a server error or redirect issue.";
         }
         
         curl_easy_cleanup(curl);
-        file.close();
+        {
+            TraceSpan span("disk", "flush");
+            if (!file.Close()) {
+                LogError() << "Failed to write file: " << filename;
+                return false;
+            }
+        }
+        MemoryBudget& budget = MemoryBudget::Instance();
+        if (budget.Pauses() > 0) {
+            LogInfo() << "Receive paused " << budget.Pauses() << " times for "
+                      << budget.ThrottledMicros() / 1000 << " ms waiting for the disk";
+        }
         
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
         
-        std::cout << "Download completed successfully!" << std::endl;
-        std::cout << "Total time: " << duration.count() << " ms" << std::endl;
+        LogInfo() << "Download completed successfully!";
+        LogInfo() << "Total time: " << duration.count() << " ms";
+        tcp_stats.Log();
         
         return true;
     }
@@ -157,8 +197,9 @@ private:
     int num_threads;
     curl_off_t file_size;
     std::vector<std::thread> threads;
-    std::mutex progress_mutex;
-    std::atomic<curl_off_t> total_downloaded{0};
+    std::shared_ptr<ProgressBoard> progress_board;
+    DownloadCache* cache = nullptr;
+    HostProfileStore* profiles = nullptr;
     
     // Structure to hold data for each chunk download
     struct ChunkData {
@@ -168,166 +209,269 @@ private:
         curl_off_t end_byte;
         int chunk_id;
         MultithreadedDownloader* downloader;
+        std::string resolve_entry;   // CURLOPT_RESOLVE pin to one server address, if any
+        int link = -1;               // local link the segment is bound to, -1 = default route
+        curl_socket_t socket = CURL_SOCKET_BAD;   // connection of the transfer in progress
+        curl_off_t reported = 0;     // bytes already passed to the scavenger controller
+        bool ranged = true;          // false: plain GET of the whole resource
     };
     
-    // Callback function to write downloaded data to file
-    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-        size_t total_size = size * nmemb;
-        std::ofstream* file = static_cast<std::ofstream*>(userp);
-        
-        if (file && file->is_open()) {
-            file->write(static_cast<char*>(contents), total_size);
-            return total_size;
+    // Destination of a segment downloaded into memory: its slice of the caller's buffer
+    struct MemorySlice : public SegmentSink {
+        char* data;
+        curl_off_t capacity;
+        curl_off_t used = 0;
+        bool overflow = false;
+        
+        MemorySlice(char* data, curl_off_t capacity) : data(data), capacity(capacity) {}
+        
+        // Copy straight into the slice; anything beyond it aborts the transfer
+        bool TryWrite(const char* contents, size_t len) override {
+            if (used + (curl_off_t)len > capacity) {
+                overflow = true;
+                return false;
+            }
+            memcpy(data + used, contents, len);
+            used += (curl_off_t)len;
+            return true;
         }
-        return 0;
-    }
+        
+        bool Failed() const override { return overflow; }
+    };
     
-    // Progress callback to track download progress
-    static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, 
-                               curl_off_t ultotal, curl_off_t ulnow) {
-        ChunkData* chunk = static_cast<ChunkData*>(clientp);
-        if (chunk && chunk->downloader) {
-            chunk->downloader->UpdateProgress(dlnow);
+    // The file is cut into more segments than threads so that work can be rebalanced
+    // across connections and server addresses as their speeds become known
+    static constexpr int kSegmentsPerThread = 4;
+    static constexpr curl_off_t kMinSegmentSize = 1024 * 1024;
+    static constexpr int kDefaultThreads = 4;
+    
+    curl_off_t min_segment_size = kMinSegmentSize;
+    long http_version = 0;                       // CURLOPT_HTTP_VERSION for segments, 0 = curl default
+    std::atomic<long> negotiated_http_version{0};
+    std::atomic<bool> range_refused{false};      // a segment request was answered with the whole file
+    
+    int num_segments = 0;
+    std::vector<ChunkData> segments;
+    SegmentQueue segment_queue;
+    
+    // Every address the host resolves to; segments are spread across them
+    AddressPool address_pool;
+    bool spread_addresses = true;
+    
+    // Local interfaces / source addresses to spread segments across (empty = default route)
+    LinkPool link_pool;
+    
+    // Kernel TCP state of every segment connection, sampled as each one closes
+    TcpStats tcp_stats;
+    
+    // Set while downloading into memory: segments write into this buffer instead of part files
+    char* memory_target = nullptr;
+    
+    // Low-priority mode: yield to other traffic when queuing delay builds up (0 = off)
+    int scavenger_target_ms = 0;
+    ScavengerController scavenger;
+    
+    // Where segments are fetched from: libcurl, unless a simulation has been plugged in
+    CurlTransport curl_transport;
+    Transport* transport = &curl_transport;
+    
+    // Download a specific chunk of the file; returns true if the whole range arrived
+    bool DownloadChunk(ChunkData& chunk_data) {
+        // Create temporary file for this chunk; a writer thread per segment keeps disk I/O
+        // off the connection, bounded by the global memory budget. In-memory downloads copy
+        // each segment straight into its slice of the destination buffer instead.
+        curl_off_t expected = chunk_data.end_byte - chunk_data.start_byte + 1;
+        MemorySlice slice(memory_target ? memory_target + chunk_data.start_byte : nullptr, expected);
+        std::string temp_filename = chunk_data.filename + ".part" + std::to_string(chunk_data.chunk_id);
+        StreamWriter temp_file;
+        
+        if (!memory_target && !temp_file.Open(temp_filename)) {
+            LogError() << "Failed to create temporary file: " << temp_filename;
+            return false;
         }
-        return 0;
+        SegmentSink& sink = memory_target ? static_cast<SegmentSink&>(slice) : temp_file;
+        
+        UpdateProgress(chunk_data.chunk_id, 0);
+        
+        RangeRequest request;
+        request.url = chunk_data.url;
+        request.start_byte = chunk_data.start_byte;
+        request.end_byte = chunk_data.end_byte;
+        request.ranged = chunk_data.ranged;
+        request.segment_id = chunk_data.chunk_id;
+        request.resolve_entry = chunk_data.resolve_entry;
+        
+        // Progress reporting (skipped entirely in quiet mode unless it paces the transfer)
+        chunk_data.reported = 0;
+        Transport::ProgressFn progress;
+        if (progress_board || scavenger.Enabled()) {
+            progress = [this, &chunk_data](curl_off_t received) {
+                UpdateProgress(chunk_data.chunk_id, received);
+                scavenger.OnData(chunk_data.socket, received - chunk_data.reported);
+                chunk_data.reported = received;
+            };
+        }
+        
+        RangeResult result = transport->Fetch(request, sink, progress);
+        if (result.http_version > 0) {
+            negotiated_http_version = result.http_version;
+        }
+        if (result.status == 200 && chunk_data.ranged) {
+            range_refused = true;
+        }
+        if (!result.ok) {
+            LogError() << "Chunk " << chunk_data.chunk_id << " download failed: " << result.error;
+        } else {
+            LogInfo() << "Chunk " << chunk_data.chunk_id << " downloaded successfully (HTTP " << result.status << ")";
+        }
+        
+        TraceSpan flush_span("disk", "flush", "segment", chunk_data.chunk_id);
+        bool written = memory_target || temp_file.Close();
+        
+        // Only HTTP has a status that tells a range from the whole file; for FTP and SFTP the
+        // byte count alone shows the segment is complete
+        long expected_code = chunk_data.ranged ? 206 : 200;
+        if (result.ok && ((result.status != 0 && result.status != expected_code) || result.received != expected)) {
+            LogError() << "Chunk " << chunk_data.chunk_id << " incomplete: HTTP " << result.status << ", "
+                       << result.received << " of " << expected << " bytes";
+            return false;
+        }
+        return result.ok && written;
     }
     
-    // Get file size from server using updated curl function
-    curl_off_t GetFileSize(const std::string& url) {
-        CURL* curl;
-        CURLcode res;
-        curl_off_t file_size = 0;
-        
-        curl = curl_easy_init();
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);  // HEAD request
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);  // 30 second timeout
+    // Worker thread: take segments off the shared queue until it is empty, retrying failed
+    // segments (on another address where possible)
+    void SegmentWorker(int worker_id) {
+        TraceRecorder::Instance().SetThreadName("worker " + std::to_string(worker_id));
+        curl_socket_t socket = CURL_SOCKET_BAD;   // the transport keeps this worker's connection
+        while (true) {
+            PlannedSegment planned;
+            scavenger.AcquireSlot();
+            if (!segment_queue.Next(planned)) {
+                scavenger.ReleaseSlot();
+                break;
+            }
             
-            res = curl_easy_perform(curl);
-            if (res == CURLE_OK) {
-                long response_code;
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-                curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &file_size);
-                
-                std::cout << "HEAD request - Response code: " << response_code << std::endl;
-                std::cout << "Content-Length: " << file_size << " bytes" << std::endl;
-                
-                // Check if response is successful
-                if (response_code < 200 || response_code >= 300) {
-                    std::cerr << "Server returned error code: " << response_code << std::endl;
-                    file_size = 0;
+            ChunkData& segment = segments[planned.id];
+            int address = address_pool.Size() > 1 ? address_pool.Acquire() : -1;
+            segment.resolve_entry = address >= 0 ? address_pool.ResolveEntry(address) : "";
+            segment.link = link_pool.Acquire();
+            
+            segment.socket = socket;
+            long long started = transport->NowMicros();
+            bool ok = DownloadChunk(segment);
+            socket = segment.socket;
+            double seconds = (transport->NowMicros() - started) / 1e6;
+            long long delivered = ok ? segment.end_byte - segment.start_byte + 1 : 0;
+            address_pool.Release(address, delivered, seconds, ok);
+            link_pool.Release(segment.link, delivered, ok);
+            scavenger.ReleaseSlot();
+            
+            if (!ok) {
+                if (range_refused) {
+                    // Retrying would fetch the whole file again for every segment
+                    segment_queue.Fail();
+                    transport->Cancel();
+                } else if (!segment_queue.Retry(planned.id)) {
+                    transport->Cancel();
                 }
-            } else {
-                std::cerr << "HEAD request failed: " << curl_easy_strerror(res) << std::endl;
             }
-            curl_easy_cleanup(curl);
         }
-        return file_size;
+        transport->WorkerDone();
     }
     
-    // Check if server supports range requests
-    bool SupportsRangeRequests(const std::string& url) {
-        CURL* curl;
-        CURLcode res;
-        bool supports_range = false;
-        
-        curl = curl_easy_init();
-        if (curl) {
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
-            
-            // Set a small range to test
-            curl_easy_setopt(curl, CURLOPT_RANGE, "0-1023");
-            
-            res = curl_easy_perform(curl);
-            if (res == CURLE_OK) {
-                long response_code;
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-                std::cout << "Range request test - Response code: " << response_code << std::endl;
-                supports_range = (response_code == 206); // Partial Content
-            } else {
-                std::cerr << "Range request test failed: " << curl_easy_strerror(res) << std::endl;
-            }
-            curl_easy_cleanup(curl);
+    // Start from what earlier transfers learned about this host
+    HostPlan PrepareFromProfile() {
+        HostPlan plan;
+        if (profiles) {
+            plan = profiles->PlanFor(url);
+        }
+        if (num_threads <= 0) {
+            num_threads = plan.threads > 0 ? plan.threads : kDefaultThreads;
         }
-        return supports_range;
+        if (plan.segment_size > 0) {
+            min_segment_size = plan.segment_size;
+        }
+        http_version = plan.http_version;
+        if (plan.known) {
+            LogInfo() << "Using tuning profile for " << HostProfileStore::HostKey(url) << ": "
+                      << (plan.threads > 0 ? std::to_string(plan.threads) : std::string("?")) << " connections, "
+                      << min_segment_size / 1024 << " KB segments";
+        }
+        return plan;
     }
     
-    // Download a specific chunk of the file
-    void DownloadChunk(ChunkData chunk_data) {
-        CURL* curl;
-        CURLcode res;
-        
-        // Create temporary file for this chunk
-        std::string temp_filename = chunk_data.filename + ".part" + std::to_string(chunk_data.chunk_id);
-        std::ofstream temp_file(temp_filename, std::ios::binary);
-        
-        if (!temp_file.is_open()) {
-            std::cerr << "Failed to create temporary file: " << temp_filename << std::endl;
-            return;
+    // Cut the file into segments and run them on the worker threads until every segment is
+    // done or one has failed for good
+    void RunSegments(bool ranged) {
+        // Calculate segment layout; without ranges the whole file is one segment
+        num_segments = segment_queue.Plan(file_size, ranged ? num_threads : 1, ranged ? min_segment_size : file_size,
+                                          kSegmentsPerThread);
+        
+        LogInfo() << "Chunk size: " << file_size / num_segments << " bytes (" << num_segments << " chunks)";
+        LogInfo() << "Starting download with " << num_threads << " threads...";
+        
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_board = Logger::Instance().BeginProgress("download", num_segments);
         }
         
-        curl = curl_easy_init();
-        if (curl) {
-            // Set URL
-            curl_easy_setopt(curl, CURLOPT_URL, chunk_data.url.c_str());
-            
-            // Set range for this chunk
-            std::string range = std::to_string(chunk_data.start_byte) + "-" + 
-                               std::to_string(chunk_data.end_byte);
-            curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
-            
-            // Set write callback
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &temp_file);
-            
-            // Set progress callback
-            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
-            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &chunk_data);
-            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-            
-            // Other options
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
-            
-            // Perform the download
-            res = curl_easy_perform(curl);
-            
-            if (res != CURLE_OK) {
-                std::cerr << "Chunk " << chunk_data.chunk_id << " download failed: " 
-                         << curl_easy_strerror(res) << std::endl;
-            } else {
-                long response_code;
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
-                std::cout << "Chunk " << chunk_data.chunk_id << " downloaded successfully (HTTP " << response_code << ")" << std::endl;
+        // Describe every queued segment
+        segments.clear();
+        range_refused = false;
+        tcp_stats.Reset();
+        if (scavenger_target_ms != 0) {
+            scavenger.Start(std::min(num_threads, num_segments), scavenger_target_ms);
+        }
+        for (const PlannedSegment& planned : segment_queue.Segments()) {
+            int i = planned.id;
+            ChunkData chunk_data;
+            chunk_data.url = url;
+            chunk_data.filename = filename;
+            chunk_data.start_byte = planned.start_byte;
+            chunk_data.end_byte = planned.end_byte;
+            chunk_data.chunk_id = i;
+            chunk_data.downloader = this;
+            chunk_data.ranged = ranged;
+            if (progress_board) {
+                progress_board->SetTotal(i, chunk_data.end_byte - chunk_data.start_byte + 1);
             }
             
-            curl_easy_cleanup(curl);
+            LogDebug() << "Chunk " << i << ": bytes " << chunk_data.start_byte 
+                     << "-" << chunk_data.end_byte << " (" << (chunk_data.end_byte - chunk_data.start_byte + 1) << " bytes)";
+            
+            segments.push_back(chunk_data);
         }
         
-        temp_file.close();
+        // Start the worker threads
+        threads.clear();
+        transport->BeginWorkers(std::min(num_threads, num_segments));
+        for (int i = 0; i < std::min(num_threads, num_segments); ++i) {
+            threads.emplace_back(&MultithreadedDownloader::SegmentWorker, this, i);
+        }
+        
+        // Wait for all threads to complete
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        
+        if (progress_board) {
+            Logger::Instance().EndProgress(progress_board);
+            progress_board.reset();
+        }
     }
     
     // Merge all downloaded chunks into final file
     void MergeChunks() {
+        TraceSpan span("commit", "merge");
         std::ofstream final_file(filename, std::ios::binary);
         if (!final_file.is_open()) {
-            std::cerr << "Failed to create final file: " << filename << std::endl;
+            LogError() << "Failed to create final file: " << filename;
             return;
         }
         
-        std::cout << "\nMerging chunks..." << std::endl;
+        LogInfo() << "Merging chunks...";
         
-        for (int i = 0; i < num_threads; ++i) {
+        for (int i = 0; i < num_segments; ++i) {
             std::string temp_filename = filename + ".part" + std::to_string(i);
             std::ifstream temp_file(temp_filename, std::ios::binary);
             
@@ -338,117 +482,266 @@ private:
                 
                 // Remove temporary file
                 std::remove(temp_filename.c_str());
-                std::cout << "Merged chunk " << i << std::endl;
+                LogInfo() << "Merged chunk " << i;
             } else {
-                std::cerr << "Failed to open chunk file: " << temp_filename << std::endl;
+                LogError() << "Failed to open chunk file: " << temp_filename;
             }
         }
         
         final_file.close();
-        std::cout << "File merge completed!" << std::endl;
+        LogInfo() << "File merge completed!";
     }
     
 public:
+    // threads <= 0 picks the count learned for the host (see SetProfileStore), or 4
     MultithreadedDownloader(const std::string& url, const std::string& filename, int threads = 4) 
         : url(url), filename(filename), num_threads(threads), file_size(0) {
         curl_global_init(CURL_GLOBAL_DEFAULT);
+        
+        // Per-segment handle options that depend on this download's state
+        curl_transport.SetHandleSetup([this](CURL* curl, const RangeRequest& request) {
+            ChunkData& segment = segments[request.segment_id];
+            link_pool.Apply(curl, segment.link);
+            SocketTuning::Instance().Apply(curl, &tcp_stats);
+            if (scavenger.Enabled()) {
+                ScavengerController::Track(curl, &segment.socket);
+            }
+            if (http_version) {
+                curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, http_version);
+            }
+        });
     }
     
     ~MultithreadedDownloader() {
         curl_global_cleanup();
     }
     
-    // Update progress tracking
-    void UpdateProgress(curl_off_t bytes_downloaded) {
-        std::lock_guard<std::mutex> lock(progress_mutex);
-        // This is a simplified progress update
-        // In a real implementation, you'd track per-chunk progress more accurately
+    // Update progress tracking for one chunk (lock-free, rendered by the logger thread)
+    void UpdateProgress(int chunk_id, curl_off_t bytes_downloaded) {
+        if (progress_board) {
+            progress_board->SetDone(chunk_id, bytes_downloaded);
+        }
+    }
+    
+    // Serve repeated downloads from a local cache (not owned; nullptr disables caching)
+    void SetCache(DownloadCache* download_cache) {
+        cache = download_cache;
+    }
+    
+    // Pin segments to the individual addresses the host resolves to (on by default)
+    void SetAddressSpreading(bool enabled) {
+        spread_addresses = enabled;
+    }
+    
+    // Bind segments across local interfaces or source addresses ("eth0,eth1" or
+    // "10.0.0.2,10.0.1.2@40000-40999"); returns the number of usable links
+    size_t SetSourceLinks(const std::string& list) {
+        return link_pool.Configure(list);
+    }
+    
+    // Run as a background download that backs off when it adds more than target_ms of
+    // queuing delay (0 = the default target)
+    void SetScavenger(int target_ms) {
+        scavenger_target_ms = target_ms > 0 ? target_ms : -1;
+    }
+    
+    // Seed the plan from, and record the outcome into, per-host tuning profiles (not owned)
+    void SetProfileStore(HostProfileStore* store) {
+        profiles = store;
+    }
+    
+    // Fetch segments through another transport, e.g. a SimulatedTransport (not owned;
+    // nullptr goes back to libcurl)
+    void SetTransport(Transport* replacement) {
+        transport = replacement ? replacement : &curl_transport;
+    }
+    
+    // Smallest segment worth a request of its own (default 1 MB)
+    void SetSegmentSize(curl_off_t bytes) {
+        min_segment_size = std::max<curl_off_t>(bytes, 1);
     }
     
     // Main download function
     bool Download() {
-        std::cout << "Starting multithreaded download..." << std::endl;
-        std::cout << "URL: " << url << std::endl;
-        std::cout << "Filename: " << filename << std::endl;
-        std::cout << "Threads: " << num_threads << std::endl;
+        if (cache) {
+            return cache->Fetch(url, filename, [this] { return DownloadFromNetwork(); });
+        }
+        return DownloadFromNetwork();
+    }
+    
+    // Download from the origin, bypassing any cache
+    bool DownloadFromNetwork() {
+        TraceSpan session_span("session", "multithreaded_download");
+        HostPlan plan = PrepareFromProfile();
+        
+        LogInfo() << "Starting multithreaded download...";
+        LogInfo() << "URL: " << url;
+        LogInfo() << "Filename: " << filename;
+        LogInfo() << "Threads: " << num_threads;
         
         // Get file size
-        file_size = GetFileSize(url);
+        file_size = transport->Size(url, num_threads);
         if (file_size <= 0) {
-            std::cerr << "Failed to get file size or file is empty. Trying single-threaded download..." << std::endl;
+            LogWarning() << "Failed to get file size or file is empty. Trying single-threaded download...";
             
             // Fall back to single-threaded download
             SingleThreadedDownloader fallback(url, filename);
             return fallback.Download();
         }
         
-        std::cout << "File size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)" << std::endl;
+        LogInfo() << "File size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)";
         
-        // Check if server supports range requests
-        if (!SupportsRangeRequests(url)) {
-            std::cout << "Server doesn't support range requests. Falling back to single-threaded download..." << std::endl;
+        // Check if server supports range requests (skipped when the profile already knows)
+        bool supports_range = plan.supports_range == 1 || transport->SupportsRanges(url, file_size);
+        if (!supports_range) {
+            LogWarning() << "Server doesn't support range requests. Falling back to single-threaded download...";
             SingleThreadedDownloader fallback(url, filename);
             return fallback.Download();
         }
         
-        std::cout << "Server supports range requests. Proceeding with multithreaded download." << std::endl;
+        LogInfo() << "Server supports range requests. Proceeding with multithreaded download.";
         
-        // Calculate chunk size
-        curl_off_t chunk_size = file_size / num_threads;
-        curl_off_t remainder = file_size % num_threads;
+        // Spread connections over every address the host resolves to
+        if (spread_addresses && address_pool.Size() == 0) {
+            address_pool.Resolve(url);
+        }
         
-        std::cout << "Chunk size: " << chunk_size << " bytes" << std::endl;
-        std::cout << "\nStarting download with " << num_threads << " threads..." << std::endl;
+        // Record start time (on the transport's clock, which is virtual in simulations)
+        long long start_time = transport->NowMicros();
         
-        // Record start time
-        auto start_time = std::chrono::high_resolution_clock::now();
+        RunSegments(true);
         
-        // Create and start threads for each chunk
-        for (int i = 0; i < num_threads; ++i) {
-            ChunkData chunk_data;
-            chunk_data.url = url;
-            chunk_data.filename = filename;
-            chunk_data.start_byte = i * chunk_size;
-            chunk_data.end_byte = (i == num_threads - 1) ? 
-                                  (i + 1) * chunk_size - 1 + remainder : 
-                                  (i + 1) * chunk_size - 1;
-            chunk_data.chunk_id = i;
-            chunk_data.downloader = this;
-            
-            std::cout << "Thread " << i << ": bytes " << chunk_data.start_byte 
-                     << "-" << chunk_data.end_byte << " (" << (chunk_data.end_byte - chunk_data.start_byte + 1) << " bytes)" << std::endl;
-            
-            threads.emplace_back(&MultithreadedDownloader::DownloadChunk, this, chunk_data);
-        }
+        // Record end time
+        long long duration_ms = (transport->NowMicros() - start_time) / 1000;
         
-        // Wait for all threads to complete
-        for (auto& thread : threads) {
-            thread.join();
+        if (segment_queue.Failed()) {
+            for (int i = 0; i < num_segments; ++i) {
+                std::remove((filename + ".part" + std::to_string(i)).c_str());
+            }
+            if (range_refused) {
+                // The profile said ranges work, but the server has stopped honouring them:
+                // forget that, so the next transfer probes again
+                LogWarning() << "Server ignored range requests. Falling back to single-threaded download...";
+                if (profiles) {
+                    profiles->Record(url, 0, 0, negotiated_http_version, 0, 0);
+                }
+                SingleThreadedDownloader fallback(url, filename);
+                return fallback.Download();
+            }
+            LogError() << "Download failed: not all chunks could be downloaded";
+            return false;
         }
         
-        // Record end time
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        
-        std::cout << "\nAll chunks downloaded in " << duration.count() << " ms" << std::endl;
+        LogInfo() << "All chunks downloaded in " << duration_ms << " ms";
+        if (profiles) {
+            profiles->Record(url, num_threads, 1, negotiated_http_version, file_size, duration_ms / 1000.0);
+        }
         
         // Merge chunks
         MergeChunks();
         
-        std::cout << "Download completed successfully!" << std::endl;
-        std::cout << "Total time: " << duration.count() << " ms" << std::endl;
+        LogInfo() << "Download completed successfully!";
+        LogInfo() << "Total time: " << duration_ms << " ms";
         
         return true;
     }
     
+    // Download into memory rather than a file. allocate is called once with the size from the
+    // probe and returns where the bytes go (nullptr refuses); every segment copies straight
+    // into its slice of that buffer, with no part files and no merge. On success view covers
+    // the whole resource. The cache is not consulted.
+    bool DownloadToMemory(const std::function<char*(size_t)>& allocate, std::string_view& view) {
+        TraceSpan session_span("session", "memory_download");
+        HostPlan plan = PrepareFromProfile();
+        LogInfo() << "Starting in-memory download of " << url << " (" << num_threads << " threads)";
+        
+        file_size = transport->Size(url, num_threads);
+        if (file_size <= 0) {
+            LogError() << "Size of " << url << " is unknown; cannot size the buffer";
+            return false;
+        }
+        char* buffer = allocate((size_t)file_size);
+        if (!buffer) {
+            LogError() << "No buffer for " << file_size << " bytes";
+            return false;
+        }
+        
+        bool supports_range = plan.supports_range == 1 || transport->SupportsRanges(url, file_size);
+        if (supports_range && spread_addresses && address_pool.Size() == 0) {
+            address_pool.Resolve(url);
+        }
+        
+        long long start_time = transport->NowMicros();
+        memory_target = buffer;
+        RunSegments(supports_range);
+        if (segment_queue.Failed() && range_refused) {
+            LogWarning() << "Server ignored range requests. Fetching in one piece...";
+            RunSegments(false);
+        }
+        memory_target = nullptr;
+        long long duration_ms = (transport->NowMicros() - start_time) / 1000;
+        
+        if (segment_queue.Failed()) {
+            LogError() << "Download failed: not all chunks could be downloaded";
+            return false;
+        }
+        if (profiles && supports_range && !range_refused) {
+            profiles->Record(url, num_threads, 1, negotiated_http_version, file_size, duration_ms / 1000.0);
+        }
+        view = std::string_view(buffer, (size_t)file_size);
+        LogInfo() << "Downloaded " << file_size << " bytes into memory in " << duration_ms << " ms";
+        return true;
+    }
+    
+    // In-memory download into a caller-owned buffer; fails if the resource does not fit
+    bool DownloadToBuffer(char* buffer, size_t capacity, std::string_view& view) {
+        return DownloadToMemory([&](size_t size) -> char* {
+            if (size > capacity) {
+                LogError() << "Resource needs " << size << " bytes, buffer holds " << capacity;
+                return nullptr;
+            }
+            return buffer;
+        }, view);
+    }
+    
     // Display download statistics
     void DisplayStats() {
-        std::cout << "\n=== Download Statistics ===" << std::endl;
-        std::cout << "File: " << filename << std::endl;
-        std::cout << "Size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)" << std::endl;
-        std::cout << "Threads used: " << num_threads << std::endl;
-        std::cout << "Chunks: " << num_threads << std::endl;
-        std::cout << "Average chunk size: " << (file_size / num_threads) << " bytes" << std::endl;
+        LogInfo() << "\n=== Download Statistics ===";
+        LogInfo() << "File: " << filename;
+        LogInfo() << "Size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)";
+        LogInfo() << "Threads used: " << num_threads;
+        LogInfo() << "Chunks: " << num_segments;
+        LogInfo() << "Average chunk size: " << (num_segments > 0 ? file_size / num_segments : 0) << " bytes";
+        
+        MemoryBudget& budget = MemoryBudget::Instance();
+        LogInfo() << "Buffered memory: peak " << budget.Peak() / 1024 / 1024 << " MB of "
+                  << budget.Limit() / 1024 / 1024 << " MB budget";
+        if (budget.Pauses() > 0) {
+            LogInfo() << "Throttled: " << budget.Pauses() << " pauses, " << budget.ThrottledMicros() / 1000 << " ms";
+        }
+        
+        std::vector<AddressPool::Address> addresses = address_pool.Snapshot();
+        if (addresses.size() > 1) {
+            LogInfo() << "Server addresses:";
+            for (const auto& address : addresses) {
+                LogInfo() << "  " << address.ip << ": " << address.bytes << " bytes, "
+                          << std::fixed << std::setprecision(1) << address.Throughput() / 1024 / 1024 << " MB/s"
+                          << (address.demoted ? " (demoted)" : "");
+            }
+        }
+        
+        tcp_stats.Log();
+        scavenger.Log();
+        
+        std::vector<LinkPool::Link> links = link_pool.Snapshot();
+        if (!links.empty()) {
+            LogInfo() << "Local links:";
+            for (const auto& link : links) {
+                LogInfo() << "  " << link.name << ": " << link.bytes << " bytes, "
+                          << std::fixed << std::setprecision(1) << link.Throughput() / 1024 / 1024 << " MB/s"
+                          << (link.disabled ? " (disabled)" : "");
+            }
+        }
     }
 };
 
@@ -7,7 +7,21 @@
 #include <mutex>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <functional>
+#include <string_view>
 #include <curl/curl.h>
+#include "Logger.h"
+#include "DownloadCache.h"
+#include "AddressPool.h"
+#include "LinkPool.h"
+#include "SocketTuning.h"
+#include "Scavenger.h"
+#include "HostProfiles.h"
+#include "StreamWriter.h"
+#include "Transport.h"
+#include "SegmentQueue.h"
+#include <deque>
 
 // Single-threaded downloader for comparison
 class SingleThreadedDownloader {
@@ -18,11 +32,11 @@ private:
     // Progress tracking
     struct ProgressData {
         SingleThreadedDownloader* downloader;
-        std::chrono::high_resolution_clock::time_point start_time;
+        std::shared_ptr<ProgressBoard> board;
     };
     
-    // Callback function to write downloaded data to file
-    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
+    // Receive buffer per read from the socket; large reads mean fewer callbacks per MB
+    static constexpr long kReceiveBufferSize = 512 * 1024;
     
     // Progress callback
     static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, 
@@ -43,8 +57,9 @@ private:
     int num_threads;
     curl_off_t file_size;
     std::vector<std::thread> threads;
-    std::mutex progress_mutex;
-    std::atomic<curl_off_t> total_downloaded{0};
+    std::shared_ptr<ProgressBoard> progress_board;
+    DownloadCache* cache = nullptr;
+    HostProfileStore* profiles = nullptr;
     
     // Structure to hold data for each chunk download
     struct ChunkData {
@@ -54,37 +69,120 @@ private:
         curl_off_t end_byte;
         int chunk_id;
         MultithreadedDownloader* downloader;
+        std::string resolve_entry;   // CURLOPT_RESOLVE pin to one server address, if any
+        int link = -1;               // local link the segment is bound to, -1 = default route
+        curl_socket_t socket = CURL_SOCKET_BAD;   // connection of the transfer in progress
+        curl_off_t reported = 0;     // bytes already passed to the scavenger controller
+        bool ranged = true;          // false: plain GET of the whole resource
     };
     
-    // Callback function to write downloaded data to file
-    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
+    // Destination of a segment downloaded into memory: its slice of the caller's buffer
+    struct MemorySlice : public SegmentSink {
+        char* data;
+        curl_off_t capacity;
+        curl_off_t used = 0;
+        bool overflow = false;
+        
+        MemorySlice(char* data, curl_off_t capacity);
+        
+        // Copy straight into the slice; anything beyond it aborts the transfer
+        bool TryWrite(const char* contents, size_t len) override;
+        bool Failed() const override;
+    };
     
-    // Progress callback to track download progress
-    static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow, 
-                               curl_off_t ultotal, curl_off_t ulnow);
+    // The file is cut into more segments than threads so that work can be rebalanced
+    // across connections and server addresses as their speeds become known
+    static constexpr int kSegmentsPerThread = 4;
+    static constexpr curl_off_t kMinSegmentSize = 1024 * 1024;
+    static constexpr int kDefaultThreads = 4;
+    
+    curl_off_t min_segment_size = kMinSegmentSize;
+    long http_version = 0;                       // CURLOPT_HTTP_VERSION for segments, 0 = curl default
+    std::atomic<long> negotiated_http_version{0};
+    std::atomic<bool> range_refused{false};      // a segment request was answered with the whole file
+    
+    int num_segments = 0;
+    std::vector<ChunkData> segments;
+    SegmentQueue segment_queue;
+    
+    // Every address the host resolves to; segments are spread across them
+    AddressPool address_pool;
+    bool spread_addresses = true;
+    
+    // Local interfaces / source addresses to spread segments across (empty = default route)
+    LinkPool link_pool;
+    
+    // Kernel TCP state of every segment connection, sampled as each one closes
+    TcpStats tcp_stats;
+    
+    // Set while downloading into memory: segments write into this buffer instead of part files
+    char* memory_target = nullptr;
+    
+    // Low-priority mode: yield to other traffic when queuing delay builds up (0 = off)
+    int scavenger_target_ms = 0;
+    ScavengerController scavenger;
+    
+    // Where segments are fetched from: libcurl, unless a simulation has been plugged in
+    CurlTransport curl_transport;
+    Transport* transport = &curl_transport;
     
-    // Get file size from server using updated curl function
-    curl_off_t GetFileSize(const std::string& url);
+    // Download a specific chunk of the file; returns true if the whole range arrived
+    bool DownloadChunk(ChunkData& chunk_data);
     
-    // Check if server supports range requests
-    bool SupportsRangeRequests(const std::string& url);
+    // Worker thread: take segments off the shared queue until it is empty
+    void SegmentWorker(int worker_id);
     
-    // Download a specific chunk of the file
-    void DownloadChunk(ChunkData chunk_data);
+    // Start from what earlier transfers learned about this host
+    HostPlan PrepareFromProfile();
+    
+    // Cut the file into segments and run them on the worker threads
+    void RunSegments(bool ranged);
     
     // Merge all downloaded chunks into final file
     void MergeChunks();
     
 public:
+    // threads <= 0 picks the count learned for the host (see SetProfileStore), or 4
     MultithreadedDownloader(const std::string& url, const std::string& filename, int threads = 4);
     ~MultithreadedDownloader();
     
-    // Update progress tracking
-    void UpdateProgress(curl_off_t bytes_downloaded);
+    // Update progress tracking for one chunk
+    void UpdateProgress(int chunk_id, curl_off_t bytes_downloaded);
+    
+    // Serve repeated downloads from a local cache (not owned; nullptr disables caching)
+    void SetCache(DownloadCache* download_cache);
+    
+    // Pin segments to the individual addresses the host resolves to (on by default)
+    void SetAddressSpreading(bool enabled);
+    
+    // Bind segments across local interfaces or source addresses; returns the usable count
+    size_t SetSourceLinks(const std::string& list);
+    
+    // Run as a background download that backs off past target_ms of queuing delay
+    void SetScavenger(int target_ms);
+    
+    // Seed the plan from, and record the outcome into, per-host tuning profiles (not owned)
+    void SetProfileStore(HostProfileStore* store);
+    
+    // Fetch segments through another transport, e.g. a SimulatedTransport (not owned;
+    // nullptr goes back to libcurl)
+    void SetTransport(Transport* replacement);
+    
+    // Smallest segment worth a request of its own (default 1 MB)
+    void SetSegmentSize(curl_off_t bytes);
     
     // Main download function
     bool Download();
     
+    // Download from the origin, bypassing any cache
+    bool DownloadFromNetwork();
+    
+    // Download into a buffer obtained from allocate(size from the probe); no part files
+    bool DownloadToMemory(const std::function<char*(size_t)>& allocate, std::string_view& view);
+    
+    // In-memory download into a caller-owned buffer; fails if the resource does not fit
+    bool DownloadToBuffer(char* buffer, size_t capacity, std::string_view& view);
+    
     // Display download statistics
     void DisplayStats();
 };
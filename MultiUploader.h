@@ -0,0 +1,463 @@
+#ifndef MULTIUPLOADER_H
+#define MULTIUPLOADER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+#include "AddressPool.h"
+#include "SegmentQueue.h"
+#include "SocketTuning.h"
+
+// Upload counterpart of MultithreadedDownloader: the local file is cut into parts that are
+// sent concurrently by a pool of workers, each part read straight from the file with pread
+// and retried on its own. Parts are laid out and queued by the downloader's SegmentQueue. Two server protocols are supported:
+//   ContentRange  PUT <url> once per part with "Content-Range: bytes a-b/total"; the server
+//                 assembles the file (WebDAV stores, upload endpoints accepting partial PUT)
+//   S3Multipart   S3 multipart upload (also MinIO, Ceph RGW): initiate, PUT every part with
+//                 its partNumber, then complete with the list of part ETags; aborted on failure
+// Requests can be signed with AWS SigV4 (SetCredentials).
+class MultithreadedUploader {
+public:
+    enum class Mode { ContentRange, S3Multipart };
+
+private:
+    std::string url;
+    std::string filename;
+    int num_threads;
+    Mode mode;
+    std::string credentials;          // "access_key:secret_key", empty = unsigned requests
+    std::string region = "us-east-1";
+
+    int file_fd = -1;
+    curl_off_t file_size = 0;
+    std::string upload_id;
+
+    struct Part {
+        int number;                   // 1-based, as S3 numbers them
+        curl_off_t start_byte;
+        curl_off_t end_byte;
+        std::string etag;
+        MultithreadedUploader* uploader;
+        std::string resolve_entry;
+    };
+
+    // Body of one part, read from the file on demand; curl may rewind it (redirects, auth)
+    struct PartReader {
+        int fd;
+        curl_off_t start;
+        curl_off_t length;
+        curl_off_t position = 0;
+
+        static size_t ReadCallback(char* buffer, size_t size, size_t nitems, void* userp) {
+            PartReader* reader = static_cast<PartReader*>(userp);
+            size_t want = (size_t)std::min<curl_off_t>((curl_off_t)(size * nitems), reader->length - reader->position);
+            if (want == 0) return 0;
+            ssize_t n;
+            do {
+                n = pread(reader->fd, buffer, want, reader->start + reader->position);
+            } while (n < 0 && errno == EINTR);
+            if (n <= 0) return CURL_READFUNC_ABORT;
+            reader->position += n;
+            return (size_t)n;
+        }
+
+        static int SeekCallback(void* userp, curl_off_t offset, int origin) {
+            PartReader* reader = static_cast<PartReader*>(userp);
+            if (origin != SEEK_SET || offset < 0 || offset > reader->length) return CURL_SEEKFUNC_FAIL;
+            reader->position = offset;
+            return CURL_SEEKFUNC_OK;
+        }
+    };
+
+    // S3 rejects parts under 5 MB (except the last), over 5 GB, and more than 10000 parts
+    static constexpr int kPartsPerThread = 4;
+    static constexpr curl_off_t kMinPartSize = 5LL * 1024 * 1024;
+    static constexpr curl_off_t kMaxPartSize = 5LL * 1024 * 1024 * 1024;
+    static constexpr int kMaxParts = 10000;
+
+    std::vector<Part> parts;
+    SegmentQueue part_queue;
+    std::vector<std::thread> threads;
+    std::shared_ptr<ProgressBoard> progress_board;
+
+    AddressPool address_pool;
+    bool spread_addresses = true;
+    TcpStats tcp_stats;
+    long long elapsed_ms = 0;
+
+    static size_t CollectCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+        static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+        return size * nmemb;
+    }
+
+    // Pick the ETag out of a part response's headers
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp) {
+        size_t total = size * nitems;
+        std::string line(buffer, total);
+        if (line.size() > 5 && strncasecmp(line.c_str(), "etag:", 5) == 0) {
+            std::string value = line.substr(5);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t\r\n") + 1);
+            *static_cast<std::string*>(userp) = value;
+        }
+        return total;
+    }
+
+    static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
+                                curl_off_t ultotal, curl_off_t ulnow) {
+        Part* part = static_cast<Part*>(clientp);
+        if (part->uploader->progress_board) {
+            part->uploader->progress_board->SetDone(part->number - 1, ulnow);
+        }
+        return 0;
+    }
+
+    static std::string XmlValue(const std::string& xml, const std::string& tag) {
+        size_t open = xml.find("<" + tag + ">");
+        if (open == std::string::npos) return "";
+        open += tag.size() + 2;
+        size_t close = xml.find("</" + tag + ">", open);
+        return close == std::string::npos ? "" : xml.substr(open, close - open);
+    }
+
+    // <url>?<query>, or <url>&<query> if the URL already has a query string
+    std::string WithQuery(const std::string& query) const {
+        return url + (url.find('?') == std::string::npos ? "?" : "&") + query;
+    }
+
+    std::string UploadIdQuery() const {
+        char* escaped = curl_easy_escape(nullptr, upload_id.c_str(), (int)upload_id.size());
+        std::string query = "uploadId=" + std::string(escaped ? escaped : "");
+        curl_free(escaped);
+        return query;
+    }
+
+    // A handle with the options every request of an upload shares
+    CURL* NewHandle(const std::string& target) {
+        CURL* curl = curl_easy_init();
+        if (!curl) return nullptr;
+        curl_easy_setopt(curl, CURLOPT_URL, target.c_str());
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 30L);
+        if (!credentials.empty()) {
+            std::string provider = "aws:amz:" + region + ":s3";
+            curl_easy_setopt(curl, CURLOPT_USERPWD, credentials.c_str());
+            curl_easy_setopt(curl, CURLOPT_AWS_SIGV4, provider.c_str());
+        }
+        return curl;
+    }
+
+    // Small request with an in-memory body (S3 control requests); returns the HTTP status
+    long Request(const std::string& target, const char* method, const std::string& body, std::string& response) {
+        CURL* curl = NewHandle(target);
+        if (!curl) return 0;
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)body.size());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CollectCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+        struct curl_slist* headers = curl_slist_append(nullptr, "Content-Type: application/xml");
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+        long response_code = 0;
+        CURLcode res = curl_easy_perform(curl);
+        if (res == CURLE_OK) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        } else {
+            LogError() << method << " " << target << " failed: " << curl_easy_strerror(res);
+        }
+        curl_slist_free_all(headers);
+        curl_easy_cleanup(curl);
+        return response_code;
+    }
+
+    bool InitiateMultipart() {
+        TraceSpan span("probe", "initiate_multipart");
+        std::string response;
+        long code = Request(WithQuery("uploads="), "POST", "", response);
+        upload_id = XmlValue(response, "UploadId");
+        if (code != 200 || upload_id.empty()) {
+            LogError() << "Could not start multipart upload (HTTP " << code << ")";
+            return false;
+        }
+        LogInfo() << "Multipart upload " << upload_id << " started";
+        return true;
+    }
+
+    bool CompleteMultipart() {
+        TraceSpan span("commit", "complete_multipart");
+        std::string body = "<CompleteMultipartUpload>";
+        for (const Part& part : parts) {
+            body += "<Part><PartNumber>" + std::to_string(part.number) + "</PartNumber><ETag>" + part.etag +
+                    "</ETag></Part>";
+        }
+        body += "</CompleteMultipartUpload>";
+        // S3 may answer 200 and still report an error in the body
+        std::string response;
+        long code = Request(WithQuery(UploadIdQuery()), "POST", body, response);
+        if (code != 200 || response.find("<Error>") != std::string::npos) {
+            LogError() << "Completing multipart upload failed (HTTP " << code << "): " << XmlValue(response, "Message");
+            return false;
+        }
+        return true;
+    }
+
+    // Drop the parts already stored so a failed upload leaves nothing billed behind
+    void AbortMultipart() {
+        std::string response;
+        long code = Request(WithQuery(UploadIdQuery()), "DELETE", "", response);
+        LogWarning() << "Multipart upload " << upload_id << " aborted (HTTP " << code << ")";
+    }
+
+    // Upload one part; returns 0 on success, otherwise the HTTP status (or -1 for a transport error)
+    long UploadPart(Part& part) {
+        curl_off_t length = part.end_byte - part.start_byte + 1;
+        PartReader reader{file_fd, part.start_byte, length};
+        std::string target = mode == Mode::S3Multipart
+            ? WithQuery("partNumber=" + std::to_string(part.number) + "&" + UploadIdQuery())
+            : url;
+
+        CURL* curl = NewHandle(target);
+        if (!curl) return -1;
+        struct curl_slist* resolve = nullptr;
+        if (!part.resolve_entry.empty()) {
+            resolve = curl_slist_append(resolve, part.resolve_entry.c_str());
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+        }
+        SocketTuning::Instance().Apply(curl, &tcp_stats);
+
+        // "Expect: 100-continue" would cost every part an extra round trip
+        struct curl_slist* headers = curl_slist_append(nullptr, "Expect:");
+        if (mode == Mode::ContentRange) {
+            std::string content_range = "Content-Range: bytes " + std::to_string(part.start_byte) + "-" +
+                                        std::to_string(part.end_byte) + "/" + std::to_string(file_size);
+            headers = curl_slist_append(headers, content_range.c_str());
+        }
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+        curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+        curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, length);
+        curl_easy_setopt(curl, CURLOPT_READFUNCTION, PartReader::ReadCallback);
+        curl_easy_setopt(curl, CURLOPT_READDATA, &reader);
+        curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, PartReader::SeekCallback);
+        curl_easy_setopt(curl, CURLOPT_SEEKDATA, &reader);
+        std::string response;
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CollectCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+        std::string etag;
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &etag);
+        if (progress_board) {
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &part);
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        }
+
+        CURLcode res;
+        {
+            TraceSpan span("transfer", "upload_part", "part", part.number);
+            res = curl_easy_perform(curl);
+        }
+        long response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_slist_free_all(headers);
+        curl_slist_free_all(resolve);
+        curl_easy_cleanup(curl);
+
+        if (res != CURLE_OK) {
+            LogError() << "Part " << part.number << " upload failed: " << curl_easy_strerror(res);
+            return -1;
+        }
+        if (response_code < 200 || response_code >= 300) {
+            LogError() << "Part " << part.number << " rejected: HTTP " << response_code;
+            return response_code;
+        }
+        if (mode == Mode::S3Multipart && etag.empty()) {
+            LogError() << "Part " << part.number << " stored without an ETag";
+            return -1;
+        }
+        part.etag = etag;
+        LogInfo() << "Part " << part.number << " uploaded (HTTP " << response_code << ")";
+        return 0;
+    }
+
+    // Worker thread: send parts off the shared queue until it is empty, retrying failed parts
+    // (on another address where possible)
+    void PartWorker(int worker_id) {
+        TraceRecorder::Instance().SetThreadName("uploader " + std::to_string(worker_id));
+        PlannedSegment planned;
+        while (part_queue.Next(planned)) {
+            Part& part = parts[planned.id];
+            int address = address_pool.Size() > 1 ? address_pool.Acquire() : -1;
+            part.resolve_entry = address >= 0 ? address_pool.ResolveEntry(address) : "";
+
+            auto started = std::chrono::steady_clock::now();
+            long status = UploadPart(part);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+            address_pool.Release(address, status == 0 ? part.end_byte - part.start_byte + 1 : 0, seconds, status == 0);
+            if (status == 0) continue;
+
+            // Client errors other than timeouts and throttling will not go away on a retry
+            bool permanent = status >= 400 && status < 500 && status != 408 && status != 429;
+            if (permanent) {
+                LogError() << "Part " << part.number << " failed for good";
+                part_queue.Fail();
+            } else {
+                part_queue.Retry(planned.id);
+            }
+        }
+    }
+
+    // Cut the file into parts and run them on the worker threads
+    void RunParts() {
+        // Only the last part may be under the minimum, so no more threads than minimum-size parts
+        int connections = (int)std::min<curl_off_t>(num_threads, std::max<curl_off_t>(1, file_size / kMinPartSize));
+        int num_parts = part_queue.Plan(file_size, connections, kMinPartSize, kPartsPerThread);
+        // Parts over the maximum size, or too many parts, need another layout of exactly that many
+        curl_off_t needed = std::max<curl_off_t>(num_parts, (file_size + kMaxPartSize - 1) / kMaxPartSize);
+        int clamped = (int)std::min<curl_off_t>(needed, kMaxParts);
+        if (clamped != num_parts) {
+            num_parts = part_queue.Plan(file_size, clamped, kMinPartSize, 1);
+        }
+        LogInfo() << "Part size: " << part_queue.Segments()[0].Length() << " bytes (" << num_parts << " parts)";
+
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_board = Logger::Instance().BeginProgress("upload", num_parts);
+        }
+        parts.clear();
+        tcp_stats.Reset();
+        for (const PlannedSegment& segment : part_queue.Segments()) {
+            Part part;
+            part.number = segment.id + 1;
+            part.start_byte = segment.start_byte;
+            part.end_byte = segment.end_byte;
+            part.uploader = this;
+            if (progress_board) {
+                progress_board->SetTotal(segment.id, segment.Length());
+            }
+            parts.push_back(part);
+        }
+
+        threads.clear();
+        for (int i = 0; i < std::min(num_threads, num_parts); ++i) {
+            threads.emplace_back(&MultithreadedUploader::PartWorker, this, i);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (progress_board) {
+            Logger::Instance().EndProgress(progress_board);
+            progress_board.reset();
+        }
+    }
+
+public:
+    MultithreadedUploader(const std::string& filename, const std::string& url, int threads = 4,
+                          Mode mode = Mode::ContentRange)
+        : url(url), filename(filename), num_threads(std::max(threads, 1)), mode(mode) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~MultithreadedUploader() {
+        if (file_fd >= 0) close(file_fd);
+        curl_global_cleanup();
+    }
+
+    // Sign every request with AWS SigV4 ("access_key:secret_key"); needed by S3 and MinIO
+    void SetCredentials(const std::string& key_and_secret, const std::string& signing_region = "us-east-1") {
+        credentials = key_and_secret;
+        region = signing_region;
+    }
+
+    // Pin parts to the individual addresses the host resolves to (on by default)
+    void SetAddressSpreading(bool enabled) {
+        spread_addresses = enabled;
+    }
+
+    bool Upload() {
+        TraceSpan session_span("session", "multithreaded_upload");
+        LogInfo() << "Starting multithreaded upload of " << filename << " to " << url << " ("
+                  << num_threads << " threads, " << (mode == Mode::S3Multipart ? "S3 multipart" : "Content-Range PUT") << ")";
+
+        file_fd = open(filename.c_str(), O_RDONLY);
+        struct stat st;
+        if (file_fd < 0 || fstat(file_fd, &st) != 0) {
+            LogError() << "Cannot open " << filename << ": " << strerror(errno);
+            return false;
+        }
+        file_size = st.st_size;
+        if (file_size <= 0) {
+            LogError() << filename << " is empty";
+            return false;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(file_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        if (mode == Mode::S3Multipart && !InitiateMultipart()) {
+            return false;
+        }
+        if (spread_addresses && address_pool.Size() == 0) {
+            address_pool.Resolve(url);
+        }
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        RunParts();
+        bool ok = !part_queue.Failed();
+        if (mode == Mode::S3Multipart) {
+            ok = ok && CompleteMultipart();
+            if (!ok) AbortMultipart();
+        }
+        elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start_time).count();
+
+        close(file_fd);
+        file_fd = -1;
+        if (!ok) {
+            LogError() << "Upload failed: not all parts could be uploaded";
+            return false;
+        }
+        LogInfo() << "Upload completed successfully in " << elapsed_ms << " ms";
+        return true;
+    }
+
+    void DisplayStats() {
+        LogInfo() << "\n=== Upload Statistics ===";
+        LogInfo() << "File: " << filename;
+        LogInfo() << "Size: " << file_size << " bytes (" << file_size / 1024 / 1024 << " MB)";
+        LogInfo() << "Threads used: " << num_threads;
+        LogInfo() << "Parts: " << parts.size();
+        if (elapsed_ms > 0) {
+            LogInfo() << "Throughput: " << std::fixed << std::setprecision(1)
+                      << file_size / 1024.0 / 1024.0 / (elapsed_ms / 1000.0) << " MB/s";
+        }
+
+        std::vector<AddressPool::Address> addresses = address_pool.Snapshot();
+        if (addresses.size() > 1) {
+            LogInfo() << "Server addresses:";
+            for (const auto& address : addresses) {
+                LogInfo() << "  " << address.ip << ": " << address.bytes << " bytes, "
+                          << std::fixed << std::setprecision(1) << address.Throughput() / 1024 / 1024 << " MB/s"
+                          << (address.demoted ? " (demoted)" : "");
+            }
+        }
+        tcp_stats.Log();
+    }
+};
+
+#endif // MULTIUPLOADER_H
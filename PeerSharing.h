@@ -0,0 +1,536 @@
+#ifndef PEERSHARING_H
+#define PEERSHARING_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "DeltaDownloader.h"
+#include "MiniHttpServer.h"
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// LAN peer-to-peer sharing of one file. A swarm is identified by the file's SHA-256 from its
+// published block manifest (<url>.mtdelta, see DeltaManifest); the manifest's blocks are the
+// segments peers exchange, and their checksums let a downloader accept a segment from any peer.
+//
+// Peers find each other through a tracker, a tiny HTTP service any machine on the LAN can run:
+//
+//   GET /announce?swarm=<id>&port=<peer port>&have=<hex bitfield>[&event=stopped]
+//   -> one line per other live peer: "<address>:<port> <hex bitfield>"
+//
+// Bit i of the bitfield (most significant bit of hex digit i / 4 first) says the peer holds
+// segment i. Peers serve the segments they hold as range requests on GET /<swarm id>.
+
+// Bitfield helpers shared by tracker and peers
+struct SegmentBitfield {
+    static std::string Encode(const std::vector<char>& have) {
+        static const char* digits = "0123456789abcdef";
+        std::string hex((have.size() + 3) / 4, '0');
+        for (size_t i = 0; i < have.size(); ++i) {
+            if (have[i]) {
+                int value = (int)(strchr(digits, hex[i / 4]) - digits) | (8 >> (i % 4));
+                hex[i / 4] = digits[value];
+            }
+        }
+        return hex;
+    }
+
+    static std::vector<char> Decode(const std::string& hex, size_t count) {
+        std::vector<char> have(count, 0);
+        for (size_t i = 0; i < count && i / 4 < hex.size(); ++i) {
+            int value = isdigit((unsigned char)hex[i / 4]) ? hex[i / 4] - '0' : tolower((unsigned char)hex[i / 4]) - 'a' + 10;
+            have[i] = (value & (8 >> (i % 4))) ? 1 : 0;
+        }
+        return have;
+    }
+};
+
+// In-memory tracker; peers that stop announcing are forgotten
+class PeerTracker {
+private:
+    struct PeerEntry {
+        std::string have;
+        long long last_seen = 0;
+    };
+
+    MiniHttpServer server;
+    std::mutex mutex;
+    std::map<std::string, std::map<std::string, PeerEntry>> swarms;    // swarm -> "address:port" -> entry
+
+    static constexpr long long kPeerTimeoutSeconds = 30;
+
+    void Handle(const HttpRequest& request, HttpConnection& connection) {
+        std::string swarm = request.Query("swarm");
+        int port = atoi(request.Query("port").c_str());
+        if (request.Path() != "/announce" || swarm.empty() || port <= 0) {
+            connection.SendResponse(404, "Not Found", "unknown request\n");
+            return;
+        }
+        std::string self = request.peer_address + ":" + std::to_string(port);
+        long long now = time(nullptr);
+        std::ostringstream reply;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto& peers = swarms[swarm];
+            if (request.Query("event") == "stopped") {
+                peers.erase(self);
+            } else {
+                PeerEntry& entry = peers[self];
+                entry.have = request.Query("have");
+                entry.last_seen = now;
+            }
+            for (auto it = peers.begin(); it != peers.end();) {
+                if (now - it->second.last_seen > kPeerTimeoutSeconds) {
+                    it = peers.erase(it);
+                    continue;
+                }
+                if (it->first != self) {
+                    reply << it->first << " " << it->second.have << "\n";
+                }
+                ++it;
+            }
+            if (peers.empty()) {
+                swarms.erase(swarm);
+            }
+        }
+        connection.SendResponse(200, "OK", reply.str());
+    }
+
+public:
+    bool Start(int port) {
+        if (!server.Start("0.0.0.0", port, [this](const HttpRequest& request, HttpConnection& connection) {
+                Handle(request, connection);
+            })) {
+            return false;
+        }
+        LogInfo() << "Tracker listening on port " << server.Port();
+        return true;
+    }
+
+    int Port() const { return server.Port(); }
+
+    void Stop() { server.Stop(); }
+};
+
+// Downloads a file from LAN peers where possible and from the origin otherwise, while serving
+// the segments it already holds to other peers. After completion it keeps seeding for a while.
+class PeerDownloader {
+private:
+    std::string url;
+    std::string filename;
+    std::string tracker_url;
+    int num_threads;
+    int seed_seconds;
+    int listen_port;
+
+    struct Peer {
+        std::string address;                 // host:port
+        std::vector<char> have;
+        int failures = 0;
+    };
+
+    enum SegmentState : char { kMissing = 0, kFetching = 1, kHave = 2 };
+
+    static constexpr int kAnnounceSeconds = 2;
+    static constexpr int kMaxPeerFailures = 3;           // stop asking a peer that keeps failing
+    static constexpr int kPeersPerSegment = 3;
+    static constexpr int kMaxOriginAttempts = 3;
+    static constexpr curl_off_t kMaxRunBytes = 4 * 1024 * 1024;   // most bytes asked for in one request
+
+    DeltaManifest manifest;
+    std::string swarm_id;
+    int out_fd = -1;
+    MiniHttpServer server;
+
+    std::mutex state_mutex;
+    std::condition_variable state_changed;
+    std::vector<char> state;
+    std::vector<int> origin_attempts;
+    std::vector<Peer> peers;
+    size_t segments_held = 0;
+    bool failed = false;
+    bool stopping = false;
+
+    std::atomic<long long> bytes_from_peers{0};
+    std::atomic<long long> bytes_from_origin{0};
+    std::atomic<long long> bytes_served{0};
+    std::atomic<int> corrupt_segments{0};
+    std::shared_ptr<ProgressBoard> progress_board;
+
+    ByteRange SegmentRange(size_t index) const {
+        curl_off_t start = (curl_off_t)index * manifest.block_size;
+        return ByteRange{start, start + (curl_off_t)manifest.BlockLength(index) - 1};
+    }
+
+    // Serve GET /<swarm> ranges that lie entirely within segments we hold
+    void HandlePeerRequest(const HttpRequest& request, HttpConnection& connection) {
+        ByteRange range;
+        if (request.method != "GET" || request.Path() != "/" + swarm_id || !request.Range(manifest.length, range)) {
+            connection.SendResponse(404, "Not Found", "not here\n");
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            for (size_t i = (size_t)(range.start / manifest.block_size); i <= (size_t)(range.end / manifest.block_size); ++i) {
+                if (state[i] != kHave) {
+                    connection.SendResponse(416, "Range Not Satisfiable", "segment not held\n");
+                    return;
+                }
+            }
+        }
+        TraceSpan span("peer", "serve", "bytes", (long long)range.Length());
+        std::string content_range = "bytes " + std::to_string(range.start) + "-" + std::to_string(range.end) + "/" +
+                                    std::to_string(manifest.length);
+        if (connection.SendHead(206, "Partial Content", range.Length(), {{"Content-Range", content_range}}) &&
+            connection.SendFileRange(out_fd, range)) {
+            bytes_served += range.Length();
+        }
+    }
+
+    // Report what we hold and refresh the peer list
+    void Announce(bool stopped = false) {
+        std::string have;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            std::vector<char> held(state.size());
+            for (size_t i = 0; i < state.size(); ++i) held[i] = state[i] == kHave;
+            have = SegmentBitfield::Encode(held);
+        }
+        std::string announce_url = tracker_url + "/announce?swarm=" + swarm_id + "&port=" + std::to_string(server.Port()) +
+                                   "&have=" + have + (stopped ? "&event=stopped" : "");
+        CURL* curl = curl_easy_init();
+        if (!curl) {
+            return;
+        }
+        std::string body;
+        curl_easy_setopt(curl, CURLOPT_URL, announce_url.c_str());
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](void* contents, size_t size, size_t nmemb, void* userp) {
+            static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+            return size * nmemb;
+        });
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+        CURLcode res = curl_easy_perform(curl);
+        long response_code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+        curl_easy_cleanup(curl);
+        if (res != CURLE_OK || response_code != 200) {
+            LogDebug() << "Tracker announce failed: "
+                       << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            return;
+        }
+        if (stopped) {
+            return;
+        }
+
+        std::istringstream lines(body);
+        std::string address, bitfield;
+        std::lock_guard<std::mutex> lock(state_mutex);
+        std::vector<Peer> updated;
+        while (lines >> address >> bitfield) {
+            Peer peer;
+            peer.address = address;
+            peer.have = SegmentBitfield::Decode(bitfield, state.size());
+            for (const Peer& known : peers) {
+                if (known.address == address) peer.failures = known.failures;
+            }
+            updated.push_back(std::move(peer));
+        }
+        peers.swap(updated);
+    }
+
+    void AnnounceLoop() {
+        TraceRecorder::Instance().SetThreadName("announcer");
+        std::unique_lock<std::mutex> lock(state_mutex);
+        while (!stopping) {
+            state_changed.wait_for(lock, std::chrono::seconds(kAnnounceSeconds), [&] { return stopping; });
+            if (stopping) break;
+            lock.unlock();
+            Announce();
+            lock.lock();
+        }
+    }
+
+    // Caller holds state_mutex. Prefer segments some peer can give us; pick at random so that
+    // peers starting together fetch different segments from the origin. The pick is extended
+    // over the missing segments that follow it, as long as one source can serve them all, so
+    // small manifest blocks still travel in large requests. count receives the run length.
+    long PickSegments(std::mt19937& random, size_t& count) {
+        std::vector<size_t> from_peers, from_origin;
+        for (size_t i = 0; i < state.size(); ++i) {
+            if (state[i] != kMissing) continue;
+            bool offered = std::any_of(peers.begin(), peers.end(), [&](const Peer& peer) {
+                return peer.failures < kMaxPeerFailures && peer.have[i];
+            });
+            (offered ? from_peers : from_origin).push_back(i);
+        }
+        std::vector<size_t>& pool = from_peers.empty() ? from_origin : from_peers;
+        if (pool.empty()) {
+            return -1;
+        }
+        size_t first = pool[std::uniform_int_distribution<size_t>(0, pool.size() - 1)(random)];
+
+        // Leave work for the other workers near the end
+        size_t max_count = std::max<size_t>(1, std::min(pool.size() / (size_t)num_threads,
+                                                        (size_t)(kMaxRunBytes / manifest.block_size)));
+        std::vector<const Peer*> holders;
+        for (const Peer& peer : peers) {
+            if (peer.failures < kMaxPeerFailures && peer.have[first]) holders.push_back(&peer);
+        }
+        count = 1;
+        while (count < max_count && first + count < state.size() && state[first + count] == kMissing) {
+            size_t next = first + count;
+            if (&pool == &from_peers) {
+                holders.erase(std::remove_if(holders.begin(), holders.end(), [&](const Peer* peer) { return !peer->have[next]; }),
+                              holders.end());
+                if (holders.empty()) break;
+            }
+            ++count;
+        }
+        return (long)first;
+    }
+
+    bool Verify(size_t index, const char* data, size_t length) const {
+        return DeltaManifest::StrongChecksum(reinterpret_cast<const unsigned char*>(data), length) ==
+               manifest.strong[index];
+    }
+
+    // Fetch the segments of [first, first + count) not yet marked in ok with one request, and
+    // keep those that verify. Returns the bytes stored, or -1 if the request failed. At least
+    // one segment must still be missing.
+    curl_off_t FetchRun(const std::string& source, size_t first, size_t count, std::vector<char>& ok, CURL* curl,
+                        std::string& error) {
+        size_t begin = first;
+        while (ok[begin - first]) ++begin;
+        size_t end = first + count;
+        while (ok[end - 1 - first]) --end;
+        ByteRange range{SegmentRange(begin).start, SegmentRange(end - 1).end};
+
+        std::string data;
+        if (!RangeFetcher::FetchToMemory(source, range, data, &error, curl)) {
+            return -1;
+        }
+        curl_off_t stored = 0;
+        for (size_t index = begin; index < end; ++index) {
+            if (ok[index - first]) continue;
+            ByteRange segment = SegmentRange(index);
+            const char* bytes = data.data() + (segment.start - range.start);
+            if (!Verify(index, bytes, (size_t)segment.Length())) {
+                corrupt_segments++;
+                error = "checksum mismatch";
+                continue;
+            }
+            if (!Store(index, bytes, (size_t)segment.Length())) {
+                continue;
+            }
+            ok[index - first] = 1;
+            stored += segment.Length();
+        }
+        return stored;
+    }
+
+    // Try peers holding the whole run, then the origin for whatever is still missing
+    void FetchSegments(size_t first, size_t count, std::vector<char>& ok, CURL* curl, std::mt19937& random) {
+        std::string error;
+        std::vector<std::string> candidates;
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            for (const Peer& peer : peers) {
+                bool holds_all = peer.failures < kMaxPeerFailures;
+                for (size_t i = first; holds_all && i < first + count; ++i) holds_all = peer.have[i] != 0;
+                if (holds_all) candidates.push_back(peer.address);
+            }
+        }
+        std::shuffle(candidates.begin(), candidates.end(), random);
+        if (candidates.size() > (size_t)kPeersPerSegment) candidates.resize(kPeersPerSegment);
+
+        auto complete = [&] { return std::all_of(ok.begin(), ok.end(), [](char held) { return held != 0; }); };
+        for (const std::string& address : candidates) {
+            TraceSpan span("peer", "fetch", "segment", (long long)first);
+            curl_off_t stored = FetchRun("http://" + address + "/" + swarm_id, first, count, ok, curl, error);
+            if (stored > 0) bytes_from_peers += stored;
+            if (complete()) {
+                return;
+            }
+            LogDebug() << "Segments " << first << "+" << count << " from peer " << address << " failed: " << error;
+            std::lock_guard<std::mutex> lock(state_mutex);
+            for (Peer& peer : peers) {
+                if (peer.address == address) peer.failures++;
+            }
+        }
+
+        TraceSpan span("transfer", "origin_segment", "segment", (long long)first);
+        curl_off_t stored = FetchRun(url, first, count, ok, curl, error);
+        if (stored < 0) {
+            LogWarning() << "Segments " << first << "+" << count << " from origin failed: " << error;
+            return;
+        }
+        bytes_from_origin += stored;
+        if (!complete()) {
+            LogWarning() << "Segments " << first << "+" << count << " from origin failed: " << error;
+        }
+    }
+
+    bool Store(size_t index, const char* data, size_t length) {
+        curl_off_t offset = SegmentRange(index).start;
+        size_t written = 0;
+        while (written < length) {
+            ssize_t n = pwrite(out_fd, data + written, length - written, offset + (curl_off_t)written);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                LogError() << "Disk write failed: " << strerror(errno);
+                return false;
+            }
+            written += (size_t)n;
+        }
+        return true;
+    }
+
+    void Worker(int worker_id) {
+        TraceRecorder::Instance().SetThreadName("worker " + std::to_string(worker_id));
+        std::mt19937 random(std::random_device{}() + worker_id);
+        // One handle per worker keeps connections to peers and the origin open between requests
+        CURL* curl = curl_easy_init();
+        std::unique_lock<std::mutex> lock(state_mutex);
+        while (!failed && segments_held < state.size()) {
+            size_t count = 0;
+            long first = PickSegments(random, count);
+            if (first < 0) {
+                // Everything left is being fetched by other workers; one may still fail
+                state_changed.wait_for(lock, std::chrono::milliseconds(100));
+                continue;
+            }
+            for (size_t i = 0; i < count; ++i) state[first + i] = kFetching;
+            lock.unlock();
+            std::vector<char> ok(count, 0);
+            FetchSegments((size_t)first, count, ok, curl, random);
+            lock.lock();
+            for (size_t i = 0; i < count; ++i) {
+                size_t index = (size_t)first + i;
+                if (ok[i]) {
+                    state[index] = kHave;
+                    segments_held++;
+                } else {
+                    state[index] = kMissing;
+                    if (++origin_attempts[index] >= kMaxOriginAttempts) {
+                        LogError() << "Segment " << index << " failed " << kMaxOriginAttempts << " times";
+                        failed = true;
+                    }
+                }
+            }
+            if (progress_board) progress_board->SetDone(0, (curl_off_t)segments_held);
+            state_changed.notify_all();
+        }
+        lock.unlock();
+        if (curl) curl_easy_cleanup(curl);
+    }
+
+public:
+    // listen_port 0 picks a free port for serving other peers
+    PeerDownloader(const std::string& url, const std::string& filename, const std::string& tracker_url,
+                   int threads = 4, int seed_seconds = 60, int listen_port = 0)
+        : url(url), filename(filename), tracker_url(tracker_url), num_threads(threads > 0 ? threads : 1),
+          seed_seconds(std::max(seed_seconds, 0)), listen_port(listen_port) {
+        while (!this->tracker_url.empty() && this->tracker_url.back() == '/') this->tracker_url.pop_back();
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~PeerDownloader() {
+        server.Stop();
+        if (out_fd >= 0) close(out_fd);
+        curl_global_cleanup();
+    }
+
+    bool Download() {
+        TraceSpan session_span("session", "peer_download");
+        LogInfo() << "Starting peer-assisted download...";
+        LogInfo() << "URL: " << url;
+        LogInfo() << "Filename: " << filename;
+        LogInfo() << "Tracker: " << tracker_url;
+
+        if (!manifest.Fetch(url + ".mtdelta")) {
+            return false;
+        }
+        swarm_id = manifest.file_hash.substr(0, 32);
+        state.assign(manifest.BlockCount(), kMissing);
+        origin_attempts.assign(manifest.BlockCount(), 0);
+
+        out_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0 || ftruncate(out_fd, manifest.length) != 0) {
+            LogError() << "Failed to create output file: " << filename;
+            return false;
+        }
+        if (!server.Start("0.0.0.0", listen_port, [this](const HttpRequest& request, HttpConnection& connection) {
+                HandlePeerRequest(request, connection);
+            })) {
+            return false;
+        }
+        LogInfo() << "Sharing " << manifest.BlockCount() << " segments of " << manifest.block_size
+                  << " bytes on port " << server.Port();
+
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_board = Logger::Instance().BeginProgress("download", 1);
+            progress_board->SetTotal(0, (curl_off_t)state.size());
+        }
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        Announce();                              // learn the swarm before choosing segments
+        std::thread announcer(&PeerDownloader::AnnounceLoop, this);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < num_threads; ++i) {
+            workers.emplace_back(&PeerDownloader::Worker, this, i);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        if (progress_board) {
+            Logger::Instance().EndProgress(progress_board);
+            progress_board.reset();
+        }
+
+        bool ok = !failed;
+        if (ok) {
+            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+            LogInfo() << "Download completed successfully!";
+            LogInfo() << "From peers: " << bytes_from_peers << " bytes, from origin: " << bytes_from_origin << " bytes";
+            LogInfo() << "Total time: " << duration.count() << " ms";
+            if (seed_seconds > 0) {
+                LogInfo() << "Seeding for " << seed_seconds << " s...";
+                std::unique_lock<std::mutex> lock(state_mutex);
+                state_changed.wait_for(lock, std::chrono::seconds(seed_seconds), [&] { return stopping; });
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state_mutex);
+            stopping = true;
+        }
+        state_changed.notify_all();
+        announcer.join();
+        Announce(true);
+        server.Stop();
+        LogInfo() << "Served " << bytes_served << " bytes to peers";
+        if (corrupt_segments > 0) {
+            LogWarning() << corrupt_segments << " segments failed verification and were fetched again";
+        }
+        return ok;
+    }
+};
+
+#endif // PEERSHARING_H
@@ -0,0 +1,625 @@
+#ifndef PIECEMANIFEST_H
+#define PIECEMANIFEST_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "Logger.h"
+#include "Sha256.h"
+#include "TraceRecorder.h"
+
+// Per-piece hashes and mirrors of one file, read from either
+//
+//   Metalink 4 (.meta4, RFC 5854): <file><size/><hash type="sha-256"/>
+//                                  <pieces length="N" type="sha-256"><hash/>...</pieces>
+//                                  <url priority="1">...</url>...</file>
+//   JSON: {"name": "...", "size": N, "piece_length": N, "piece_hash": "sha-256",
+//          "pieces": ["<hex>", ...], "sha256": "<hex>", "mirrors": ["<url>", ...]}
+//
+// Only SHA-256 piece hashes are supported.
+struct PieceManifest {
+    std::string name;
+    curl_off_t length = 0;
+    curl_off_t piece_length = 0;
+    std::string file_hash;
+    std::vector<std::string> pieces;
+    std::vector<std::string> mirrors;          // most preferred first
+
+    size_t PieceCount() const { return pieces.size(); }
+
+    ByteRange Piece(size_t index) const {
+        curl_off_t start = (curl_off_t)index * piece_length;
+        return ByteRange{start, std::min(length, start + piece_length) - 1};
+    }
+
+    bool Valid() const {
+        size_t expected = piece_length > 0 ? (size_t)((length + piece_length - 1) / piece_length) : 0;
+        return length > 0 && !pieces.empty() && pieces.size() == expected && !mirrors.empty();
+    }
+
+    // Metalink: the attributes and inner text of the next <tag ...>...</tag> at or after pos
+    static bool NextElement(const std::string& xml, size_t& pos, const std::string& tag,
+                            std::string& attributes, std::string& content) {
+        size_t open = pos;
+        while ((open = xml.find("<" + tag, open)) != std::string::npos) {
+            char next = open + tag.size() + 1 < xml.size() ? xml[open + tag.size() + 1] : '\0';
+            if (next == '>' || isspace((unsigned char)next)) break;
+            open += tag.size() + 1;
+        }
+        if (open == std::string::npos) return false;
+        size_t open_end = xml.find('>', open);
+        size_t close = xml.find("</" + tag + ">", open_end);
+        if (open_end == std::string::npos || close == std::string::npos) return false;
+        attributes = xml.substr(open + tag.size() + 1, open_end - open - tag.size() - 1);
+        content = xml.substr(open_end + 1, close - open_end - 1);
+        pos = close + tag.size() + 3;
+        return true;
+    }
+
+    static std::string Attribute(const std::string& attributes, const std::string& name) {
+        size_t pos = 0;
+        while ((pos = attributes.find(name + "=", pos)) != std::string::npos) {
+            if (pos == 0 || isspace((unsigned char)attributes[pos - 1])) {
+                char quote = attributes[pos + name.size() + 1];
+                size_t end = attributes.find(quote, pos + name.size() + 2);
+                if (end != std::string::npos) return attributes.substr(pos + name.size() + 2, end - pos - name.size() - 2);
+            }
+            pos += name.size();
+        }
+        return "";
+    }
+
+    static std::string XmlText(std::string text) {
+        static const std::pair<const char*, const char*> entities[] = {
+            {"&lt;", "<"}, {"&gt;", ">"}, {"&quot;", "\""}, {"&apos;", "'"}, {"&amp;", "&"}};
+        for (const auto& entity : entities) {
+            size_t pos = 0;
+            while ((pos = text.find(entity.first, pos)) != std::string::npos) {
+                text.replace(pos, strlen(entity.first), entity.second);
+                pos += strlen(entity.second);
+            }
+        }
+        text.erase(0, text.find_first_not_of(" \t\r\n"));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        return text;
+    }
+
+    static std::string Lower(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)tolower(c); });
+        return text;
+    }
+
+    bool ParseMetalink(const std::string& xml) {
+        size_t pos = 0;
+        std::string attributes, file;
+        if (!NextElement(xml, pos, "file", attributes, file)) {
+            return false;
+        }
+        name = Attribute(attributes, "name");
+
+        std::string content;
+        size_t inner = 0;
+        if (NextElement(file, inner, "size", attributes, content)) {
+            length = atoll(XmlText(content).c_str());
+        }
+
+        // Whole-file hash: a <hash> outside <pieces>
+        std::string pieces_xml;
+        size_t pieces_pos = 0;
+        std::string pieces_attributes;
+        bool has_pieces = NextElement(file, pieces_pos, "pieces", pieces_attributes, pieces_xml);
+        std::string outside = has_pieces ? file.substr(0, file.find("<pieces")) + file.substr(pieces_pos) : file;
+        inner = 0;
+        while (NextElement(outside, inner, "hash", attributes, content)) {
+            if (Lower(Attribute(attributes, "type")) == "sha-256") file_hash = Lower(XmlText(content));
+        }
+
+        if (has_pieces) {
+            if (Lower(Attribute(pieces_attributes, "type")) != "sha-256") {
+                LogError() << "Unsupported piece hash type: " << Attribute(pieces_attributes, "type");
+                return false;
+            }
+            piece_length = atoll(Attribute(pieces_attributes, "length").c_str());
+            inner = 0;
+            while (NextElement(pieces_xml, inner, "hash", attributes, content)) {
+                pieces.push_back(Lower(XmlText(content)));
+            }
+        }
+
+        std::vector<std::pair<int, std::string>> urls;
+        inner = 0;
+        while (NextElement(file, inner, "url", attributes, content)) {
+            std::string priority = Attribute(attributes, "priority");
+            urls.emplace_back(priority.empty() ? 999999 : atoi(priority.c_str()), XmlText(content));
+        }
+        std::stable_sort(urls.begin(), urls.end(),
+                         [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) {
+                             return a.first < b.first;
+                         });
+        for (const auto& url : urls) mirrors.push_back(url.second);
+        return true;
+    }
+
+    // Just enough JSON for the manifest: objects, arrays, strings, numbers, literals
+    struct JsonValue {
+        enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+        double number = 0;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::map<std::string, JsonValue> fields;
+
+        const JsonValue* Field(const std::string& key) const {
+            auto it = fields.find(key);
+            return it == fields.end() ? nullptr : &it->second;
+        }
+    };
+
+    static void SkipSpace(const std::string& json, size_t& pos) {
+        while (pos < json.size() && isspace((unsigned char)json[pos])) ++pos;
+    }
+
+    static bool ParseJsonString(const std::string& json, size_t& pos, std::string& out) {
+        if (json[pos] != '"') return false;
+        for (++pos; pos < json.size(); ++pos) {
+            char c = json[pos];
+            if (c == '"') {
+                ++pos;
+                return true;
+            }
+            if (c == '\\' && pos + 1 < json.size()) {
+                char e = json[++pos];
+                if (e == 'n') out += '\n';
+                else if (e == 't') out += '\t';
+                else if (e == 'r') out += '\r';
+                else if (e == 'u' && pos + 4 < json.size()) {
+                    unsigned code = (unsigned)strtoul(json.substr(pos + 1, 4).c_str(), nullptr, 16);
+                    out += code < 0x80 ? (char)code : '?';       // manifests are ASCII in practice
+                    pos += 4;
+                } else out += e;
+            } else {
+                out += c;
+            }
+        }
+        return false;
+    }
+
+    static bool ParseJson(const std::string& json, size_t& pos, JsonValue& value, int depth = 0) {
+        SkipSpace(json, pos);
+        if (pos >= json.size() || depth > 32) return false;
+        char c = json[pos];
+        if (c == '{') {
+            value.type = JsonValue::Object;
+            ++pos;
+            SkipSpace(json, pos);
+            if (pos < json.size() && json[pos] == '}') return ++pos, true;
+            while (pos < json.size()) {
+                SkipSpace(json, pos);
+                std::string key;
+                if (!ParseJsonString(json, pos, key)) return false;
+                SkipSpace(json, pos);
+                if (pos >= json.size() || json[pos++] != ':') return false;
+                if (!ParseJson(json, pos, value.fields[key], depth + 1)) return false;
+                SkipSpace(json, pos);
+                if (pos < json.size() && json[pos] == ',') { ++pos; continue; }
+                return pos < json.size() && json[pos++] == '}';
+            }
+            return false;
+        }
+        if (c == '[') {
+            value.type = JsonValue::Array;
+            ++pos;
+            SkipSpace(json, pos);
+            if (pos < json.size() && json[pos] == ']') return ++pos, true;
+            while (pos < json.size()) {
+                value.items.emplace_back();
+                if (!ParseJson(json, pos, value.items.back(), depth + 1)) return false;
+                SkipSpace(json, pos);
+                if (pos < json.size() && json[pos] == ',') { ++pos; continue; }
+                return pos < json.size() && json[pos++] == ']';
+            }
+            return false;
+        }
+        if (c == '"') {
+            value.type = JsonValue::String;
+            return ParseJsonString(json, pos, value.text);
+        }
+        if (json.compare(pos, 4, "true") == 0 || json.compare(pos, 5, "false") == 0) {
+            value.type = JsonValue::Bool;
+            value.number = json[pos] == 't';
+            pos += json[pos] == 't' ? 4 : 5;
+            return true;
+        }
+        if (json.compare(pos, 4, "null") == 0) {
+            pos += 4;
+            return true;
+        }
+        char* end = nullptr;
+        value.type = JsonValue::Number;
+        value.number = strtod(json.c_str() + pos, &end);
+        if (end == json.c_str() + pos) return false;
+        pos = (size_t)(end - json.c_str());
+        return true;
+    }
+
+    bool ParseJsonManifest(const std::string& json) {
+        JsonValue root;
+        size_t pos = 0;
+        if (!ParseJson(json, pos, root) || root.type != JsonValue::Object) {
+            return false;
+        }
+        if (const JsonValue* v = root.Field("name")) name = v->text;
+        if (const JsonValue* v = root.Field("size")) length = (curl_off_t)v->number;
+        if (const JsonValue* v = root.Field("piece_length")) piece_length = (curl_off_t)v->number;
+        if (const JsonValue* v = root.Field("sha256")) file_hash = Lower(v->text);
+        const JsonValue* type = root.Field("piece_hash");
+        if (type && Lower(type->text) != "sha-256" && Lower(type->text) != "sha256") {
+            LogError() << "Unsupported piece hash type: " << type->text;
+            return false;
+        }
+        if (const JsonValue* v = root.Field("pieces")) {
+            for (const JsonValue& item : v->items) pieces.push_back(Lower(item.text));
+        }
+        const JsonValue* urls = root.Field("mirrors");
+        if (!urls) urls = root.Field("urls");
+        if (urls) {
+            for (const JsonValue& item : urls->items) mirrors.push_back(item.text);
+        }
+        return true;
+    }
+
+    // Write a JSON manifest for a local file (run by whoever publishes the file)
+    static bool Generate(const std::string& path, curl_off_t piece_length, const std::vector<std::string>& urls,
+                         const std::string& manifest_path) {
+        std::ifstream file(path, std::ios::binary);
+        std::ofstream out(manifest_path);
+        if (!file.is_open() || !out.is_open() || piece_length <= 0) {
+            return false;
+        }
+        std::vector<char> buffer((size_t)piece_length);
+        Sha256 whole;
+        curl_off_t length = 0;
+        std::ostringstream hashes;
+        while (file) {
+            file.read(buffer.data(), piece_length);
+            size_t got = (size_t)file.gcount();
+            if (got == 0) break;
+            whole.Update(buffer.data(), got);
+            hashes << (length > 0 ? ",\n    \"" : "\n    \"") << Sha256::Hash(buffer.data(), got) << "\"";
+            length += (curl_off_t)got;
+        }
+        std::string name = path.substr(path.find_last_of('/') + 1);
+        out << "{\n  \"name\": \"" << name << "\",\n"
+            << "  \"size\": " << length << ",\n"
+            << "  \"piece_length\": " << piece_length << ",\n"
+            << "  \"piece_hash\": \"sha-256\",\n"
+            << "  \"sha256\": \"" << whole.HexDigest() << "\",\n"
+            << "  \"mirrors\": [";
+        for (size_t i = 0; i < urls.size(); ++i) {
+            out << (i ? ", " : "") << "\"" << urls[i] << "\"";
+        }
+        out << "],\n  \"pieces\": [" << hashes.str() << "\n  ]\n}\n";
+        return out.good();
+    }
+
+    // Load from a URL or a local path. Without listed mirrors, the manifest's own URL minus its
+    // .meta4, .pieces.json or .json suffix is taken as the file's URL.
+    bool Load(const std::string& source) {
+        std::string text;
+        bool remote = source.compare(0, 7, "http://") == 0 || source.compare(0, 8, "https://") == 0;
+        if (remote) {
+            TraceSpan span("probe", "piece_manifest");
+            CURL* curl = curl_easy_init();
+            if (!curl) return false;
+            curl_easy_setopt(curl, CURLOPT_URL, source.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, +[](void* contents, size_t size, size_t nmemb, void* userp) {
+                static_cast<std::string*>(userp)->append(static_cast<char*>(contents), size * nmemb);
+                return size * nmemb;
+            });
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &text);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 60L);
+            CURLcode res = curl_easy_perform(curl);
+            long response_code = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            curl_easy_cleanup(curl);
+            if (res != CURLE_OK || response_code >= 400) {
+                LogError() << "Failed to fetch manifest " << source << ": "
+                           << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+                return false;
+            }
+        } else {
+            std::ifstream in(source, std::ios::binary);
+            if (!in.is_open()) {
+                LogError() << "Cannot read manifest " << source;
+                return false;
+            }
+            std::ostringstream buffer;
+            buffer << in.rdbuf();
+            text = buffer.str();
+        }
+
+        size_t first = text.find_first_not_of(" \t\r\n");
+        bool parsed = first != std::string::npos && text[first] == '{' ? ParseJsonManifest(text) : ParseMetalink(text);
+        if (parsed && mirrors.empty() && remote) {
+            for (const char* suffix : {".meta4", ".pieces.json", ".json"}) {
+                size_t length = strlen(suffix);
+                if (source.size() > length && source.compare(source.size() - length, length, suffix) == 0) {
+                    mirrors.push_back(source.substr(0, source.size() - length));
+                    break;
+                }
+            }
+        }
+        if (!parsed || !Valid()) {
+            LogError() << "Invalid piece manifest: " << source
+                       << " (needs size, SHA-256 piece hashes matching the size, and at least one URL)";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Downloads a file described by a PieceManifest. Pieces are hashed as their bytes stream to
+// disk; a piece that does not match is fetched again on its own, from a different mirror when
+// there is one. Once every piece has matched, the file is correct without re-reading it.
+class PieceDownloader {
+private:
+    std::string manifest_source;
+    std::string filename;
+    int num_threads;
+
+    static constexpr curl_off_t kRequestBytes = 16LL * 1024 * 1024;   // consecutive pieces per request, at most
+    static constexpr int kMaxPieceAttempts = 5;
+    static constexpr int kMaxMirrorFailures = 5;                       // then only used as a last resort
+
+    enum PieceState : char { kPending = 0, kFetching = 1, kVerified = 2 };
+
+    struct Piece {
+        PieceState state = kPending;
+        int attempts = 0;
+        int last_mirror = -1;                   // mirror that delivered a bad or failed copy
+    };
+
+    PieceManifest manifest;
+    int out_fd = -1;
+    std::mutex mutex;
+    std::vector<Piece> pieces;
+    std::vector<int> mirror_failures;
+    size_t next_mirror = 0;
+    curl_off_t run_bytes = kRequestBytes;
+    size_t verified_count = 0;
+    bool failed = false;
+
+    std::atomic<long long> bytes_verified{0};
+    std::atomic<int> corrupt_pieces{0};
+    std::atomic<int> refetched_pieces{0};
+    std::shared_ptr<ProgressBoard> progress_board;
+
+    // Caller holds mutex. A healthy mirror other than the one to avoid, taking turns
+    int ChooseMirror(int avoid) {
+        int count = (int)manifest.mirrors.size();
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < count; ++i) {
+                int candidate = (int)((next_mirror + i) % count);
+                if (candidate == avoid && count > 1) continue;
+                if (pass == 0 && mirror_failures[candidate] >= kMaxMirrorFailures) continue;
+                next_mirror = candidate + 1;
+                return candidate;
+            }
+        }
+        return avoid >= 0 ? avoid : 0;
+    }
+
+    // Caller holds mutex. Claim a run of consecutive pending pieces: fresh pieces are batched
+    // into one request, a re-fetch goes alone to a different mirror.
+    bool ClaimRun(size_t& first, size_t& count, int& mirror) {
+        for (size_t i = 0; i < pieces.size(); ++i) {
+            if (pieces[i].state != kPending) continue;
+            first = i;
+            count = 1;
+            if (pieces[i].attempts == 0) {
+                curl_off_t bytes = manifest.Piece(i).Length();
+                while (first + count < pieces.size() && pieces[first + count].state == kPending &&
+                       pieces[first + count].attempts == 0 && bytes < run_bytes) {
+                    bytes += manifest.Piece(first + count).Length();
+                    ++count;
+                }
+            }
+            mirror = ChooseMirror(pieces[i].last_mirror);
+            for (size_t j = first; j < first + count; ++j) pieces[j].state = kFetching;
+            return true;
+        }
+        return false;
+    }
+
+    // Caller holds mutex
+    void PieceFailed(size_t index, int mirror) {
+        Piece& piece = pieces[index];
+        piece.state = kPending;
+        piece.last_mirror = mirror;
+        if (++piece.attempts >= kMaxPieceAttempts) {
+            LogError() << "Piece " << index << " failed " << kMaxPieceAttempts << " times";
+            failed = true;
+        }
+    }
+
+    void FetchRun(size_t first, size_t count, int mirror) {
+        const std::string& url = manifest.mirrors[mirror];
+        ByteRange range{manifest.Piece(first).start, manifest.Piece(first + count - 1).end};
+        TraceSpan span("transfer", "pieces", "first", (long long)first);
+
+        // Hash each piece as its bytes arrive, in order within the response
+        size_t current = first;
+        Sha256 hash;
+        std::vector<ByteRange> ranges{range};
+        std::string error;
+        bool ok = RangeFetcher::Fetch(url, ranges, [&](curl_off_t offset, const char* data, size_t len) {
+            while (len > 0) {
+                ByteRange piece = manifest.Piece(current);
+                size_t take = (size_t)std::min<curl_off_t>((curl_off_t)len, piece.end - offset + 1);
+                for (size_t written = 0; written < take;) {
+                    ssize_t n = pwrite(out_fd, data + written, take - written, offset + (curl_off_t)written);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        LogError() << "Disk write failed: " << strerror(errno);
+                        return false;
+                    }
+                    written += (size_t)n;
+                }
+                hash.Update(data, take);
+                data += take;
+                len -= take;
+                offset += (curl_off_t)take;
+                if (offset > piece.end) {
+                    bool match = hash.HexDigest() == manifest.pieces[current];
+                    hash.Reset();
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (match) {
+                        if (pieces[current].attempts > 0) refetched_pieces++;
+                        pieces[current].state = kVerified;
+                        verified_count++;
+                        bytes_verified += piece.Length();
+                        if (progress_board) progress_board->SetDone(0, bytes_verified);
+                    } else {
+                        corrupt_pieces++;
+                        LogWarning() << "Piece " << current << " from " << url << " does not match its hash";
+                        mirror_failures[mirror]++;
+                        PieceFailed(current, mirror);
+                    }
+                    ++current;
+                }
+            }
+            return true;
+        }, &error);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ok) {
+            LogWarning() << "Request for pieces " << first << "-" << first + count - 1 << " from " << url
+                         << " failed: " << error;
+            mirror_failures[mirror]++;
+        }
+        // The piece the response broke off in counts as a failed attempt; pieces it never
+        // reached simply go back to the queue
+        for (size_t i = current; i < first + count; ++i) {
+            if (i == current) {
+                PieceFailed(i, mirror);
+            } else {
+                pieces[i].state = kPending;
+            }
+        }
+    }
+
+    void Worker(int worker_id) {
+        TraceRecorder::Instance().SetThreadName("worker " + std::to_string(worker_id));
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!failed && verified_count < pieces.size()) {
+            size_t first = 0, count = 0;
+            int mirror = 0;
+            if (!ClaimRun(first, count, mirror)) {
+                // Remaining pieces are in flight; one of them may still come back
+                lock.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                lock.lock();
+                continue;
+            }
+            lock.unlock();
+            FetchRun(first, count, mirror);
+            lock.lock();
+        }
+    }
+
+public:
+    // manifest_source is a URL or path of a .meta4 or JSON piece manifest
+    PieceDownloader(const std::string& manifest_source, const std::string& filename, int threads = 4)
+        : manifest_source(manifest_source), filename(filename), num_threads(threads > 0 ? threads : 1) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~PieceDownloader() {
+        if (out_fd >= 0) close(out_fd);
+        curl_global_cleanup();
+    }
+
+    bool Download() {
+        TraceSpan session_span("session", "piece_download");
+        LogInfo() << "Starting piece-verified download...";
+        LogInfo() << "Manifest: " << manifest_source;
+        LogInfo() << "Filename: " << filename;
+
+        if (!manifest.Load(manifest_source)) {
+            return false;
+        }
+        LogInfo() << "File: " << manifest.length << " bytes in " << manifest.PieceCount() << " pieces of "
+                  << manifest.piece_length << " bytes, " << manifest.mirrors.size() << " mirror(s)";
+        pieces.assign(manifest.PieceCount(), Piece());
+        mirror_failures.assign(manifest.mirrors.size(), 0);
+        // Enough runs that every connection has work (and mirrors take turns) on smaller files
+        run_bytes = std::min(kRequestBytes, manifest.length / (num_threads * 4));
+
+        out_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0 || ftruncate(out_fd, manifest.length) != 0) {
+            LogError() << "Failed to create output file: " << filename;
+            return false;
+        }
+        if (Logger::Instance().ProgressEnabled()) {
+            progress_board = Logger::Instance().BeginProgress("download", 1);
+            progress_board->SetTotal(0, manifest.length);
+        }
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (int i = 0; i < num_threads; ++i) {
+            workers.emplace_back(&PieceDownloader::Worker, this, i);
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+        if (progress_board) {
+            Logger::Instance().EndProgress(progress_board);
+            progress_board.reset();
+        }
+
+        if (failed) {
+            LogError() << "Download failed: some pieces never matched their hashes";
+            return false;
+        }
+        if (fsync(out_fd) != 0) {
+            LogError() << "Failed to sync " << filename << ": " << strerror(errno);
+            return false;
+        }
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        LogInfo() << "Download completed successfully! All " << manifest.PieceCount() << " pieces verified";
+        if (corrupt_pieces > 0) {
+            LogInfo() << corrupt_pieces << " corrupt piece copies discarded, " << refetched_pieces
+                      << " pieces re-fetched";
+        }
+        for (size_t i = 0; i < manifest.mirrors.size(); ++i) {
+            if (mirror_failures[i] > 0) {
+                LogInfo() << "Mirror " << manifest.mirrors[i] << ": " << mirror_failures[i] << " failures";
+            }
+        }
+        LogInfo() << "Total time: " << duration.count() << " ms";
+        return true;
+    }
+};
+
+#endif // PIECEMANIFEST_H
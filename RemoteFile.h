@@ -0,0 +1,314 @@
+#ifndef REMOTEFILE_H
+#define REMOTEFILE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <sys/types.h>
+#include <curl/curl.h>
+#include "HttpRange.h"
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// Random-access reader over a remote file using HTTP range requests. Data is fetched in
+// fixed-size blocks kept in an LRU cache; a read that misses several adjacent blocks fetches
+// them with one request. Sequential access is detected and grows a readahead window that is
+// fetched in the background across several connections, so streaming a footer, a zip central
+// directory or a whole file all work without downloading the rest of the object.
+class RemoteFile {
+public:
+    struct Stats {
+        unsigned long long requests = 0;
+        unsigned long long bytes_fetched = 0;
+        unsigned long long block_hits = 0;
+        unsigned long long block_misses = 0;
+    };
+
+private:
+    typedef std::shared_ptr<const std::string> Block;
+
+    struct CacheSlot {
+        Block data;
+        std::list<size_t>::iterator lru_position;
+    };
+
+    std::string url;
+    size_t block_size;
+    size_t cache_blocks;
+    int max_connections;
+    curl_off_t file_size = -1;
+
+    std::mutex mutex;
+    std::condition_variable block_ready;
+    std::list<size_t> lru;                          // most recently used at the front
+    std::unordered_map<size_t, CacheSlot> cache;
+    std::unordered_set<size_t> in_flight;
+    Stats stats;
+
+    // Sequential readahead state
+    curl_off_t last_read_end = -1;
+    size_t readahead_blocks = 0;
+    size_t max_readahead_blocks;
+
+    // Background fetchers for readahead runs
+    std::deque<std::pair<size_t, size_t>> readahead_queue;   // [first block, last block]
+    std::condition_variable queue_ready;
+    std::vector<std::thread> fetchers;
+    bool stopping = false;
+
+    size_t BlockCount() const { return (size_t)((file_size + block_size - 1) / block_size); }
+
+    curl_off_t GetFileSize() {
+        TraceSpan span("probe", "head_size");
+        CURL* curl = curl_easy_init();
+        curl_off_t size = -1;
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+            CURLcode res = curl_easy_perform(curl);
+            long response_code = 0;
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+            if (res == CURLE_OK && response_code >= 200 && response_code < 300) {
+                curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+            } else {
+                LogError() << "HEAD request failed for " << url << ": "
+                           << (res != CURLE_OK ? curl_easy_strerror(res) : ("HTTP " + std::to_string(response_code)).c_str());
+            }
+            curl_easy_cleanup(curl);
+        }
+        return size;
+    }
+
+    // Caller holds the mutex
+    void Insert(size_t index, Block data) {
+        auto it = cache.find(index);
+        if (it != cache.end()) {
+            lru.erase(it->second.lru_position);
+            cache.erase(it);
+        }
+        lru.push_front(index);
+        cache[index] = CacheSlot{std::move(data), lru.begin()};
+        while (cache.size() > cache_blocks) {
+            cache.erase(lru.back());
+            lru.pop_back();
+        }
+    }
+
+    // Caller holds the mutex
+    Block Lookup(size_t index) {
+        auto it = cache.find(index);
+        if (it == cache.end()) {
+            return nullptr;
+        }
+        lru.splice(lru.begin(), lru, it->second.lru_position);
+        return it->second.data;
+    }
+
+    // Fetch blocks [first, last] with a single range request; blocks were marked in flight by the
+    // caller. The blocks also go to *fetched, which holds on to them even if the cache cannot.
+    bool FetchRun(size_t first, size_t last, std::vector<Block>* fetched = nullptr) {
+        TraceSpan span("transfer", "remote_read", "blocks", (long long)(last - first + 1));
+        ByteRange range{(curl_off_t)first * (curl_off_t)block_size,
+                        std::min(file_size, (curl_off_t)(last + 1) * (curl_off_t)block_size) - 1};
+        std::string data;
+        std::string error;
+        bool ok = RangeFetcher::FetchToMemory(url, range, data, &error);
+        if (!ok) {
+            LogError() << "Range read failed for " << url << ": " << error;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.requests++;
+        for (size_t index = first; index <= last; ++index) {
+            in_flight.erase(index);
+            if (ok) {
+                size_t offset = (index - first) * block_size;
+                size_t len = std::min(block_size, data.size() - offset);
+                Block block = std::make_shared<const std::string>(data, offset, len);
+                if (fetched) fetched->push_back(block);
+                Insert(index, std::move(block));
+            }
+        }
+        if (ok) {
+            stats.bytes_fetched += data.size();
+        }
+        block_ready.notify_all();
+        return ok;
+    }
+
+    void FetcherLoop() {
+        while (true) {
+            std::pair<size_t, size_t> run;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queue_ready.wait(lock, [this] { return stopping || !readahead_queue.empty(); });
+                if (stopping) return;
+                run = readahead_queue.front();
+                readahead_queue.pop_front();
+            }
+            FetchRun(run.first, run.second);
+        }
+    }
+
+    // Queue background fetches of blocks after `from`, split over the available connections.
+    // Caller holds the mutex.
+    void ScheduleReadahead(size_t from) {
+        size_t end = std::min(BlockCount(), from + readahead_blocks);
+        std::vector<size_t> wanted;
+        for (size_t index = from; index < end; ++index) {
+            if (!cache.count(index) && !in_flight.count(index)) {
+                wanted.push_back(index);
+            }
+        }
+        if (wanted.empty()) return;
+
+        size_t per_connection = std::max<size_t>(1, (wanted.size() + max_connections - 1) / max_connections);
+        size_t run_start = 0;
+        for (size_t i = 1; i <= wanted.size(); ++i) {
+            bool boundary = i == wanted.size() || wanted[i] != wanted[i - 1] + 1 || i - run_start >= per_connection;
+            if (boundary) {
+                for (size_t j = run_start; j < i; ++j) in_flight.insert(wanted[j]);
+                readahead_queue.emplace_back(wanted[run_start], wanted[i - 1]);
+                run_start = i;
+            }
+        }
+        queue_ready.notify_all();
+    }
+
+public:
+    // block_size: unit of fetching and caching; cache_blocks: LRU capacity;
+    // max_connections: parallel readahead requests
+    RemoteFile(const std::string& url, size_t block_size = 1024 * 1024, size_t cache_blocks = 64,
+               int max_connections = 4)
+        : url(url), block_size(block_size), cache_blocks(std::max<size_t>(cache_blocks, 2)),
+          max_connections(std::max(max_connections, 1)),
+          max_readahead_blocks(std::max<size_t>(1, this->cache_blocks / 2)) {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+    }
+
+    ~RemoteFile() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queue_ready.notify_all();
+        for (auto& fetcher : fetchers) {
+            fetcher.join();
+        }
+        curl_global_cleanup();
+    }
+
+    // Probe the size and start the readahead connections
+    bool Open() {
+        file_size = GetFileSize();
+        if (file_size < 0) {
+            return false;
+        }
+        for (int i = 0; i < max_connections; ++i) {
+            fetchers.emplace_back(&RemoteFile::FetcherLoop, this);
+        }
+        return true;
+    }
+
+    curl_off_t Size() const { return file_size; }
+
+    // pread(2) semantics: read up to len bytes at offset; returns bytes read (0 at end of file)
+    // or -1 on error
+    ssize_t Pread(void* buffer, size_t len, curl_off_t offset) {
+        if (file_size < 0 || offset < 0) return -1;
+        if (offset >= file_size || len == 0) return 0;
+        len = (size_t)std::min<curl_off_t>((curl_off_t)len, file_size - offset);
+
+        size_t first = (size_t)(offset / (curl_off_t)block_size);
+        size_t last = (size_t)((offset + (curl_off_t)len - 1) / (curl_off_t)block_size);
+
+        // The blocks this read copies from, held here so that a read larger than the cache does
+        // not lose its first blocks to eviction before it gets to them
+        std::vector<Block> held(last - first + 1);
+        std::vector<std::pair<size_t, size_t>> runs;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            // Sequential reads double the readahead window, a seek resets it
+            if (offset == last_read_end) {
+                readahead_blocks = std::min(max_readahead_blocks, std::max<size_t>(1, readahead_blocks * 2));
+            } else {
+                readahead_blocks = 0;
+            }
+            last_read_end = offset + (curl_off_t)len;
+
+            // Adjacent missing blocks become one request
+            for (size_t index = first; index <= last; ++index) {
+                if ((held[index - first] = Lookup(index))) {
+                    stats.block_hits++;
+                    continue;
+                }
+                stats.block_misses++;
+                if (in_flight.count(index)) continue;
+                in_flight.insert(index);
+                if (!runs.empty() && runs.back().second + 1 == index) {
+                    runs.back().second = index;
+                } else {
+                    runs.emplace_back(index, index);
+                }
+            }
+            if (readahead_blocks > 0) {
+                ScheduleReadahead(last + 1);
+            }
+        }
+
+        for (const auto& run : runs) {
+            std::vector<Block> fetched;
+            FetchRun(run.first, run.second, &fetched);
+            for (size_t i = 0; i < fetched.size(); ++i) {
+                held[run.first - first + i] = std::move(fetched[i]);
+            }
+        }
+
+        char* out = static_cast<char*>(buffer);
+        size_t copied = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (size_t index = first; index <= last; ++index) {
+            Block block = std::move(held[index - first]);
+            // Wait for readahead already fetching this block; refetch if that attempt failed
+            while (!block && !(block = Lookup(index))) {
+                if (!in_flight.count(index)) {
+                    in_flight.insert(index);
+                    lock.unlock();
+                    bool ok = FetchRun(index, index);
+                    lock.lock();
+                    if (!ok) return copied > 0 ? (ssize_t)copied : -1;
+                    continue;
+                }
+                block_ready.wait(lock);
+            }
+            curl_off_t block_start = (curl_off_t)index * (curl_off_t)block_size;
+            size_t from = (size_t)std::max<curl_off_t>(0, offset - block_start);
+            size_t to = std::min(block->size(), (size_t)(offset + (curl_off_t)len - block_start));
+            if (from >= to) break;
+            memcpy(out + copied, block->data() + from, to - from);
+            copied += to - from;
+        }
+        return (ssize_t)copied;
+    }
+
+    Stats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
+
+#endif // REMOTEFILE_H
@@ -0,0 +1,262 @@
+#ifndef SCAVENGER_H
+#define SCAVENGER_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// Low-priority ("scavenger") mode in the spirit of LEDBAT (RFC 6817). The receive-side RTT of
+// every connection is sampled with TCP_INFO. The lowest RTT seen over the last minutes is the
+// base delay, and anything above it is queuing delay that this download is adding to the
+// bottleneck. While the queuing delay stays under the target, the receive rate and then the
+// number of connections ramp up. Once it passes the target, both shrink in proportion to the
+// overshoot. The rate is enforced by not reading the sockets, so the senders are held back by
+// TCP flow control rather than by dropped packets.
+class ScavengerController {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    bool enabled = false;
+    long long target_us = 0;
+    int max_connections = 1;
+
+    std::mutex mutex;
+    std::condition_variable slot_free;
+    int allowed = 1;                 // connections currently permitted
+    int active = 0;
+
+    // Delay tracking: minimum RTT of the current tick, and per-minute minima for the base delay
+    long long tick_min_rtt_us = 0;
+    std::vector<long long> base_minutes;
+    Clock::time_point minute_started;
+
+    // Receive pacing; rate 0 means unpaced
+    double rate = 0;
+    Clock::time_point next_read;
+    long long tick_bytes = 0;
+    Clock::time_point tick_started;
+    int calm_ticks = 0;
+
+    // Statistics
+    long long base_us = 0;
+    long long peak_queuing_us = 0;
+    int backoffs = 0;
+    int fewest_connections = 0;
+    double lowest_rate = 0;
+
+    static constexpr int kDefaultTargetMs = 25;
+    static constexpr int kBaseHistoryMinutes = 10;
+    static constexpr auto kTick = std::chrono::milliseconds(100);
+    static constexpr auto kSampleInterval = std::chrono::milliseconds(20);
+    static constexpr auto kBurst = std::chrono::milliseconds(50);
+    static constexpr auto kMaxSleep = std::chrono::milliseconds(500);
+    static constexpr double kGain = 0.1;             // rate growth per tick at zero queuing delay
+    static constexpr double kDecrease = 0.5;         // rate cut per tick at twice the target
+    static constexpr double kMinRate = 32 * 1024;    // bytes/s; never starve completely
+    static constexpr double kMaxRate = 10e9;
+    static constexpr int kCalmTicksPerConnection = 10;
+
+    // curl only reports a handle's socket once the transfer is over, so connections are
+    // recorded as they are opened
+    static curl_socket_t OpenSocketCallback(void* clientp, curlsocktype purpose, curl_sockaddr* address) {
+        curl_socket_t fd = socket(address->family, address->socktype, address->protocol);
+        if (purpose == CURLSOCKTYPE_IPCXN) {
+            *static_cast<curl_socket_t*>(clientp) = fd;
+        }
+        return fd;
+    }
+
+    // Receive-side RTT of a connection in microseconds, 0 if unknown
+    static long long SampleRtt(curl_socket_t fd) {
+#if defined(__linux__) && defined(TCP_INFO)
+        if (fd == CURL_SOCKET_BAD) {
+            return 0;
+        }
+        tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+            return 0;
+        }
+        // A pure receiver rarely updates tcpi_rtt; tcpi_rcv_rtt is measured once per window
+        return info.tcpi_rcv_rtt > 0 ? info.tcpi_rcv_rtt : info.tcpi_rtt;
+#else
+        (void)fd;
+        return 0;
+#endif
+    }
+
+    // Caller holds the mutex
+    long long BaseDelay() const {
+        long long base = 0;
+        for (long long minimum : base_minutes) {
+            if (minimum > 0 && (base == 0 || minimum < base)) base = minimum;
+        }
+        return base;
+    }
+
+    // Caller holds the mutex. Adjust rate and connection count once per tick.
+    void Tick(Clock::time_point now) {
+        double seconds = std::chrono::duration<double>(now - tick_started).count();
+        double throughput = seconds > 0 ? tick_bytes / seconds : 0;
+        long long current = tick_min_rtt_us;
+        tick_bytes = 0;
+        tick_min_rtt_us = 0;
+        tick_started = now;
+        if (current <= 0) {
+            return;
+        }
+
+        if (now - minute_started >= std::chrono::minutes(1)) {
+            base_minutes.push_back(0);
+            if ((int)base_minutes.size() > kBaseHistoryMinutes) {
+                base_minutes.erase(base_minutes.begin());
+            }
+            minute_started = now;
+        }
+        long long& minute = base_minutes.back();
+        if (minute == 0 || current < minute) minute = current;
+        base_us = BaseDelay();
+
+        long long queuing = current - base_us;
+        peak_queuing_us = std::max(peak_queuing_us, queuing);
+        double off_target = (double)(target_us - queuing) / target_us;
+
+        if (off_target < 0) {
+            // Over target: cut the rate in proportion to the overshoot, and drop a connection
+            // when the queue is well past it
+            if (rate == 0) {
+                rate = std::max(throughput, kMinRate);
+            }
+            rate = std::max(kMinRate, rate * (1 - kDecrease * std::min(1.0, -off_target)));
+            lowest_rate = lowest_rate == 0 ? rate : std::min(lowest_rate, rate);
+            calm_ticks = 0;
+            ++backoffs;
+            if (off_target < -1 && allowed > 1) {
+                --allowed;
+                fewest_connections = std::min(fewest_connections, allowed);
+                LogInfo() << "Scavenger: queuing delay " << queuing / 1000 << " ms, down to " << allowed
+                          << " connection" << (allowed == 1 ? "" : "s");
+            }
+            TraceRecorder::Instance().Instant("scheduler", "scavenger_backoff", "queuing_us", queuing);
+        } else {
+            if (rate > 0) {
+                rate = std::min(kMaxRate, rate * (1 + kGain * off_target));
+            }
+            // A link that has stayed quiet for a while gets another connection
+            if (off_target > 0.5 && ++calm_ticks >= kCalmTicksPerConnection && allowed < max_connections) {
+                ++allowed;
+                calm_ticks = 0;
+                slot_free.notify_all();
+                LogDebug() << "Scavenger: link idle, up to " << allowed << " connections";
+            }
+        }
+    }
+
+public:
+    // Turn the controller on for a download using up to connections connections
+    void Start(int connections, int target_ms) {
+        std::lock_guard<std::mutex> lock(mutex);
+        enabled = true;
+        target_us = (long long)(target_ms > 0 ? target_ms : kDefaultTargetMs) * 1000;
+        max_connections = std::max(connections, 1);
+        allowed = std::min(2, max_connections);
+        fewest_connections = allowed;
+        active = 0;
+        rate = 0;
+        lowest_rate = 0;
+        backoffs = 0;
+        peak_queuing_us = 0;
+        tick_bytes = 0;
+        tick_min_rtt_us = 0;
+        calm_ticks = 0;
+        base_minutes.assign(1, 0);
+        minute_started = tick_started = next_read = Clock::now();
+    }
+
+    bool Enabled() const { return enabled; }
+
+    // Have the handle store the socket of each connection it opens in *socket for OnData().
+    // A transfer on a reused connection leaves *socket alone, so it must still hold the socket
+    // the handle's previous transfer used.
+    static void Track(CURL* curl, curl_socket_t* socket) {
+        curl_easy_setopt(curl, CURLOPT_OPENSOCKETFUNCTION, OpenSocketCallback);
+        curl_easy_setopt(curl, CURLOPT_OPENSOCKETDATA, socket);
+    }
+
+    // Block until this worker may open a connection
+    void AcquireSlot() {
+        if (!enabled) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        slot_free.wait(lock, [this] { return active < allowed; });
+        ++active;
+    }
+
+    void ReleaseSlot() {
+        if (!enabled) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        --active;
+        slot_free.notify_all();
+    }
+
+    // Called from a transfer's progress callback with the bytes received since the last call;
+    // sleeps as long as the current rate requires, which stops the socket from being read
+    void OnData(curl_socket_t socket, curl_off_t bytes) {
+        if (!enabled) return;
+        static thread_local Clock::time_point last_sample;
+        Clock::time_point now = Clock::now();
+        long long rtt = 0;
+        if (now - last_sample >= kSampleInterval) {
+            last_sample = now;
+            rtt = SampleRtt(socket);
+        }
+
+        Clock::time_point wake;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (rtt > 0 && (tick_min_rtt_us == 0 || rtt < tick_min_rtt_us)) {
+                tick_min_rtt_us = rtt;
+            }
+            tick_bytes += bytes;
+            if (now - tick_started >= kTick) {
+                Tick(now);
+            }
+            if (rate <= 0 || bytes <= 0) {
+                return;
+            }
+            // Shared pacing clock: every connection's bytes push it forward, so together they
+            // receive at rate, with up to kBurst of unused time carried over
+            next_read = std::max(next_read, now - std::chrono::duration_cast<Clock::duration>(kBurst));
+            next_read += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(bytes / rate));
+            wake = next_read;
+        }
+        if (wake > now) {
+            std::this_thread::sleep_for(std::min<Clock::duration>(wake - now, kMaxSleep));
+        }
+    }
+
+    void Log() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!enabled) return;
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "Scavenger: base delay %.1f ms, peak queuing delay %.1f ms (target %lld ms), %d backoffs, "
+                 "%d-%d connections, lowest rate %.0f KB/s",
+                 base_us / 1000.0, peak_queuing_us / 1000.0, target_us / 1000, backoffs, fewest_connections,
+                 max_connections, lowest_rate / 1024);
+        LogInfo() << line;
+    }
+};
+
+#endif // SCAVENGER_H
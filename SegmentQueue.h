@@ -0,0 +1,101 @@
+#ifndef SEGMENTQUEUE_H
+#define SEGMENTQUEUE_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+
+// One byte range of the file as the scheduler planned it
+struct PlannedSegment {
+    int id = 0;
+    curl_off_t start_byte = 0;
+    curl_off_t end_byte = -1;
+
+    curl_off_t Length() const { return end_byte - start_byte + 1; }
+};
+
+// Segment layout and work queue shared by the segmented downloaders and the uploader. The file
+// is cut into up to segments_per_thread segments per connection, never smaller than the minimum
+// segment size (except that there is always at least one per connection). Workers take segments
+// off the queue; a failed segment goes to the back until it has failed kMaxAttempts times,
+// which fails the whole transfer.
+class SegmentQueue {
+public:
+    static constexpr int kMaxAttempts = 3;
+
+private:
+    std::mutex mutex;
+    std::vector<PlannedSegment> segments;
+    std::vector<int> attempts;
+    std::deque<int> pending;
+    std::atomic<bool> failed{false};
+
+public:
+    // Lay out and queue every segment; returns how many there are
+    int Plan(curl_off_t size, int threads, curl_off_t min_segment_size, int segments_per_thread) {
+        curl_off_t count = std::max(threads, 1);
+        if (size / min_segment_size > count) {
+            count = std::min<curl_off_t>(size / min_segment_size, count * segments_per_thread);
+        }
+        count = std::max<curl_off_t>(std::min(count, size), 1);
+        curl_off_t chunk = size / count;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        segments.clear();
+        pending.clear();
+        attempts.assign((size_t)count, 0);
+        failed = false;
+        for (int i = 0; i < (int)count; ++i) {
+            PlannedSegment segment;
+            segment.id = i;
+            segment.start_byte = i * chunk;
+            segment.end_byte = i == count - 1 ? size - 1 : (i + 1) * chunk - 1;
+            segments.push_back(segment);
+            pending.push_back(i);
+        }
+        return (int)count;
+    }
+
+    // Take the next segment; false once the queue is empty or the download has failed
+    bool Next(PlannedSegment& segment) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed || pending.empty()) return false;
+        segment = segments[pending.front()];
+        pending.pop_front();
+        return true;
+    }
+
+    // A segment failed: queue it again, unless it has used up its attempts. Returns false once
+    // the download has failed.
+    bool Retry(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed) return false;
+        if (++attempts[id] < kMaxAttempts) {
+            TraceRecorder::Instance().Instant("retry", "segment_retry", "segment", id);
+            LogWarning() << "Retrying chunk " << id << " (attempt " << attempts[id] + 1 << ")";
+            pending.push_back(id);
+            return true;
+        }
+        LogError() << "Chunk " << id << " failed after " << kMaxAttempts << " attempts";
+        failed = true;
+        return false;
+    }
+
+    // Give up on the download, e.g. when retrying cannot help
+    void Fail() {
+        failed = true;
+    }
+
+    bool Failed() const { return failed; }
+
+    int Count() const { return (int)segments.size(); }
+
+    const std::vector<PlannedSegment>& Segments() const { return segments; }
+};
+
+#endif // SEGMENTQUEUE_H
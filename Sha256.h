@@ -0,0 +1,148 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Incremental SHA-256 (FIPS 180-4), used for content addressing and piece verification
+class Sha256 {
+private:
+    uint32_t state[8];
+    uint8_t block[64];
+    size_t block_len;
+    uint64_t total_len;
+
+    static uint32_t Rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+    void Transform(const uint8_t* data) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+                   (uint32_t)data[i * 4 + 2] << 8 | (uint32_t)data[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t t1 = h + s1 + ch + k[i] + w[i];
+            uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2 = s0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+public:
+    Sha256() { Reset(); }
+
+    void Reset() {
+        static const uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        memcpy(state, init, sizeof(state));
+        block_len = 0;
+        total_len = 0;
+    }
+
+    void Update(const void* data, size_t len) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        total_len += len;
+        if (block_len > 0) {
+            size_t take = std::min(len, 64 - block_len);
+            memcpy(block + block_len, bytes, take);
+            block_len += take;
+            bytes += take;
+            len -= take;
+            if (block_len == 64) {
+                Transform(block);
+                block_len = 0;
+            }
+        }
+        while (len >= 64) {
+            Transform(bytes);
+            bytes += 64;
+            len -= 64;
+        }
+        if (len > 0) {
+            memcpy(block, bytes, len);
+            block_len = len;
+        }
+    }
+
+    // Finish and return the lowercase hex digest; the object must be Reset() before reuse
+    std::string HexDigest() {
+        uint64_t bit_len = total_len * 8;
+        uint8_t pad = 0x80;
+        Update(&pad, 1);
+        uint8_t zero = 0;
+        while (block_len != 56) {
+            Update(&zero, 1);
+        }
+        uint8_t len_bytes[8];
+        for (int i = 0; i < 8; ++i) {
+            len_bytes[i] = static_cast<uint8_t>(bit_len >> (56 - 8 * i));
+        }
+        Update(len_bytes, 8);
+
+        static const char* hex = "0123456789abcdef";
+        std::string out;
+        for (uint32_t word : state) {
+            for (int shift = 28; shift >= 0; shift -= 4) {
+                out += hex[(word >> shift) & 0xf];
+            }
+        }
+        return out;
+    }
+
+    static std::string Hash(const void* data, size_t len) {
+        Sha256 sha;
+        sha.Update(data, len);
+        return sha.HexDigest();
+    }
+
+    static std::string Hash(const std::string& text) { return Hash(text.data(), text.size()); }
+
+    // Hash a whole file; returns an empty string if it cannot be read
+    static std::string HashFile(const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return "";
+        }
+        Sha256 sha;
+        std::string buffer(1 << 20, '\0');
+        while (file) {
+            file.read(&buffer[0], buffer.size());
+            std::streamsize got = file.gcount();
+            if (got > 0) {
+                sha.Update(buffer.data(), static_cast<size_t>(got));
+            }
+        }
+        return sha.HexDigest();
+    }
+};
+
+#endif // SHA256_H
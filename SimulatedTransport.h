@@ -0,0 +1,339 @@
+#ifndef SIMULATEDTRANSPORT_H
+#define SIMULATEDTRANSPORT_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include "Logger.h"
+#include "Transport.h"
+
+// The network a SimulatedTransport pretends to be, configured from a spec such as
+// "size=1024,bottleneck=10000,connection=50,rtt=40,failures=0.01,jitter=0.3,seed=7":
+//   size=<MB>             size of the simulated resource
+//   bottleneck=<Mbit/s>   capacity shared by all connections, 0 = unlimited
+//   connection=<Mbit/s>   cap per connection (a server throttling each one), 0 = unlimited
+//   rtt=<ms>              round-trip time; connect + request cost two before the first byte
+//   failures=<0..1>       chance that a transfer breaks partway through
+//   jitter=<0..1>         spread of the per-connection cap between transfers
+//   seed=<n>              seed of every random choice; equal seeds give equal runs
+struct SimulatedNetwork {
+    curl_off_t size = 256LL * 1024 * 1024;
+    double bottleneck_mbit = 1000;
+    double connection_mbit = 100;
+    double rtt_ms = 20;
+    double failure_rate = 0;
+    double jitter = 0;
+    unsigned long long seed = 1;
+
+    // Returns false on an unknown option
+    bool Configure(const std::string& spec) {
+        bool ok = true;
+        size_t pos = 0;
+        while (pos <= spec.size()) {
+            size_t comma = spec.find(',', pos);
+            std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            double value = eq == std::string::npos ? 0 : atof(item.c_str() + eq + 1);
+            if (key == "size") {
+                size = (curl_off_t)(value * 1024 * 1024);
+            } else if (key == "bottleneck") {
+                bottleneck_mbit = value;
+            } else if (key == "connection") {
+                connection_mbit = value;
+            } else if (key == "rtt") {
+                rtt_ms = value;
+            } else if (key == "failures") {
+                failure_rate = value;
+            } else if (key == "jitter") {
+                jitter = std::min(std::max(value, 0.0), 1.0);
+            } else if (key == "seed") {
+                seed = std::strtoull(item.c_str() + eq + 1, nullptr, 10);
+            } else if (!key.empty()) {
+                LogWarning() << "Unknown simulation option: " << item;
+                ok = false;
+            }
+            if (comma == std::string::npos) break;
+            pos = comma + 1;
+        }
+        return ok && size > 0;
+    }
+};
+
+// A Transport with no sockets: transfers are flows in a fluid model of SimulatedNetwork, timed
+// on a virtual clock. The clock only moves when every worker thread is blocked in Fetch(); it
+// then jumps straight to the next event (a flow getting its first byte, finishing or
+// breaking), with the bottleneck divided max-min fairly among the flows that are receiving.
+// Random choices are keyed by the range and attempt rather than drawn in arrival order, so a
+// run is deterministic, and a thousand connections moving gigabytes take milliseconds of wall
+// time. Bodies are a fixed pattern written into the sink at the end of each flow, so sinks
+// still do their real work and the result can be checked with Verify().
+class SimulatedTransport : public Transport {
+private:
+    struct Flow {
+        double ready_us;             // first byte arrives
+        double remaining;            // bytes still to receive
+        double stop_at;              // remaining bytes when the transfer breaks (0 = never)
+        double cap;                  // bytes per microsecond this connection can carry
+        double rate = 0;
+        bool done = false;
+        bool cancelled = false;
+    };
+
+    SimulatedNetwork network;
+    std::vector<unsigned char> pattern;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    double now_us = 0;
+    int workers = 0;                 // threads that will issue fetches
+    std::vector<Flow*> flows;
+    std::map<curl_off_t, int> attempts;
+    long long transfers = 0;
+    long long failures = 0;
+    long long events = 0;
+
+    // Prime period, so a pattern block landing at the wrong offset is caught by Verify()
+    static constexpr size_t kPatternPeriod = 65521;
+    static constexpr size_t kWriteBlock = 64 * 1024;
+
+    static uint64_t Mix(uint64_t x) {
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    // Uniform in [0, 1), the same for the same range, attempt and purpose on every run
+    double Uniform(curl_off_t start, int attempt, int purpose) const {
+        uint64_t x = Mix(network.seed ^ Mix((uint64_t)start ^ Mix(((uint64_t)attempt << 8) | (uint64_t)purpose)));
+        return (double)(x >> 11) / 9007199254740992.0;
+    }
+
+    static double BytesPerMicro(double mbit) {
+        return mbit > 0 ? mbit * 1e6 / 8 / 1e6 : std::numeric_limits<double>::infinity();
+    }
+
+    // Caller holds the mutex. Share the bottleneck max-min fairly among receiving flows.
+    void AssignRates() {
+        std::vector<Flow*> receiving;
+        for (Flow* flow : flows) {
+            if (!flow->done && flow->ready_us <= now_us) receiving.push_back(flow);
+        }
+        std::sort(receiving.begin(), receiving.end(), [](const Flow* a, const Flow* b) { return a->cap < b->cap; });
+        double capacity = BytesPerMicro(network.bottleneck_mbit);
+        for (size_t i = 0; i < receiving.size(); ++i) {
+            double share = capacity / (double)(receiving.size() - i);
+            receiving[i]->rate = std::min(receiving[i]->cap, share);
+            capacity -= receiving[i]->rate;
+        }
+    }
+
+    // Caller holds the mutex and every worker is waiting: run the model up to the next event
+    // that ends a flow
+    void Advance() {
+        while (true) {
+            AssignRates();
+            double step = std::numeric_limits<double>::infinity();
+            for (Flow* flow : flows) {
+                if (flow->done) continue;
+                if (flow->ready_us > now_us) {
+                    step = std::min(step, flow->ready_us - now_us);
+                } else if (flow->rate > 0) {
+                    step = std::min(step, (flow->remaining - flow->stop_at) / flow->rate);
+                }
+            }
+            if (step == std::numeric_limits<double>::infinity()) {
+                // Unlimited bandwidth: everything receiving finishes at once
+                step = 0;
+            }
+            now_us += step;
+            ++events;
+
+            bool finished = false;
+            for (Flow* flow : flows) {
+                if (flow->done || flow->ready_us > now_us - step) continue;
+                flow->remaining -= std::isinf(flow->rate) ? flow->remaining : flow->rate * step;
+                if (flow->remaining - flow->stop_at <= 0.5) {
+                    flow->remaining = flow->stop_at;
+                    flow->done = true;
+                    finished = true;
+                }
+            }
+            if (finished) {
+                changed.notify_all();
+                return;
+            }
+        }
+    }
+
+    // Caller holds the mutex. A woken flow whose thread has not run yet may still start
+    // another transfer at the current time, so the clock waits for it too.
+    void AdvanceIfIdle() {
+        int blocked = 0;
+        for (Flow* flow : flows) {
+            if (flow->done) return;
+            ++blocked;
+        }
+        if (blocked > 0 && blocked >= workers) {
+            Advance();
+        }
+    }
+
+    bool Deliver(SegmentSink& sink, curl_off_t offset, curl_off_t length) {
+        std::vector<char> block(kWriteBlock);
+        while (length > 0) {
+            size_t len = (size_t)std::min<curl_off_t>(length, (curl_off_t)block.size());
+            for (size_t i = 0; i < len;) {
+                size_t at = (size_t)((offset + (curl_off_t)i) % (curl_off_t)kPatternPeriod);
+                size_t take = std::min(len - i, kPatternPeriod - at);
+                memcpy(block.data() + i, pattern.data() + at, take);
+                i += take;
+            }
+            // A full sink holds the flow back in wall time only; virtual time waits for it
+            while (!sink.TryWrite(block.data(), len)) {
+                if (sink.Failed()) return false;
+                while (!sink.HasRoom(len) && !sink.Failed()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            offset += (curl_off_t)len;
+            length -= (curl_off_t)len;
+        }
+        return true;
+    }
+
+public:
+    explicit SimulatedTransport(const SimulatedNetwork& network) : network(network), pattern(kPatternPeriod) {
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            pattern[i] = (unsigned char)(Mix(i) >> 56);
+        }
+    }
+
+    curl_off_t Size(const std::string& url, int connections) override {
+        return network.size;
+    }
+
+    bool SupportsRanges(const std::string& url, curl_off_t size) override {
+        return true;
+    }
+
+    RangeResult Fetch(const RangeRequest& request, SegmentSink& sink, const ProgressFn& progress) override {
+        bool partial = request.ranged;
+        curl_off_t start = partial ? request.start_byte : 0;
+        curl_off_t length = partial ? request.end_byte - request.start_byte + 1 : network.size;
+
+        RangeResult result;
+        Flow flow;
+        curl_off_t received = length;
+        double started_us;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            int attempt = attempts[start]++;
+            ++transfers;
+            started_us = now_us;
+            double rtt_us = network.rtt_ms * 1000;
+            flow.ready_us = now_us + 2 * rtt_us;
+            flow.remaining = (double)length;
+            flow.cap = BytesPerMicro(network.connection_mbit) * (1 - network.jitter * Uniform(start, attempt, 0));
+            flow.stop_at = 0;
+            if (Uniform(start, attempt, 1) < network.failure_rate) {
+                received = (curl_off_t)(length * Uniform(start, attempt, 2));
+                flow.stop_at = (double)(length - received);
+                ++failures;
+            }
+            result.timing.connect_us = (long long)rtt_us;
+            result.timing.first_byte_us = (long long)(2 * rtt_us);
+
+            // Called without BeginWorkers(): the caller is the only worker for this request
+            bool lone = workers == 0;
+            if (lone) ++workers;
+            flows.push_back(&flow);
+            AdvanceIfIdle();
+            changed.wait(lock, [&flow] { return flow.done; });
+            flows.erase(std::find(flows.begin(), flows.end(), &flow));
+            if (lone) --workers;
+            AdvanceIfIdle();
+            result.timing.total_us = (long long)(now_us - started_us);
+        }
+
+        if (flow.cancelled) {
+            result.error = "Transfer cancelled";
+            return result;
+        }
+        if (!Deliver(sink, start, received)) {
+            result.error = "Sink refused data";
+            return result;
+        }
+        result.received = received;
+        if (progress) {
+            progress(received);
+        }
+        if (flow.stop_at > 0) {
+            result.error = "Simulated connection reset";
+            return result;
+        }
+        result.ok = true;
+        result.status = partial ? 206 : 200;
+        return result;
+    }
+
+    void Cancel() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Flow* flow : flows) {
+            if (!flow->done) {
+                flow->done = true;
+                flow->cancelled = true;
+            }
+        }
+        changed.notify_all();
+    }
+
+    long long NowMicros() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (long long)now_us;
+    }
+
+    void BeginWorkers(int count) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        workers += count;
+    }
+
+    void WorkerDone() override {
+        std::lock_guard<std::mutex> lock(mutex);
+        --workers;
+        AdvanceIfIdle();
+    }
+
+    // Whether data holds the simulated resource starting at offset
+    bool Verify(const char* data, size_t length, curl_off_t offset = 0) const {
+        for (size_t i = 0; i < length;) {
+            size_t at = (size_t)((offset + (curl_off_t)i) % (curl_off_t)kPatternPeriod);
+            size_t take = std::min(length - i, kPatternPeriod - at);
+            if (memcmp(data + i, pattern.data() + at, take) != 0) return false;
+            i += take;
+        }
+        return true;
+    }
+
+    void Log() {
+        std::lock_guard<std::mutex> lock(mutex);
+        char line[256];
+        snprintf(line, sizeof(line), "Simulation: %lld transfers, %lld broken, %lld events, virtual time %.3f s",
+                 transfers, failures, events, now_us / 1e6);
+        LogInfo() << line;
+    }
+};
+
+#endif // SIMULATEDTRANSPORT_H
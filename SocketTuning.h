@@ -0,0 +1,259 @@
+#ifndef SOCKETTUNING_H
+#define SOCKETTUNING_H
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <curl/curl.h>
+#include "Logger.h"
+
+// What the kernel reported for the connections of one download, read with TCP_INFO as each
+// connection was closed
+class TcpStats {
+private:
+    std::mutex mutex;
+    int sockets = 0;
+    long long rtt_sum_us = 0;
+    long long rtt_min_us = 0;
+    long long rtt_max_us = 0;
+    long long retransmits = 0;
+    long long cwnd_sum = 0;
+    long long rcv_space_sum = 0;
+    long long rcvbuf_sum = 0;
+
+public:
+    void Add(long long rtt_us, long long retrans, long long cwnd, long long rcv_space, long long rcvbuf) {
+        std::lock_guard<std::mutex> lock(mutex);
+        rtt_min_us = sockets == 0 ? rtt_us : std::min(rtt_min_us, rtt_us);
+        rtt_max_us = std::max(rtt_max_us, rtt_us);
+        ++sockets;
+        rtt_sum_us += rtt_us;
+        retransmits += retrans;
+        cwnd_sum += cwnd;
+        rcv_space_sum += rcv_space;
+        rcvbuf_sum += rcvbuf;
+    }
+
+    long long AverageRttMicros() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sockets > 0 ? rtt_sum_us / sockets : 0;
+    }
+
+    void Reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        sockets = 0;
+        rtt_sum_us = rtt_min_us = rtt_max_us = 0;
+        retransmits = cwnd_sum = rcv_space_sum = rcvbuf_sum = 0;
+    }
+
+    // One summary line per download, nothing if no socket was sampled
+    void Log() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (sockets == 0) return;
+        char line[256];
+        snprintf(line, sizeof(line),
+                 "TCP: %d connections, rtt %.2f/%.2f/%.2f ms (min/avg/max), %lld retransmits, "
+                 "cwnd avg %lld segments, receive window avg %lld KB, receive buffer avg %lld KB",
+                 sockets, rtt_min_us / 1000.0, rtt_sum_us / 1000.0 / sockets, rtt_max_us / 1000.0, retransmits,
+                 cwnd_sum / sockets, rcv_space_sum / sockets / 1024, rcvbuf_sum / sockets / 1024);
+        LogInfo() << line;
+    }
+};
+
+// Process-wide socket options applied to download connections through CURLOPT_SOCKOPTFUNCTION,
+// which runs after curl creates a socket and before it connects. Everything defaults to the
+// kernel's choice. Configured from a spec such as "cc=bbr,rcvbuf=bdp,bandwidth=1000,lowat=131072,
+// quickack,busypoll=50":
+//   rcvbuf=<bytes|Nk|Nm>  fixed SO_RCVBUF (this turns off the kernel's receive autotuning)
+//   rcvbuf=bdp            size SO_RCVBUF to each connection's share of bandwidth x RTT, with the
+//                         RTT measured on the size probe and bandwidth=<Mbit/s> (default 1000)
+//   cc=<name>             TCP_CONGESTION, e.g. bbr or cubic (the module must be loaded)
+//   lowat=<bytes>         TCP_NOTSENT_LOWAT
+//   quickack              TCP_QUICKACK at connect
+//   busypoll=<usec>       SO_BUSY_POLL
+class SocketTuning {
+private:
+    long long fixed_rcvbuf = 0;
+    bool bdp_rcvbuf = false;
+    long long bandwidth_mbit = 1000;
+    std::string congestion;
+    int notsent_lowat = 0;
+    bool quickack = false;
+    int busy_poll_us = 0;
+
+    // Path estimate for rcvbuf=bdp, set by the downloader once it has probed the host
+    std::atomic<long long> path_rtt_us{0};
+    std::atomic<int> path_connections{1};
+
+    // Each failing option is reported once, not once per connection
+    std::atomic<unsigned> warned{0};
+
+    static constexpr long long kMinBuffer = 256 * 1024;
+    static constexpr long long kMaxBuffer = 256LL * 1024 * 1024;
+
+    SocketTuning() = default;
+
+    static long long ParseBytes(const std::string& text) {
+        char* end = nullptr;
+        long long value = std::strtoll(text.c_str(), &end, 10);
+        if (end && (*end == 'k' || *end == 'K')) value *= 1024;
+        if (end && (*end == 'm' || *end == 'M')) value *= 1024 * 1024;
+        return value;
+    }
+
+    void WarnOnce(unsigned bit, const char* option) {
+        if (!(warned.fetch_or(bit) & bit)) {
+            LogWarning() << "Cannot set " << option << ": " << strerror(errno);
+        }
+    }
+
+    // Runs in place of close() for every connection curl drops, so the final TCP state of
+    // each connection can still be read
+    static int CloseSocketCallback(void* clientp, curl_socket_t fd) {
+#if defined(__linux__) && defined(TCP_INFO)
+        tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        int rcvbuf = 0;
+        socklen_t rcvbuf_len = sizeof(rcvbuf);
+        if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+            getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &rcvbuf_len) == 0 && info.tcpi_rtt > 0) {
+            static_cast<TcpStats*>(clientp)->Add(info.tcpi_rtt, info.tcpi_total_retrans, info.tcpi_snd_cwnd,
+                                                 info.tcpi_rcv_space, rcvbuf);
+        }
+#else
+        (void)clientp;
+#endif
+        return close(fd);
+    }
+
+    static int SockoptCallback(void* clientp, curl_socket_t fd, curlsocktype purpose) {
+        if (purpose == CURLSOCKTYPE_IPCXN) {
+            static_cast<SocketTuning*>(clientp)->Tune(fd);
+        }
+        return CURL_SOCKOPT_OK;
+    }
+
+    void Tune(curl_socket_t fd) {
+        // Must precede connect() so the window scale offered in the SYN matches the buffer
+        int rcvbuf = (int)ReceiveBuffer();
+        if (rcvbuf > 0) {
+            bool forced = false;
+#ifdef SO_RCVBUFFORCE
+            // Needs CAP_NET_ADMIN; lets the buffer exceed net.core.rmem_max
+            forced = setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == 0;
+#endif
+            if (!forced && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0) {
+                WarnOnce(1, "SO_RCVBUF");
+            }
+        }
+#ifdef TCP_CONGESTION
+        if (!congestion.empty() &&
+            setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION, congestion.c_str(), (socklen_t)congestion.size()) != 0) {
+            WarnOnce(2, "TCP_CONGESTION");
+        }
+#endif
+#ifdef TCP_NOTSENT_LOWAT
+        if (notsent_lowat > 0 &&
+            setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &notsent_lowat, sizeof(notsent_lowat)) != 0) {
+            WarnOnce(4, "TCP_NOTSENT_LOWAT");
+        }
+#endif
+#ifdef TCP_QUICKACK
+        int one = 1;
+        if (quickack && setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one)) != 0) {
+            WarnOnce(8, "TCP_QUICKACK");
+        }
+#endif
+#ifdef SO_BUSY_POLL
+        if (busy_poll_us > 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)) != 0) {
+            WarnOnce(16, "SO_BUSY_POLL");
+        }
+#endif
+    }
+
+public:
+    static SocketTuning& Instance() {
+        static SocketTuning tuning;
+        return tuning;
+    }
+
+    // Parse a comma-separated option list; returns false on an unknown option
+    bool Configure(const std::string& spec) {
+        bool ok = true;
+        size_t pos = 0;
+        while (pos <= spec.size()) {
+            size_t comma = spec.find(',', pos);
+            std::string item = spec.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+            size_t eq = item.find('=');
+            std::string key = item.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+            if (key == "rcvbuf" && value == "bdp") {
+                bdp_rcvbuf = true;
+            } else if (key == "rcvbuf") {
+                fixed_rcvbuf = std::min(ParseBytes(value), kMaxBuffer);
+            } else if (key == "bandwidth") {
+                bandwidth_mbit = std::max(1LL, std::strtoll(value.c_str(), nullptr, 10));
+            } else if (key == "cc") {
+                congestion = value;
+            } else if (key == "lowat") {
+                notsent_lowat = (int)ParseBytes(value);
+            } else if (key == "quickack") {
+                quickack = true;
+            } else if (key == "busypoll") {
+                busy_poll_us = atoi(value.c_str());
+            } else if (!key.empty()) {
+                LogWarning() << "Unknown socket option: " << item;
+                ok = false;
+            }
+            if (comma == std::string::npos) break;
+            pos = comma + 1;
+        }
+        return ok;
+    }
+
+    bool Enabled() const {
+        return fixed_rcvbuf > 0 || bdp_rcvbuf || !congestion.empty() || notsent_lowat > 0 || quickack ||
+               busy_poll_us > 0;
+    }
+
+    // Round-trip time to the host and the number of connections sharing the path
+    void SetPath(long long rtt_us, int connections) {
+        path_rtt_us = rtt_us;
+        path_connections = std::max(connections, 1);
+    }
+
+    // SO_RCVBUF for the next connection, 0 to leave it to the kernel
+    long long ReceiveBuffer() const {
+        if (fixed_rcvbuf > 0) return fixed_rcvbuf;
+        long long rtt = path_rtt_us;
+        if (!bdp_rcvbuf || rtt <= 0) return 0;
+        long long bdp = bandwidth_mbit * 1000000 / 8 * rtt / 1000000;
+        return std::min(std::max(bdp / path_connections, kMinBuffer), kMaxBuffer);
+    }
+
+    // Install the socket callbacks on a handle. Options are applied only when configured;
+    // with stats, every connection of the handle is sampled with TCP_INFO as curl closes it.
+    void Apply(CURL* curl, TcpStats* stats = nullptr) {
+        if (Enabled()) {
+            curl_easy_setopt(curl, CURLOPT_SOCKOPTFUNCTION, SockoptCallback);
+            curl_easy_setopt(curl, CURLOPT_SOCKOPTDATA, this);
+        }
+        if (stats) {
+            curl_easy_setopt(curl, CURLOPT_CLOSESOCKETFUNCTION, CloseSocketCallback);
+            curl_easy_setopt(curl, CURLOPT_CLOSESOCKETDATA, stats);
+        }
+    }
+};
+
+#endif // SOCKETTUNING_H
@@ -0,0 +1,328 @@
+#ifndef STREAMWRITER_H
+#define STREAMWRITER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "MemoryBudget.h"
+#include "TraceRecorder.h"
+
+// Where the body of a transfer goes. TryWrite() accepts all of the data or none of it; refused
+// data is offered again once HasRoom() says it fits, which is how a slow destination holds the
+// transfer back. After Failed() the transfer is aborted.
+class SegmentSink {
+public:
+    virtual ~SegmentSink() = default;
+    virtual bool TryWrite(const char* data, size_t len) = 0;
+    virtual bool HasRoom(size_t len) const { return true; }
+    virtual bool Failed() const { return false; }
+};
+
+// Sequential file writer that takes disk I/O off the receiving thread. The producer (a curl
+// write callback) copies data into fixed-size slots of a single-producer/single-consumer ring
+// and publishes each full slot with one release store; a dedicated thread drains the ring with
+// write(2). Slot memory is reserved from the global MemoryBudget and freed as soon as the slot
+// is written, so a slow disk makes TryWrite() refuse data (and the transfer pause) instead of
+// letting buffers grow or blocking the socket.
+class StreamWriter : public SegmentSink {
+public:
+    static constexpr size_t kDefaultSlotSize = 512 * 1024;
+    static constexpr size_t kDefaultSlots = 32;
+
+private:
+    struct Slot {
+        std::unique_ptr<char[]> data;
+        size_t used = 0;
+    };
+
+    std::vector<Slot> ring;
+    size_t slot_size;
+    int fd = -1;
+    std::thread writer;
+
+    // head: slots published by the producer; tail: slots released by the writer
+    std::atomic<unsigned long long> head{0};
+    std::atomic<unsigned long long> tail{0};
+    Slot* current = nullptr;                     // producer's slot being filled
+    std::atomic<bool> closed{false};
+    std::atomic<bool> failed{false};
+
+    // The writer sleeps only while the ring is empty. It raises writer_waiting before its last
+    // look at head, and the producer bumps head before looking at writer_waiting; both sides
+    // are sequentially consistent, so one of them always sees the other and no wakeup is lost.
+    std::mutex wait_mutex;
+    std::condition_variable not_empty;
+    std::atomic<bool> writer_waiting{false};
+
+    unsigned long long bytes_written = 0;
+
+    void Publish() {
+        current = nullptr;
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+        if (writer_waiting.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            not_empty.notify_one();
+        }
+    }
+
+    bool WriteAll(const char* data, size_t len) {
+        while (len > 0) {
+            ssize_t n = ::write(fd, data, len);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                LogError() << "Disk write failed: " << strerror(errno);
+                return false;
+            }
+            data += n;
+            len -= (size_t)n;
+            bytes_written += (size_t)n;
+        }
+        return true;
+    }
+
+    void WriterLoop() {
+        TraceRecorder::Instance().SetThreadName("disk writer");
+        while (true) {
+            unsigned long long t = tail.load(std::memory_order_relaxed);
+            if (t == head.load(std::memory_order_acquire)) {
+                if (closed.load(std::memory_order_acquire)) {
+                    if (t == head.load(std::memory_order_acquire)) break;
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(wait_mutex);
+                writer_waiting.store(true, std::memory_order_seq_cst);
+                not_empty.wait(lock, [&] {
+                    return head.load(std::memory_order_seq_cst) != t || closed.load(std::memory_order_acquire);
+                });
+                writer_waiting.store(false, std::memory_order_relaxed);
+                continue;
+            }
+
+            Slot& slot = ring[t % ring.size()];
+            if (!failed.load(std::memory_order_relaxed)) {
+                TraceSpan span("disk", "write", "bytes", (long long)slot.used);
+                if (!WriteAll(slot.data.get(), slot.used)) {
+                    failed.store(true, std::memory_order_release);
+                }
+            }
+            slot.data.reset();
+            tail.store(t + 1, std::memory_order_release);
+            MemoryBudget::Instance().Release((long long)slot_size);
+        }
+    }
+
+    // Slots the producer may still claim
+    size_t FreeSlots() const {
+        size_t busy = (size_t)(head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+        return ring.size() - busy - (current ? 1 : 0);
+    }
+
+public:
+    explicit StreamWriter(size_t slot_size = kDefaultSlotSize, size_t slot_count = kDefaultSlots)
+        : ring(std::max<size_t>(slot_count, 2)), slot_size(slot_size) {}
+
+    ~StreamWriter() {
+        Close();
+    }
+
+    // Create (truncate) the file and start the writer thread
+    bool Open(const std::string& filename) {
+        fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        writer = std::thread(&StreamWriter::WriterLoop, this);
+        return true;
+    }
+
+    // Producer side: accept all of the data or none of it. Returns false when the ring or the
+    // memory budget has no room (retry once the writer drains) or after a disk error (Failed()).
+    bool TryWrite(const char* data, size_t len) override {
+        if (failed.load(std::memory_order_acquire)) {
+            return false;
+        }
+        size_t room = current ? slot_size - current->used : 0;
+        size_t new_slots = len > room ? (len - room + slot_size - 1) / slot_size : 0;
+        if (new_slots > FreeSlots() ||
+            (new_slots > 0 && !MemoryBudget::Instance().TryReserve((long long)(new_slots * slot_size)))) {
+            // Hand the partial slot to the writer: if every paused transfer sat on a reserved,
+            // unpublished slot, nothing would ever be released
+            if (current && current->used > 0) {
+                Publish();
+            }
+            return false;
+        }
+
+        while (len > 0) {
+            if (!current) {
+                current = &ring[head.load(std::memory_order_relaxed) % ring.size()];
+                current->data.reset(new char[slot_size]);
+                current->used = 0;
+            }
+            size_t take = std::min(len, slot_size - current->used);
+            memcpy(current->data.get() + current->used, data, take);
+            current->used += take;
+            data += take;
+            len -= take;
+            if (current->used == slot_size) {
+                Publish();
+            }
+        }
+        return true;
+    }
+
+    // Whether a write of len bytes would currently be accepted (budget permitting)
+    bool HasRoom(size_t len) const override {
+        size_t room = current ? slot_size - current->used : 0;
+        size_t new_slots = len > room ? (len - room + slot_size - 1) / slot_size : 0;
+        long long in_use = MemoryBudget::Instance().InUse();
+        return new_slots <= FreeSlots() &&
+               (in_use == 0 || in_use + (long long)(new_slots * slot_size) <= MemoryBudget::Instance().Limit());
+    }
+
+    bool Failed() const override { return failed.load(std::memory_order_acquire); }
+
+    // Flush everything queued, stop the writer and close the file; returns false if any
+    // write failed
+    bool Close() {
+        if (fd < 0) {
+            return !failed;
+        }
+        if (current) {
+            Publish();
+        }
+        closed.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            not_empty.notify_one();
+        }
+        if (writer.joinable()) {
+            writer.join();
+        }
+        if (::close(fd) != 0) {
+            failed = true;
+        }
+        fd = -1;
+        return !failed;
+    }
+
+    unsigned long long BytesWritten() const { return bytes_written; }
+};
+
+// Connects a curl transfer to a SegmentSink (usually a StreamWriter). The write callback hands
+// data to the sink and pauses the transfer when it is refused; Perform() drives the transfer on a multi
+// handle so a paused transfer sleeps in curl_multi_poll() and resumes as soon as the writer
+// frees memory (MemoryBudget::Release wakes it), rather than on curl's once-a-second tick.
+// The multi handle is private unless the caller passes one to keep its connections alive.
+// Instantiated for a final sink class, the calls into the sink need no virtual dispatch.
+template <class Writer = SegmentSink>
+class BasicBufferedTransfer {
+private:
+    Writer* writer;
+    std::function<bool()> should_abort;          // polled while the transfer runs
+    std::atomic<bool> paused{false};
+    std::chrono::steady_clock::time_point paused_at;
+    size_t last_refused = 0;                     // size of the chunk curl will deliver again
+
+public:
+    explicit BasicBufferedTransfer(Writer* writer) : writer(writer) {}
+
+    // Stop the transfer (CURLE_ABORTED_BY_CALLBACK) once check returns true; checked at least
+    // every 100 ms
+    void SetAbortCheck(std::function<bool()> check) {
+        should_abort = std::move(check);
+    }
+
+    // CURLOPT_WRITEFUNCTION with CURLOPT_WRITEDATA pointing at the BasicBufferedTransfer
+    static size_t WriteCallback(char* contents, size_t size, size_t nmemb, void* userp) {
+        size_t total = size * nmemb;
+        BasicBufferedTransfer* transfer = static_cast<BasicBufferedTransfer*>(userp);
+        if (transfer->writer->TryWrite(contents, total)) {
+            return total;
+        }
+        if (transfer->writer->Failed()) {
+            return 0;
+        }
+        transfer->last_refused = total;
+        transfer->paused_at = std::chrono::steady_clock::now();
+        transfer->paused = true;
+        return CURL_WRITEFUNC_PAUSE;
+    }
+
+    // Run the transfer on shared_multi if given (its connection cache outlives the transfer),
+    // else on a multi handle of its own
+    CURLcode Perform(CURL* curl, CURLM* shared_multi = nullptr) {
+        CURLM* multi = shared_multi ? shared_multi : curl_multi_init();
+        if (!multi) {
+            return CURLE_OUT_OF_MEMORY;
+        }
+        curl_multi_add_handle(multi, curl);
+        MemoryBudget& budget = MemoryBudget::Instance();
+
+        int running = 1;
+        CURLcode result = CURLE_OK;
+        bool waiting = false;
+        bool aborted = false;
+        while (running) {
+            if (should_abort && should_abort()) {
+                aborted = true;
+                break;
+            }
+            if (curl_multi_perform(multi, &running) != CURLM_OK) {
+                result = CURLE_FAILED_INIT;
+                break;
+            }
+            if (paused) {
+                if (!waiting) {
+                    budget.Wait(multi);
+                    waiting = true;
+                }
+                if (writer->HasRoom(last_refused) || writer->Failed()) {
+                    budget.StopWaiting(multi);
+                    waiting = false;
+                    budget.RecordPause(std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - paused_at).count());
+                    paused = false;
+                    // May call the write callback right away, which can pause again
+                    curl_easy_pause(curl, CURLPAUSE_CONT);
+                    continue;
+                }
+            }
+            if (running) {
+                curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+            }
+        }
+        if (waiting) {
+            budget.StopWaiting(multi);
+        }
+
+        int queued = 0;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+            if (msg->msg == CURLMSG_DONE && msg->easy_handle == curl) {
+                result = msg->data.result;
+            }
+        }
+        curl_multi_remove_handle(multi, curl);
+        if (!shared_multi) {
+            curl_multi_cleanup(multi);
+        }
+        return aborted ? CURLE_ABORTED_BY_CALLBACK : result;
+    }
+};
+
+using BufferedTransfer = BasicBufferedTransfer<>;
+
+#endif // STREAMWRITER_H
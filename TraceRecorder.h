@@ -0,0 +1,234 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <unistd.h>
+
+// Timeline tracer producing Chrome trace-event JSON (open in Perfetto or chrome://tracing).
+// Every thread records into its own fixed-size ring buffer, so recording a span is a
+// couple of stores with no locking and no allocation; when the ring wraps, the oldest
+// events are dropped. Tracing is off until Enable() is called, and a disabled tracer
+// costs one relaxed atomic load per span.
+class TraceRecorder {
+public:
+    // One recorded event. Names and categories must be string literals.
+    struct Event {
+        const char* category;
+        const char* name;
+        char phase;               // 'X' complete span, 'i' instant
+        long long ts_us;
+        long long dur_us;
+        int tid;
+        const char* arg_name;
+        long long arg;
+    };
+
+private:
+    static constexpr size_t kRingCapacity = 8192;
+
+    // Per-thread ring; written only by its owning thread
+    struct ThreadBuffer {
+        std::vector<Event> events;
+        std::atomic<unsigned long long> head{0};
+        ThreadBuffer() : events(kRingCapacity) {}
+    };
+
+    // Returns the thread's buffer to the pool when the thread exits
+    struct ThreadSlot {
+        ThreadBuffer* buffer = nullptr;
+        int tid = 0;
+        ~ThreadSlot() {
+            if (buffer) {
+                TraceRecorder::Instance().ReleaseBuffer(buffer);
+            }
+        }
+    };
+
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::vector<ThreadBuffer*> free_buffers;
+    std::vector<std::pair<int, std::string>> thread_names;
+    std::atomic<int> next_tid{1};
+
+    TraceRecorder() : epoch(std::chrono::steady_clock::now()) {}
+
+    ThreadSlot& LocalSlot() {
+        thread_local ThreadSlot slot;
+        if (!slot.buffer) {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            if (!free_buffers.empty()) {
+                slot.buffer = free_buffers.back();
+                free_buffers.pop_back();
+            } else {
+                buffers.emplace_back(new ThreadBuffer());
+                slot.buffer = buffers.back().get();
+            }
+            slot.tid = next_tid++;
+        }
+        return slot;
+    }
+
+    void ReleaseBuffer(ThreadBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        free_buffers.push_back(buffer);
+    }
+
+    static void WriteEscaped(std::ostream& out, const std::string& text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                out << ' ';
+            } else {
+                out << c;
+            }
+        }
+    }
+
+public:
+    static TraceRecorder& Instance() {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    void Enable() { enabled.store(true, std::memory_order_relaxed); }
+    void Disable() { enabled.store(false, std::memory_order_relaxed); }
+    bool IsEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // Microseconds since the recorder was created
+    long long NowMicros() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Record an event on the calling thread's ring
+    void Record(char phase, const char* category, const char* name, long long ts_us, long long dur_us,
+                const char* arg_name = nullptr, long long arg = 0) {
+        if (!IsEnabled()) return;
+        ThreadSlot& slot = LocalSlot();
+        ThreadBuffer* buffer = slot.buffer;
+        unsigned long long h = buffer->head.load(std::memory_order_relaxed);
+        Event& e = buffer->events[h % kRingCapacity];
+        e.category = category;
+        e.name = name;
+        e.phase = phase;
+        e.ts_us = ts_us;
+        e.dur_us = dur_us;
+        e.tid = slot.tid;
+        e.arg_name = arg_name;
+        e.arg = arg;
+        buffer->head.store(h + 1, std::memory_order_release);
+    }
+
+    // Record a span whose start time was measured earlier (e.g. connect time reported by curl)
+    void Complete(const char* category, const char* name, long long start_us, long long dur_us,
+                  const char* arg_name = nullptr, long long arg = 0) {
+        Record('X', category, name, start_us, dur_us < 0 ? 0 : dur_us, arg_name, arg);
+    }
+
+    // Record a point-in-time event
+    void Instant(const char* category, const char* name, const char* arg_name = nullptr, long long arg = 0) {
+        if (!IsEnabled()) return;
+        Record('i', category, name, NowMicros(), 0, arg_name, arg);
+    }
+
+    // Label the calling thread in the timeline
+    void SetThreadName(const std::string& name) {
+        if (!IsEnabled()) return;
+        int tid = LocalSlot().tid;
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        thread_names.emplace_back(tid, name);
+    }
+
+    // Write all retained events as Chrome trace-event JSON. Call once recording threads are idle.
+    bool WriteChromeTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            return false;
+        }
+
+        const int pid = static_cast<int>(getpid());
+        std::lock_guard<std::mutex> lock(registry_mutex);
+
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& entry : thread_names) {
+            out << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid
+                << ",\"tid\":" << entry.first << ",\"args\":{\"name\":\"";
+            WriteEscaped(out, entry.second);
+            out << "\"}}";
+            first = false;
+        }
+
+        for (const auto& buffer : buffers) {
+            unsigned long long head = buffer->head.load(std::memory_order_acquire);
+            unsigned long long begin = head > kRingCapacity ? head - kRingCapacity : 0;
+            for (unsigned long long i = begin; i < head; ++i) {
+                const Event& e = buffer->events[i % kRingCapacity];
+                out << (first ? "" : ",\n") << "{\"ph\":\"" << e.phase << "\",\"cat\":\"" << e.category
+                    << "\",\"name\":\"" << e.name << "\",\"pid\":" << pid << ",\"tid\":" << e.tid
+                    << ",\"ts\":" << e.ts_us;
+                if (e.phase == 'X') {
+                    out << ",\"dur\":" << e.dur_us;
+                } else {
+                    out << ",\"s\":\"t\"";
+                }
+                if (e.arg_name) {
+                    out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+                }
+                out << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        return out.good();
+    }
+};
+
+// RAII span covering the lifetime of the object
+class TraceSpan {
+private:
+    const char* category;
+    const char* name;
+    const char* arg_name;
+    long long arg;
+    long long start_us;
+    bool active;
+
+public:
+    TraceSpan(const char* category, const char* name, const char* arg_name = nullptr, long long arg = 0)
+        : category(category), name(name), arg_name(arg_name), arg(arg), start_us(0),
+          active(TraceRecorder::Instance().IsEnabled()) {
+        if (active) {
+            start_us = TraceRecorder::Instance().NowMicros();
+        }
+    }
+
+    ~TraceSpan() {
+        if (active) {
+            TraceRecorder& recorder = TraceRecorder::Instance();
+            recorder.Complete(category, name, start_us, recorder.NowMicros() - start_us, arg_name, arg);
+        }
+    }
+
+    // Replace the span argument (e.g. bytes transferred, known only at the end)
+    void SetArg(const char* new_arg_name, long long value) {
+        arg_name = new_arg_name;
+        arg = value;
+    }
+
+    long long StartMicros() const { return start_us; }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+#endif // TRACERECORDER_H
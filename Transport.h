@@ -0,0 +1,410 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <string>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <curl/curl.h>
+#include "Logger.h"
+#include "TraceRecorder.h"
+#include "SocketTuning.h"
+#include "StreamWriter.h"
+
+// Emit DNS / TCP connect / TLS handshake spans for a finished transfer, anchored at its start time
+static void TraceConnectPhases(CURL* curl, long long start_us, long long segment) {
+    TraceRecorder& tracer = TraceRecorder::Instance();
+    if (!tracer.IsEnabled()) return;
+
+    curl_off_t namelookup = 0, connect = 0, appconnect = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+
+    tracer.Complete("connect", "dns", start_us, namelookup, "segment", segment);
+    if (connect > 0) {
+        tracer.Complete("connect", "tcp_connect", start_us + namelookup, connect - namelookup, "segment", segment);
+    }
+    if (appconnect > connect) {
+        tracer.Complete("connect", "tls_handshake", start_us + connect, appconnect - connect, "segment", segment);
+    }
+}
+
+// One byte range of a resource, as the segment scheduler asks for it
+struct RangeRequest {
+    std::string url;
+    curl_off_t start_byte = 0;
+    curl_off_t end_byte = -1;
+    bool ranged = true;              // false: the whole resource, no range header
+    int segment_id = 0;
+    std::string resolve_entry;       // "host:port:address" pin to one server address, if any
+};
+
+// Microseconds from the start of a request, on the transport's clock
+struct TransferTiming {
+    long long connect_us = 0;        // connection (and TLS) established
+    long long first_byte_us = 0;
+    long long total_us = 0;
+};
+
+struct RangeResult {
+    bool ok = false;                 // the transfer ran to completion (whatever the status)
+    std::string error;
+    long status = 0;                 // HTTP status; 0 for protocols without one (FTP, SFTP)
+    long http_version = 0;           // CURL_HTTP_VERSION_* negotiated, 0 if unknown
+    curl_off_t received = 0;
+    TransferTiming timing;
+};
+
+// What the segment scheduler needs from the network: probe a resource, fetch byte ranges into
+// a sink, cancel what is in flight, and tell the time. MultithreadedDownloader runs on
+// CurlTransport by default; SimulatedTransport stands in for it in performance experiments.
+class Transport {
+public:
+    // Called with the bytes received so far by one transfer
+    using ProgressFn = std::function<void(curl_off_t received)>;
+
+    virtual ~Transport() = default;
+
+    // Size of the resource, or <= 0 if unknown; connections is how many will share the path
+    virtual curl_off_t Size(const std::string& url, int connections) = 0;
+
+    // Whether a range can be fetched on its own
+    virtual bool SupportsRanges(const std::string& url, curl_off_t size) = 0;
+
+    // Fetch one range into sink, blocking until it is complete, fails or is cancelled
+    virtual RangeResult Fetch(const RangeRequest& request, SegmentSink& sink, const ProgressFn& progress) = 0;
+
+    // Fetch for callers that know the concrete sink type (see DownloadEngine.h). This goes
+    // through the virtual Fetch; CurlTransport hides it with one instantiated for the sink.
+    template <class Sink>
+    RangeResult FetchInto(const RangeRequest& request, Sink& sink, const ProgressFn& progress) {
+        return Fetch(request, sink, progress);
+    }
+
+    // Abort every transfer in flight; transfers started afterwards are not affected
+    virtual void Cancel() = 0;
+
+    // Microseconds on the transport's clock (the wall clock, or virtual time)
+    virtual long long NowMicros() = 0;
+
+    // count worker threads are about to issue fetches; each calls WorkerDone() when it stops.
+    // A simulation only advances its clock once every worker is waiting on it; CurlTransport
+    // closes the worker's connection.
+    virtual void BeginWorkers(int count) {}
+    virtual void WorkerDone() {}
+};
+
+// The real network, through libcurl. Anything the caller wants on each segment handle (local
+// link binding, socket options, pacing) is applied by the handle setup hook, which runs again
+// for every segment. Each worker thread keeps its handle between segments, so consecutive
+// segments of a worker travel over one connection.
+class CurlTransport : public Transport {
+public:
+    using HandleSetup = std::function<void(CURL* curl, const RangeRequest& request)>;
+
+private:
+    HandleSetup handle_setup;
+    std::atomic<unsigned> generation{0};     // bumped by Cancel()
+
+    // A worker's easy handle and the multi handle whose connection cache holds its one
+    // connection. curl matches cached connections by host name, so a lane pinned to another
+    // address of the host must start over with a fresh cache.
+    struct Lane {
+        CURL* curl = nullptr;
+        CURLM* multi = nullptr;
+        std::string resolve_entry;
+    };
+    std::mutex lanes_mutex;
+    std::map<std::thread::id, Lane> lanes;
+
+    static void CloseLane(Lane& lane) {
+        if (lane.curl) curl_easy_cleanup(lane.curl);
+        if (lane.multi) curl_multi_cleanup(lane.multi);
+        lane.curl = nullptr;
+        lane.multi = nullptr;
+    }
+
+    // The calling thread's lane, reset for a request pinned to resolve_entry; nullptr if
+    // curl cannot allocate one. Only its own thread uses a lane, so it needs no lock after this.
+    Lane* AcquireLane(const std::string& resolve_entry) {
+        Lane* lane;
+        {
+            std::lock_guard<std::mutex> lock(lanes_mutex);
+            lane = &lanes[std::this_thread::get_id()];
+        }
+        if (lane->curl && lane->resolve_entry == resolve_entry) {
+            curl_easy_reset(lane->curl);
+            return lane;
+        }
+        CloseLane(*lane);
+        lane->curl = curl_easy_init();
+        lane->multi = curl_multi_init();
+        lane->resolve_entry = resolve_entry;
+        if (!lane->curl || !lane->multi) {
+            CloseLane(*lane);
+            return nullptr;
+        }
+        curl_multi_setopt(lane->multi, CURLMOPT_MAXCONNECTS, 1L);
+        return lane;
+    }
+
+    static std::string SchemeOf(const std::string& url) {
+        CURLU* parsed = curl_url();
+        char* part = nullptr;
+        std::string result = "http";
+        if (parsed && curl_url_set(parsed, CURLUPART_URL, url.c_str(), CURLU_NON_SUPPORT_SCHEME) == CURLUE_OK &&
+            curl_url_get(parsed, CURLUPART_SCHEME, &part, 0) == CURLUE_OK) {
+            result = part;
+        }
+        curl_free(part);
+        if (parsed) curl_url_cleanup(parsed);
+        return result;
+    }
+
+    static bool IsHttp(const std::string& url) {
+        std::string scheme = SchemeOf(url);
+        return scheme == "http" || scheme == "https";
+    }
+
+    static size_t DiscardCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+        return size * nmemb;
+    }
+
+    static int ProgressCallback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
+                                curl_off_t ultotal, curl_off_t ulnow) {
+        (*static_cast<const ProgressFn*>(clientp))(dlnow);
+        return 0;
+    }
+
+    // An FTP segment is REST <start> + RETR, cut off after its length. Servers without REST
+    // fail the transfer (CURLE_FTP_COULDNT_USE_REST), so fetch the first KB from offset 1 to find out.
+    bool SupportsFtpRestart(const std::string& url, curl_off_t size) {
+        TraceSpan span("probe", "rest_support");
+        bool supports_rest = false;
+        if (size < 2) {
+            return false;
+        }
+        CURL* curl = curl_easy_init();
+        if (curl) {
+            curl_off_t end = std::min<curl_off_t>(size - 1, 1024);
+            std::string range = "1-" + std::to_string(end);
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DiscardCallback);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+
+            CURLcode res = curl_easy_perform(curl);
+            curl_off_t received = 0;
+            curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+            if (res == CURLE_OK) {
+                supports_rest = received == end;
+                LogInfo() << "REST test - received " << received << " of " << end << " bytes";
+            } else {
+                LogInfo() << "REST test failed: " << curl_easy_strerror(res);
+            }
+            curl_easy_cleanup(curl);
+        }
+        return supports_rest;
+    }
+
+public:
+    ~CurlTransport() override {
+        for (auto& entry : lanes) {
+            CloseLane(entry.second);
+        }
+    }
+
+    void SetHandleSetup(HandleSetup setup) {
+        handle_setup = std::move(setup);
+    }
+
+    // HEAD request (SIZE for FTP, stat for SFTP)
+    curl_off_t Size(const std::string& url, int connections) override {
+        TraceSpan span("probe", "head_size");
+        CURL* curl;
+        CURLcode res;
+        curl_off_t file_size = 0;
+        TcpStats probe_stats;
+
+        curl = curl_easy_init();
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);  // HEAD request
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, DiscardCallback);  // FTP reports the size as text
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);  // 30 second timeout
+            SocketTuning::Instance().Apply(curl, &probe_stats);
+
+            res = curl_easy_perform(curl);
+            if (res == CURLE_OK) {
+                long response_code;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+                curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &file_size);
+
+                LogInfo() << "HEAD request - Response code: " << response_code;
+                LogInfo() << "Content-Length: " << file_size << " bytes";
+
+                // Check if response is successful (FTP answers SIZE with 213 and the last reply
+                // may be 350 to REST; SFTP has no status codes, a failed stat fails the request)
+                if (IsHttp(url) && (response_code < 200 || response_code >= 300)) {
+                    LogError() << "Server returned error code: " << response_code;
+                    file_size = 0;
+                }
+            } else {
+                LogError() << "HEAD request failed: " << curl_easy_strerror(res);
+            }
+            curl_easy_cleanup(curl);
+        }
+        // The probe's round trip sizes receive buffers when they follow the bandwidth-delay product
+        if (probe_stats.AverageRttMicros() > 0) {
+            SocketTuning::Instance().SetPath(probe_stats.AverageRttMicros(), connections);
+        }
+        return file_size;
+    }
+
+    // HTTP: a small range must come back as 206. FTP: REST must work. SFTP: always.
+    bool SupportsRanges(const std::string& url, curl_off_t size) override {
+        std::string scheme = SchemeOf(url);
+        if (scheme == "ftp" || scheme == "ftps") {
+            return SupportsFtpRestart(url, size);
+        }
+        if (scheme == "sftp") {
+            // SFTP reads at any offset of an open file; the stat in Size() gave the size
+            return true;
+        }
+        TraceSpan span("probe", "range_support");
+        CURL* curl;
+        CURLcode res;
+        bool supports_range = false;
+
+        curl = curl_easy_init();
+        if (curl) {
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+            curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+
+            // Set a small range to test
+            curl_easy_setopt(curl, CURLOPT_RANGE, "0-1023");
+
+            res = curl_easy_perform(curl);
+            if (res == CURLE_OK) {
+                long response_code;
+                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+                LogInfo() << "Range request test - Response code: " << response_code;
+                supports_range = (response_code == 206); // Partial Content
+            } else {
+                LogError() << "Range request test failed: " << curl_easy_strerror(res);
+            }
+            curl_easy_cleanup(curl);
+        }
+        return supports_range;
+    }
+
+    RangeResult Fetch(const RangeRequest& request, SegmentSink& sink, const ProgressFn& progress) override {
+        return FetchInto(request, sink, progress);
+    }
+
+    // The write callback is instantiated for Sink, so a final sink class is called directly
+    template <class Sink>
+    RangeResult FetchInto(const RangeRequest& request, Sink& sink, const ProgressFn& progress) {
+        RangeResult result;
+        Lane* lane = AcquireLane(request.resolve_entry);
+        if (!lane) {
+            result.error = curl_easy_strerror(CURLE_FAILED_INIT);
+            return result;
+        }
+        CURL* curl = lane->curl;
+        BasicBufferedTransfer<Sink> transfer(&sink);
+        unsigned started_generation = generation;
+        transfer.SetAbortCheck([this, started_generation] { return generation != started_generation; });
+
+        struct curl_slist* resolve = nullptr;
+        if (!request.resolve_entry.empty()) {
+            resolve = curl_slist_append(resolve, request.resolve_entry.c_str());
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, resolve);
+        }
+        if (handle_setup) {
+            handle_setup(curl, request);
+        }
+
+        curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+        std::string range = std::to_string(request.start_byte) + "-" + std::to_string(request.end_byte);
+        if (request.ranged) {
+            curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+        }
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, BasicBufferedTransfer<Sink>::WriteCallback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &transfer);
+
+        // No progress callback at all unless someone listens
+        if (progress) {
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, ProgressCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        }
+
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_USERAGENT, "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36");
+
+        CURLcode res;
+        {
+            TraceSpan span("transfer", "segment", "segment", request.segment_id);
+            res = transfer.Perform(curl, lane->multi);
+            TraceConnectPhases(curl, span.StartMicros(), request.segment_id);
+        }
+
+        result.ok = res == CURLE_OK;
+        if (!result.ok) {
+            result.error = curl_easy_strerror(res);
+        }
+        if (IsHttp(request.url)) {
+            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &result.status);
+        }
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &result.received);
+        curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &result.http_version);
+        curl_off_t connect = 0, appconnect = 0, first_byte = 0, total = 0;
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appconnect);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+        result.timing.connect_us = std::max(connect, appconnect);
+        result.timing.first_byte_us = first_byte;
+        result.timing.total_us = total;
+
+        // curl keeps a pointer to the resolve list until the handle is reset or cleaned up
+        curl_easy_setopt(curl, CURLOPT_RESOLVE, nullptr);
+        curl_slist_free_all(resolve);
+        return result;
+    }
+
+    void Cancel() override {
+        ++generation;
+    }
+
+    void WorkerDone() override {
+        std::lock_guard<std::mutex> lock(lanes_mutex);
+        auto lane = lanes.find(std::this_thread::get_id());
+        if (lane != lanes.end()) {
+            CloseLane(lane->second);
+            lanes.erase(lane);
+        }
+    }
+
+    long long NowMicros() override {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+#endif // TRANSPORT_H
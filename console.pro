@@ -3,7 +3,7 @@ CONFIG += c++17 console
 
 TARGET = downloader_console
 SOURCES += main_console.cpp MultiDownloader.cpp
-HEADERS += MultiDownloader.h
+HEADERS += MultiDownloader.h TraceRecorder.h Logger.h Sha256.h DownloadCache.h HttpRange.h DeltaDownloader.h RemoteFile.h AddressPool.h LinkPool.h SocketTuning.h Scavenger.h HostProfiles.h MemoryBudget.h StreamWriter.h ProgressiveDownloader.h CooperativeDownloader.h MiniHttpServer.h PeerSharing.h CachingProxy.h PieceManifest.h HttpMirror.h MultiUploader.h Transport.h SegmentQueue.h SimulatedTransport.h DownloadEngine.h Benchmark.h
 
 LIBS += -lcurl -pthread
 
@@ -4,13 +4,13 @@ CONFIG += c++17
 # Console version
 TARGET = downloader_console
 SOURCES += main_console.cpp MultiDownloader.cpp
-HEADERS += MultiDownloader.h
+HEADERS += MultiDownloader.h TraceRecorder.h Logger.h Sha256.h DownloadCache.h HttpRange.h DeltaDownloader.h RemoteFile.h AddressPool.h LinkPool.h SocketTuning.h Scavenger.h HostProfiles.h MemoryBudget.h StreamWriter.h ProgressiveDownloader.h CooperativeDownloader.h MiniHttpServer.h PeerSharing.h CachingProxy.h PieceManifest.h HttpMirror.h MultiUploader.h Transport.h SegmentQueue.h SimulatedTransport.h DownloadEngine.h Benchmark.h
 LIBS += -lcurl -pthread
 
 # GUI version
 TARGET = downloader_gui
 SOURCES += main_gui.cpp DownloaderGUI.cpp MultiDownloader.cpp
-HEADERS += DownloaderGUI.h MultiDownloader.h
+HEADERS += DownloaderGUI.h MultiDownloader.h TraceRecorder.h Logger.h Sha256.h DownloadCache.h HttpRange.h DeltaDownloader.h RemoteFile.h AddressPool.h LinkPool.h SocketTuning.h Scavenger.h HostProfiles.h MemoryBudget.h StreamWriter.h ProgressiveDownloader.h CooperativeDownloader.h MiniHttpServer.h PeerSharing.h CachingProxy.h PieceManifest.h HttpMirror.h MultiUploader.h Transport.h SegmentQueue.h SimulatedTransport.h DownloadEngine.h Benchmark.h LogModel.h
 LIBS += -lcurl -pthread
 
 # Default target
@@ -1,8 +1,375 @@
 #include "MultiDownloader.cpp"
 #include <iostream>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Publisher side of delta downloads: write <file>.mtdelta next to a file
+    if (argc >= 3 && strcmp(argv[1], "--make-delta-manifest") == 0) {
+        size_t block_size = argc >= 4 ? std::strtoull(argv[3], nullptr, 10) : 64 * 1024;
+        std::string manifest_path = std::string(argv[2]) + ".mtdelta";
+        if (!DeltaManifest::Generate(argv[2], block_size, manifest_path)) {
+            std::cerr << "Failed to write delta manifest for " << argv[2] << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << manifest_path << std::endl;
+        return 0;
+    }
+    
+    // Publisher side of piece-verified downloads: write <file>.pieces.json listing the mirrors
+    if (argc >= 4 && strcmp(argv[1], "--make-piece-manifest") == 0) {
+        std::vector<std::string> mirrors(argv + 4, argv + argc);
+        std::string manifest_path = std::string(argv[2]) + ".pieces.json";
+        if (!PieceManifest::Generate(argv[2], std::strtoll(argv[3], nullptr, 10), mirrors, manifest_path)) {
+            std::cerr << "Failed to write piece manifest for " << argv[2] << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << manifest_path << std::endl;
+        return 0;
+    }
+    
+    // DOWNLOADER_LOG_LEVEL=debug|info|warning|error|off; DOWNLOADER_QUIET=1 only prints errors
+    const char* log_level = std::getenv("DOWNLOADER_LOG_LEVEL");
+    if (log_level) {
+        if (strcmp(log_level, "debug") == 0) Logger::Instance().SetLevel(LogLevel::Debug);
+        else if (strcmp(log_level, "warning") == 0) Logger::Instance().SetLevel(LogLevel::Warning);
+        else if (strcmp(log_level, "error") == 0) Logger::Instance().SetLevel(LogLevel::Error);
+        else if (strcmp(log_level, "off") == 0) Logger::Instance().SetLevel(LogLevel::Off);
+    }
+    const char* quiet = std::getenv("DOWNLOADER_QUIET");
+    if (quiet && strcmp(quiet, "1") == 0) {
+        Logger::Instance().SetQuiet(true);
+    }
+    
+    // DOWNLOADER_MEMORY_MB caps data received but not yet written to disk (default 256)
+    const char* memory_mb = std::getenv("DOWNLOADER_MEMORY_MB");
+    if (memory_mb && *memory_mb) {
+        MemoryBudget::Instance().SetLimit(std::strtoll(memory_mb, nullptr, 10) * 1024 * 1024);
+    }
+    
+    // DOWNLOADER_TCP tunes download sockets, e.g. "cc=bbr,rcvbuf=bdp,bandwidth=1000" (see SocketTuning.h)
+    const char* tcp_options = std::getenv("DOWNLOADER_TCP");
+    if (tcp_options && *tcp_options) {
+        SocketTuning::Instance().Configure(tcp_options);
+    }
+    
+    // Opt-in timeline tracing: DOWNLOADER_TRACE=trace.json writes Chrome trace-event JSON on exit
+    const char* trace_path = std::getenv("DOWNLOADER_TRACE");
+    if (trace_path && *trace_path) {
+        TraceRecorder::Instance().Enable();
+        TraceRecorder::Instance().SetThreadName("main");
+    }
+    
+    // Read a byte range of a remote file to stdout without downloading the rest
+    if (argc >= 5 && strcmp(argv[1], "--pread") == 0) {
+        if (!log_level) {
+            Logger::Instance().SetLevel(LogLevel::Error);
+        }
+        size_t remaining = std::strtoull(argv[4], nullptr, 10);
+        bool opened;
+        {
+            RemoteFile remote(argv[2]);
+            opened = remote.Open();
+            curl_off_t offset = std::strtoll(argv[3], nullptr, 10);
+            if (opened && offset < 0) {
+                offset += remote.Size();   // negative offsets count from the end of the file
+            }
+            std::vector<char> buffer(1024 * 1024);
+            while (opened && remaining > 0) {
+                ssize_t got = remote.Pread(buffer.data(), std::min(buffer.size(), remaining), offset);
+                if (got <= 0) break;
+                std::cout.write(buffer.data(), got);
+                offset += got;
+                remaining -= got;
+            }
+        }
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return opened && remaining == 0 ? 0 : 1;
+    }
+    
+    // In-memory download: size the buffer from the probe, fetch into it and print its SHA-256
+    if (argc >= 3 && strcmp(argv[1], "--memory") == 0) {
+        if (!log_level) {
+            Logger::Instance().SetLevel(LogLevel::Warning);
+        }
+        MultithreadedDownloader downloader(argv[2], "", argc >= 4 ? atoi(argv[3]) : 4);
+        std::vector<char> buffer;
+        std::string_view view;
+        bool ok = downloader.DownloadToMemory([&buffer](size_t size) {
+            buffer.resize(size);
+            return buffer.data();
+        }, view);
+        if (ok) {
+            std::cout << Sha256::Hash(view.data(), view.size()) << "  " << view.size() << " bytes" << std::endl;
+        }
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Join (or start) a download shared with other processes and nodes through <file>.mtmap
+    if (argc >= 4 && strcmp(argv[1], "--cooperate") == 0) {
+        int num_threads = argc >= 5 ? atoi(argv[4]) : 4;
+        curl_off_t segment_mb = argc >= 6 ? std::strtoll(argv[5], nullptr, 10) : 16;
+        CooperativeDownloader downloader(argv[2], argv[3], num_threads, segment_mb * 1024 * 1024);
+        bool ok = downloader.Download();
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // LAN peer sharing: run a tracker, or download with help from peers registered with one
+    if (argc >= 3 && strcmp(argv[1], "--tracker") == 0) {
+        PeerTracker tracker;
+        if (!tracker.Start(atoi(argv[2]))) {
+            Logger::Instance().Flush();
+            return 1;
+        }
+        Logger::Instance().Flush();
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+    if (argc >= 5 && strcmp(argv[1], "--peer") == 0) {
+        int num_threads = argc >= 6 ? atoi(argv[5]) : 4;
+        int seed_seconds = argc >= 7 ? atoi(argv[6]) : 60;
+        int listen_port = argc >= 8 ? atoi(argv[7]) : 0;
+        PeerDownloader downloader(argv[2], argv[3], argv[4], num_threads, seed_seconds, listen_port);
+        bool ok = downloader.Download();
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Local forward proxy that accelerates and caches large downloads of other tools
+    if (argc >= 3 && strcmp(argv[1], "--proxy") == 0) {
+        const char* cache_dir = std::getenv("DOWNLOADER_CACHE_DIR");
+        const char* cache_max_mb = std::getenv("DOWNLOADER_CACHE_MAX_MB");
+        unsigned long long max_bytes = (cache_max_mb ? std::strtoull(cache_max_mb, nullptr, 10) : 10240ULL) * 1024 * 1024;
+        DownloadCache cache(cache_dir && *cache_dir ? cache_dir : DownloadCache::DefaultDirectory(), max_bytes);
+        CachingProxy proxy(&cache, argc >= 4 ? atoi(argv[3]) : 4);
+        if (!proxy.Start(atoi(argv[2]))) {
+            Logger::Instance().Flush();
+            return 1;
+        }
+        Logger::Instance().Flush();
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+    
+    // Mirror an HTTP directory tree: --mirror <url/> <dir> [parallel] [connections] [--delete]
+    if (argc >= 4 && strcmp(argv[1], "--mirror") == 0) {
+        std::vector<std::string> options(argv + 4, argv + argc);
+        bool delete_stale = std::find(options.begin(), options.end(), "--delete") != options.end();
+        options.erase(std::remove(options.begin(), options.end(), "--delete"), options.end());
+        int parallel = options.size() >= 1 ? atoi(options[0].c_str()) : 8;
+        int connections = options.size() >= 2 ? atoi(options[1].c_str()) : 4;
+        
+        // Small files are not worth the range probe; everything else uses the multi-connection engine
+        DirectoryMirror mirror(argv[2], argv[3], parallel,
+                               [connections](const std::string& url, const std::string& path, curl_off_t size) {
+            if (size >= 0 && size < 1024 * 1024) {
+                SingleThreadedDownloader downloader(url, path);
+                return downloader.Download();
+            }
+            MultithreadedDownloader downloader(url, path, connections);
+            return downloader.Download();
+        });
+        mirror.SetDeleteStale(delete_stale);
+        bool ok = mirror.Run();
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Parallel upload: --upload <file> <url> [threads] [--s3]; DOWNLOADER_S3_CREDENTIALS=key:secret
+    // (and DOWNLOADER_S3_REGION) sign the requests for S3 / MinIO
+    if (argc >= 4 && strcmp(argv[1], "--upload") == 0) {
+        std::vector<std::string> options(argv + 4, argv + argc);
+        bool s3 = std::find(options.begin(), options.end(), "--s3") != options.end();
+        options.erase(std::remove(options.begin(), options.end(), "--s3"), options.end());
+        int num_threads = options.size() >= 1 ? atoi(options[0].c_str()) : 4;
+        
+        MultithreadedUploader uploader(argv[2], argv[3], num_threads,
+                                       s3 ? MultithreadedUploader::Mode::S3Multipart
+                                          : MultithreadedUploader::Mode::ContentRange);
+        const char* s3_credentials = std::getenv("DOWNLOADER_S3_CREDENTIALS");
+        if (s3_credentials && *s3_credentials) {
+            const char* s3_region = std::getenv("DOWNLOADER_S3_REGION");
+            uploader.SetCredentials(s3_credentials, s3_region && *s3_region ? s3_region : "us-east-1");
+        }
+        bool ok = uploader.Upload();
+        if (ok) {
+            uploader.DisplayStats();
+        }
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Segmented download over a simulated network, on a virtual clock (see SimulatedTransport.h)
+    if (argc >= 4 && strcmp(argv[1], "--simulate") == 0) {
+        SimulatedNetwork network;
+        if (!network.Configure(argv[3])) {
+            LogError() << "Invalid simulation spec: " << argv[3];
+            Logger::Instance().Flush();
+            return 1;
+        }
+        SimulatedTransport simulation(network);
+        std::string output = argc >= 6 ? argv[5] : "";
+        MultithreadedDownloader downloader("sim://simulated", output, atoi(argv[2]));
+        downloader.SetTransport(&simulation);
+        downloader.SetAddressSpreading(false);
+        if (argc >= 5) {
+            downloader.SetSegmentSize(std::strtoll(argv[4], nullptr, 10) * 1024);
+        }
+        
+        auto wall_start = std::chrono::steady_clock::now();
+        bool ok;
+        if (output.empty()) {
+            std::vector<char> buffer;
+            std::string_view view;
+            ok = downloader.DownloadToMemory([&buffer](size_t size) {
+                buffer.resize(size);
+                return buffer.data();
+            }, view);
+            if (ok && !simulation.Verify(view.data(), view.size())) {
+                LogError() << "Simulated download does not match the resource";
+                ok = false;
+            }
+        } else {
+            ok = downloader.DownloadFromNetwork();
+        }
+        auto wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - wall_start).count();
+        
+        double virtual_seconds = simulation.NowMicros() / 1e6;
+        simulation.Log();
+        if (ok) {
+            downloader.DisplayStats();
+            std::cout << std::fixed << std::setprecision(3) << "Virtual time: " << virtual_seconds << " s, "
+                      << std::setprecision(1) << (virtual_seconds > 0 ? network.size * 8 / 1e6 / virtual_seconds : 0)
+                      << " Mbit/s (" << wall_ms << " ms wall)" << std::endl;
+        }
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // Plain segmented download on a compile-time engine (see DownloadEngine.h):
+    // --engine <url> <file> [threads] [pwrite|hash|memory|null]
+    if (argc >= 4 && strcmp(argv[1], "--engine") == 0) {
+        int num_threads = argc >= 5 ? atoi(argv[4]) : 4;
+        std::string sink = argc >= 6 ? argv[5] : "pwrite";
+        bool ok = false;
+        if (sink == "pwrite") {
+            PwriteDownloader downloader(argv[2], argv[3], num_threads);
+            ok = downloader.Download();
+            if (ok) downloader.DisplayStats();
+        } else if (sink == "hash") {
+            VerifyingDownloader downloader(argv[2], argv[3], num_threads);
+            ok = downloader.Download();
+            if (ok) {
+                downloader.DisplayStats();
+                for (const auto& digest : downloader.Target().Digests()) {
+                    std::cout << digest.second << "  @" << digest.first << std::endl;
+                }
+            }
+        } else if (sink == "memory") {
+            MemoryDownloader downloader(argv[2], "", num_threads);
+            ok = downloader.Download();
+            if (ok) {
+                downloader.DisplayStats();
+                std::string_view view = downloader.Target().View();
+                std::cout << Sha256::Hash(view.data(), view.size()) << "  " << view.size() << " bytes" << std::endl;
+            }
+        } else if (sink == "null") {
+            ThroughputProbe downloader(argv[2], "", num_threads);
+            ok = downloader.Download();
+            if (ok) downloader.DisplayStats();
+        } else {
+            LogError() << "Unknown sink: " << sink;
+        }
+        Logger::Instance().Flush();
+        if (trace_path && *trace_path) {
+            TraceRecorder::Instance().WriteChromeTrace(trace_path);
+        }
+        return ok ? 0 : 1;
+    }
+    
+    // A/B comparison (see Benchmark.h):
+    // --compare <url> [runs] [threads,threads,...] [--csv file] [--json file] [--no-bust]
+    if (argc >= 3 && strcmp(argv[1], "--compare") == 0) {
+        std::vector<std::string> options(argv + 3, argv + argc);
+        std::string csv_path;
+        std::string json_path;
+        bool cache_bust = true;
+        std::vector<std::string> positional;
+        for (size_t i = 0; i < options.size(); ++i) {
+            if (options[i] == "--csv" && i + 1 < options.size()) {
+                csv_path = options[++i];
+            } else if (options[i] == "--json" && i + 1 < options.size()) {
+                json_path = options[++i];
+            } else if (options[i] == "--no-bust") {
+                cache_bust = false;
+            } else {
+                positional.push_back(options[i]);
+            }
+        }
+        int runs = positional.size() >= 1 ? atoi(positional[0].c_str()) : 5;
+        std::string sweep = positional.size() >= 2 ? positional[1] : "2,4,8";
+        
+        DownloadComparison comparison(argv[2], runs, ".mtcompare.tmp");
+        comparison.SetCacheBusting(cache_bust);
+        comparison.AddVariant("single", 1, [](const std::string& url, const std::string& file) {
+            SingleThreadedDownloader downloader(url, file);
+            return downloader.Download();
+        });
+        for (size_t pos = 0; pos < sweep.size();) {
+            size_t comma = sweep.find(',', pos);
+            int threads = atoi(sweep.substr(pos, comma - pos).c_str());
+            if (threads > 0) {
+                comparison.AddVariant("multi-" + std::to_string(threads), threads,
+                                      [threads](const std::string& url, const std::string& file) {
+                    MultithreadedDownloader downloader(url, file, threads);
+                    return downloader.DownloadFromNetwork();
+                });
+            }
+            if (comma == std::string::npos) break;
+            pos = comma + 1;
+        }
+        
+        // Only the results: per-run logging would be noise between the timings
+        LogLevel level = Logger::Instance().Level();
+        Logger::Instance().SetLevel(LogLevel::Error);
+        bool ok = comparison.Run();
+        Logger::Instance().SetLevel(level);
+        if (ok) {
+            comparison.Report();
+            if (!csv_path.empty()) ok = comparison.WriteCsv(csv_path) && ok;
+            if (!json_path.empty()) ok = comparison.WriteJson(json_path) && ok;
+        }
+        Logger::Instance().Flush();
+        return ok ? 0 : 1;
+    }
+    
     std::cout << "=== File Downloader (Single-threaded vs Multithreaded) ===" << std::endl;
     std::cout << "This program demonstrates both single-threaded and multithreaded downloading." << std::endl;
     std::cout << "The multithreaded version automatically falls back to single-threaded if needed." << std::endl;
@@ -21,7 +388,10 @@ int main() {
     std::cout << "\nChoose download method:" << std::endl;
     std::cout << "1. Single-threaded download" << std::endl;
     std::cout << "2. Multithreaded download" << std::endl;
-    std::cout << "Enter choice (1 or 2): ";
+    std::cout << "3. Delta download against an older local copy" << std::endl;
+    std::cout << "4. Progressive download (start at once, fan out once the size is known)" << std::endl;
+    std::cout << "5. Piece-verified download (URL of a .meta4 or JSON piece manifest)" << std::endl;
+    std::cout << "Enter choice (1-5): ";
     std::cin >> choice;
     
     auto start_time = std::chrono::high_resolution_clock::now();
@@ -30,21 +400,102 @@ int main() {
         // Single-threaded download
         SingleThreadedDownloader downloader(download_url, output_filename);
         if (!downloader.Download()) {
-            std::cerr << "Download failed!" << std::endl;
+            LogError() << "Download failed!";
+            Logger::Instance().Flush();
             return 1;
         }
-    } else {
-        // Multithreaded download
+    } else if (choice == 3) {
+        // Delta download: reuse blocks of an older copy, fetch only what changed
+        std::string old_filename;
+        std::cout << "Enter path of the older local copy: ";
+        std::cin >> std::ws;
+        std::getline(std::cin, old_filename);
+        
+        DeltaDownloader downloader(download_url, old_filename, output_filename);
+        if (!downloader.Download()) {
+            LogWarning() << "Delta download failed, downloading the whole file instead";
+            MultithreadedDownloader fallback(download_url, output_filename);
+            if (!fallback.Download()) {
+                LogError() << "Download failed!";
+                Logger::Instance().Flush();
+                return 1;
+            }
+        }
+    } else if (choice == 4) {
+        // Progressive download: no probes, extra connections join once the headers allow it
         int num_threads = 4;
-        std::cout << "Enter number of threads (default 4): ";
+        std::cout << "Enter maximum number of connections (default 4): ";
         std::cin >> num_threads;
         if (num_threads <= 0) num_threads = 4;
         
+        ProgressiveDownloader downloader(download_url, output_filename, num_threads);
+        if (!downloader.Download()) {
+            LogError() << "Download failed!";
+            Logger::Instance().Flush();
+            return 1;
+        }
+    } else if (choice == 5) {
+        // Every piece is checked against the manifest as it lands; bad pieces are fetched again
+        int num_threads = 4;
+        std::cout << "Enter number of connections (default 4): ";
+        std::cin >> num_threads;
+        
+        PieceDownloader downloader(download_url, output_filename, num_threads);
+        if (!downloader.Download()) {
+            LogError() << "Download failed!";
+            Logger::Instance().Flush();
+            return 1;
+        }
+    } else {
+        // Multithreaded download
+        int num_threads = 0;
+        std::cout << "Enter number of threads (0 = learn per host): ";
+        std::cin >> num_threads;
+        if (num_threads < 0) num_threads = 0;
+        
         MultithreadedDownloader downloader(download_url, output_filename, num_threads);
+        
+        // Per-host tuning profiles seed the thread count and segment size; DOWNLOADER_PROFILES=0 disables
+        std::unique_ptr<HostProfileStore> profiles;
+        const char* profiles_flag = std::getenv("DOWNLOADER_PROFILES");
+        if (!(profiles_flag && strcmp(profiles_flag, "0") == 0)) {
+            const char* profile_dir = std::getenv("DOWNLOADER_PROFILE_DIR");
+            profiles = std::make_unique<HostProfileStore>(profile_dir && *profile_dir ? profile_dir
+                                                                                     : HostProfileStore::DefaultDirectory());
+            downloader.SetProfileStore(profiles.get());
+        }
+        
+        // DOWNLOADER_CACHE=1 (or DOWNLOADER_CACHE_DIR=<dir>) serves repeat downloads from a local cache
+        std::unique_ptr<DownloadCache> cache;
+        const char* cache_flag = std::getenv("DOWNLOADER_CACHE");
+        const char* cache_dir = std::getenv("DOWNLOADER_CACHE_DIR");
+        if ((cache_flag && strcmp(cache_flag, "1") == 0) || (cache_dir && *cache_dir)) {
+            const char* cache_max_mb = std::getenv("DOWNLOADER_CACHE_MAX_MB");
+            unsigned long long max_bytes = (cache_max_mb ? std::strtoull(cache_max_mb, nullptr, 10) : 10240ULL) * 1024 * 1024;
+            cache = std::make_unique<DownloadCache>(cache_dir && *cache_dir ? cache_dir : DownloadCache::DefaultDirectory(),
+                                                    max_bytes);
+            downloader.SetCache(cache.get());
+        }
+        
+        // DOWNLOADER_SCAVENGER=1 yields to other traffic, keeping added queuing delay under
+        // DOWNLOADER_SCAVENGER_TARGET_MS (default 25)
+        const char* scavenger_flag = std::getenv("DOWNLOADER_SCAVENGER");
+        if (scavenger_flag && strcmp(scavenger_flag, "1") == 0) {
+            const char* target_ms = std::getenv("DOWNLOADER_SCAVENGER_TARGET_MS");
+            downloader.SetScavenger(target_ms ? atoi(target_ms) : 0);
+        }
+        
+        // DOWNLOADER_SOURCES=eth0,eth1 (or local addresses) spreads segments across several uplinks
+        const char* sources = std::getenv("DOWNLOADER_SOURCES");
+        if (sources && *sources && downloader.SetSourceLinks(sources) == 0) {
+            LogWarning() << "None of DOWNLOADER_SOURCES is usable; using the default route";
+        }
+        
         if (downloader.Download()) {
             downloader.DisplayStats();
         } else {
-            std::cerr << "Download failed!" << std::endl;
+            LogError() << "Download failed!";
+            Logger::Instance().Flush();
             return 1;
         }
     }
@@ -52,8 +503,17 @@ int main() {
     auto end_time = std::chrono::high_resolution_clock::now();
     auto total_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
     
-    std::cout << "\n=== Total Program Time ===" << std::endl;
-    std::cout << "Total execution time: " << total_duration.count() << " ms" << std::endl;
+    LogInfo() << "\n=== Total Program Time ===";
+    LogInfo() << "Total execution time: " << total_duration.count() << " ms";
+    Logger::Instance().Flush();
+    
+    if (trace_path && *trace_path) {
+        if (TraceRecorder::Instance().WriteChromeTrace(trace_path)) {
+            std::cout << "Trace written to " << trace_path << std::endl;
+        } else {
+            std::cerr << "Failed to write trace file: " << trace_path << std::endl;
+        }
+    }
     
     return 0;
 } 
\ No newline at end of file